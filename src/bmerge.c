@@ -36,6 +36,7 @@ static Rboolean rollToNearest=FALSE;
 #define XIND(i) (xo ? xo[(i)]-1 : i)
 
 void bmerge_r(int xlow, int xupp, int ilow, int iupp, int col, int thisgrp, int lowmax, int uppmax);
+static Rboolean bmerge_packed(int xN, int iN);
 
 SEXP bmerge(SEXP iArg, SEXP xArg, SEXP icolsArg, SEXP xcolsArg, SEXP isorted, SEXP xoArg, SEXP rollarg, SEXP rollendsArg, SEXP nomatchArg, SEXP multArg, SEXP opArg, SEXP nqgrpArg, SEXP nqmaxgrpArg) {
     int xN, iN, protecti=0;
@@ -139,15 +140,6 @@ SEXP bmerge(SEXP iArg, SEXP xArg, SEXP icolsArg, SEXP xcolsArg, SEXP isorted, SE
     allGrp1[0] = TRUE;
     protecti += 2;
 
-    // isorted arg
-    o = NULL;
-    if (!LOGICAL(isorted)[0]) {
-        SEXP order = PROTECT(vec_init(length(icolsArg), ScalarInteger(1))); // rep(1, length(icolsArg))
-        SEXP oSxp = PROTECT(forder(i, icolsArg, ScalarLogical(FALSE), ScalarLogical(TRUE), order, ScalarLogical(FALSE)));
-        protecti += 2;
-        if (!LENGTH(oSxp)) o = NULL; else o = INTEGER(oSxp);
-    }
-
     // xo arg
     xo = NULL;
     if (length(xoArg)) {
@@ -155,8 +147,21 @@ SEXP bmerge(SEXP iArg, SEXP xArg, SEXP icolsArg, SEXP xcolsArg, SEXP isorted, SE
         xo = INTEGER(xoArg);
     }
 
+    // a multi-column equi join on integer columns whose key fits in 64 bits packs each row's key into one integer, sorts
+    // i by its packed key (itself, so forder isn't needed) and merges it against x. It reads x through xo, so set above.
+    Rboolean packed = bmerge_packed(xN, iN);
+
+    // isorted arg
+    o = NULL;
+    if (!packed && !LOGICAL(isorted)[0]) {
+        SEXP order = PROTECT(vec_init(length(icolsArg), ScalarInteger(1))); // rep(1, length(icolsArg))
+        SEXP oSxp = PROTECT(forder(i, icolsArg, ScalarLogical(FALSE), ScalarLogical(TRUE), order, ScalarLogical(FALSE), ScalarLogical(FALSE)));
+        protecti += 2;
+        if (!LENGTH(oSxp)) o = NULL; else o = INTEGER(oSxp);
+    }
+
     // start bmerge
-    if (iN) {
+    if (iN && !packed) {
         // embarassingly parallel if we've storage space for nqmaxgrp*iN
         for (int kk=0; kk<nqmaxgrp; kk++) {
             bmerge_r(-1,xN,-1,iN,scols,kk+1,1,1);
@@ -195,6 +200,137 @@ SEXP bmerge(SEXP iArg, SEXP xArg, SEXP icolsArg, SEXP xcolsArg, SEXP isorted, SE
     return (ans);
 }
 
+/*
+Composite key packing, the alternative to bmerge_r column by column. When all the join columns are integer (including logical
+and factor), the join is == on all of them with no roll, and each x column's range plus a value for NA fits in 64 bits between
+them, each x row is packed into one unsigned key with the first column in the most significant bits. As x is sorted by
+those columns the packed keys are sorted too. i is packed the same way, its keys sorted in one radix pass (i values outside
+the range of that x column can't match and are left out) and then merged against x's keys, each comparison being a single
+one however many columns there are. The sorted i keys are split into one chunk per thread. It costs a pass through x, so
+it's only used when i is large enough relative to x for that to pay off.
+*/
+// The first position in [lo,n) of the sorted keys xk whose key is >= key (or > key when upper). Gallops out from lo first
+// so that a run of nearby sorted keys costs a few steps each rather than a full binary search.
+static int gallop(const unsigned long long *xk, int lo, int n, unsigned long long key, Rboolean upper)
+{
+    int hi = lo;
+    long long step = 1;
+    while (hi < n && (upper ? xk[hi] <= key : xk[hi] < key)) {
+        lo = hi+1;
+        hi = (n-hi > step) ? hi+step : n;
+        step <<= 1;
+    }
+    while (lo < hi) {
+        int mid = lo + (hi-lo)/2;
+        if (upper ? xk[mid] <= key : xk[mid] < key) lo = mid+1; else hi = mid;
+    }
+    return lo;
+}
+
+static Rboolean bmerge_packed(int xN, int iN)
+{
+    if (ncol < 2 || nqmaxgrp != 1 || scols != 0 || roll != 0.0 || xN < 1 || (double)iN * ncol < xN) return FALSE;
+    int xmin[ncol], xmax[ncol], bits[ncol], totbits = 0;
+    for (int col=0; col<ncol; col++) {
+        if (op[col] != EQ) return FALSE;
+        SEXP xc = VECTOR_ELT(x, xcols[col]-1);
+        if (TYPEOF(xc) != INTSXP && TYPEOF(xc) != LGLSXP) return FALSE;
+        const int *xd = INTEGER(xc);
+        xmin[col] = xmax[col] = NA_INTEGER;
+        for (int r=0; r<xN; r++) {
+            if (xd[r] == NA_INTEGER) continue;
+            if (xmin[col] == NA_INTEGER) xmin[col] = xmax[col] = xd[r];
+            else if (xd[r] < xmin[col]) xmin[col] = xd[r];
+            else if (xd[r] > xmax[col]) xmax[col] = xd[r];
+        }
+        long long nvals = (xmin[col] == NA_INTEGER) ? 1 : (long long)xmax[col] - xmin[col] + 2;   // +1 for NA
+        bits[col] = 0;
+        while ((1LL << bits[col]) < nvals) bits[col]++;
+        if ((totbits += bits[col]) > 64) return FALSE;
+    }
+    unsigned long long *xk = malloc(xN * sizeof(unsigned long long));
+    if (xk == NULL) return FALSE;                                   // bmerge_r needs no working memory
+    memset(xk, 0, xN * sizeof(unsigned long long));
+    for (int col=0; col<ncol; col++) {
+        const int *xd = INTEGER(VECTOR_ELT(x, xcols[col]-1));
+        int thismin = xmin[col], thisbits = bits[col];
+        if (!thisbits) continue;                                    // all NA
+        for (int r=0; r<xN; r++) {
+            int v = xd[XIND(r)];
+            xk[r] = (xk[r] << thisbits) | (v == NA_INTEGER ? 0 : (unsigned long long)((long long)v - thismin + 1));
+        }
+    }
+    for (int r=1; r<xN; r++) if (xk[r] < xk[r-1]) { free(xk); return FALSE; }   // not sorted by these columns; can't happen
+    // Pack i the same way. A row with a value outside the range of that x column can't match so gets irow -1 and keeps its
+    // nomatch default.
+    size_t nalloc = iN ? iN : 1;
+    unsigned long long *ik = malloc(nalloc * sizeof(unsigned long long)), *sk = malloc(nalloc * sizeof(unsigned long long));
+    int *irow = malloc(nalloc * sizeof(int)), *so = malloc(nalloc * sizeof(int)), *wo = malloc(nalloc * sizeof(int));
+    if (!ik || !sk || !irow || !so || !wo) {
+        free(xk); free(ik); free(sk); free(irow); free(so); free(wo);
+        return FALSE;
+    }
+    const int *icol[ncol];
+    for (int col=0; col<ncol; col++) icol[col] = INTEGER(VECTOR_ELT(i, icols[col]-1));
+    int nth = getDTthreads();
+    #pragma omp parallel for num_threads(nth)
+    for (int ir=0; ir<iN; ir++) {
+        unsigned long long ikey = 0;
+        int col;
+        for (col=0; col<ncol; col++) {
+            int v = icol[col][ir];
+            if (!bits[col]) { if (v != NA_INTEGER) break; continue; }
+            if (v == NA_INTEGER) { ikey <<= bits[col]; continue; }
+            if (v < xmin[col] || v > xmax[col] || xmin[col] == NA_INTEGER) break;   // no x row has this value
+            ikey = (ikey << bits[col]) | (unsigned long long)((long long)v - xmin[col] + 1);
+        }
+        ik[ir] = ikey;
+        irow[ir] = (col < ncol) ? -1 : ir;
+    }
+    int m = 0;
+    Rboolean iSorted = TRUE;
+    for (int ir=0; ir<iN; ir++) {
+        if (irow[ir] < 0) continue;
+        if (m && ik[ir] < ik[m-1]) iSorted = FALSE;
+        ik[m] = ik[ir];
+        irow[m++] = ir;
+    }
+    // Random binary searches into a large x miss cache at every step, which is what bmerge_r avoids by sorting i first.
+    // So do the same here: sort the packed i keys (a single stable radix sort) unless they're already in order, then
+    // merge them against x with galloping searches that start where the previous key finished.
+    if (!iSorted) {
+        if (fsort_keys(ik, sk, so, wo, m, nth, FALSE)) {
+            free(xk); free(ik); free(sk); free(irow); free(so); free(wo);
+            return FALSE;
+        }
+        for (int k=0; k<m; k++) wo[k] = irow[so[k]-1];
+        unsigned long long *tk = ik; ik = sk; sk = tk;
+        int *to = irow; irow = wo; wo = to;
+    }
+    int anyLong = 0, nchunk = (m < 1024) ? 1 : nth;   // each chunk starts with one full binary search
+    #pragma omp parallel for num_threads(nchunk) reduction(|:anyLong)
+    for (int c=0; c<nchunk; c++) {
+        int from = (int)((long long)m * c / nchunk), to = (int)((long long)m * (c+1) / nchunk);
+        if (from == to) continue;
+        int pos = gallop(xk, 0, xN, ik[from], FALSE), first = 0, len = 0;
+        for (int k=from; k<to; k++) {
+            if (k == from || ik[k] != ik[k-1]) {
+                first = gallop(xk, pos, xN, ik[k], FALSE);
+                pos = gallop(xk, first, xN, ik[k], TRUE);
+                len = pos - first;
+            }
+            if (!len) continue;
+            int ir = irow[k];
+            retFirst[ir] = (mult != LAST) ? first+1 : pos;             // 1-based
+            retLength[ir] = (mult == ALL) ? len : 1;
+            if (mult == ALL && len > 1) anyLong = 1;
+        }
+    }
+    if (anyLong) allLen1[0] = FALSE;
+    free(xk); free(ik); free(sk); free(irow); free(so); free(wo);
+    return TRUE;
+}
+
 static union {
   int i;
   double d;
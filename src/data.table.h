@@ -55,11 +55,19 @@ Rboolean isDatatable(SEXP x);
 int StrCmp(SEXP x, SEXP y);
 unsigned long long dtwiddle(void *p, int i, int order);
 unsigned long long i64twiddle(void *p, int i, int order);
+unsigned long long dtwiddle_na(void *p, int i, int order, int nalast);
+unsigned long long i64twiddle_na(void *p, int i, int order, int nalast);
 unsigned long long (*twiddle)(void *, int, int);
-SEXP forder(SEXP DT, SEXP by, SEXP retGrp, SEXP sortStrArg, SEXP orderArg, SEXP naArg);
+SEXP forder(SEXP DT, SEXP by, SEXP retGrp, SEXP sortStrArg, SEXP orderArg, SEXP naArg, SEXP collateArg);
+
+// fsort.c
+int fsort_keys(unsigned long long *xk, unsigned long long *sk, int *so, int *wo, R_xlen_t n, int nth, Rboolean verbose);
+int ksort_buckets(unsigned long long *x, int *o, unsigned long long *wx, int *wo, const R_xlen_t *from, const R_xlen_t *len,
+                  int nbucket, unsigned long long min, int fromBit, int toBit, R_xlen_t grain, int nth);
 
 // reorder.c
 SEXP reorder(SEXP x, SEXP order);
+SEXP extsort(SEXP x, SEXP by, SEXP orderArg, SEXP naArg, SEXP budgetArg, SEXP pathArg, SEXP verboseArg);
 
 // fcast.c
 SEXP vec_init(R_len_t n, SEXP val);
@@ -1,72 +1,149 @@
 #include "data.table.h"
+#include <stdarg.h>
+#include <stdint.h>
 // #define TIMING_ON
 
 /* 
     - Only forder() and *twiddle() functions are meant for use by other C code in data.table, hence all other functions here except forder and *twiddle are static.
-    - The static functions here make use of global variables, whose scope is limited to the same translation unit; therefore access from outside this file must be via forder and/or *twiddle only. 
+    - The working state of a sort is held in a sortContext which the static functions here take as their first argument, rather than in static
+      globals. So two sorts never share state and can run at the same time; e.g. from different threads. Contexts are kept in a small pool between
+      calls so that their working memory is reused by the next sort rather than allocated afresh each time. The exception is character columns
+      under N_PAR rows, which still use R's global TRUELENGTH (see csort_pre and cgroup) and savetl, so at most one such sort may be running at
+      once. Larger character columns are ranked via a private hash instead (see shash_pre).
     - The coding techniques deployed here are for efficiency; e.g. i) the static functions are recursive or called repetitively and we wish to minimise stack overhead, or ii) reach outside themselves to place results in the end result directly rather than returning small bits of memory.
 */
 
-static int *gs[2] = {NULL};                                         // gs = groupsizes e.g. 23,12,87,2,1,34,...
-static int flip = 0;                                                // two vectors flip flopped: flip and 1-flip
-static int gsalloc[2] = {0};                                        // allocated stack size
-static int gsngrp[2] = {0};                                         // used
-static int gsmax[2] = {0};                                          // max grpn so far
-static int gsmaxalloc = 0;                                          // max size of stack, set by forder to nrows
-static Rboolean stackgrps = TRUE;                                   // switched off for last column when not needed by setkey
-static Rboolean sortStr = TRUE;                                     // TRUE for setkey, FALSE for by=
-static int *newo = NULL;                                            // used by forder and [i|d|c]sort to reorder order. not needed if length(by)==1
-
-static int nalast = -1;                                             // =1, 0, -1 for TRUE, NA, FALSE respectively. Value rewritten inside forder().
-                                                                    // note that na.last=NA (0) removes NAs, not retains them.
-static int order = 1;                                               // =1, -1 for ascending and descending order respectively
-
 #define N_SMALL 200                                                 // replaced n < 200 with n < N_SMALL. Easier to change later
 #define N_RANGE 100000                                              // range limit for counting sort. UPDATE: should be less than INT_MAX (see setRange for details)
 
-#define Error(...) do {savetl_end(); error(__VA_ARGS__);} while(0)  // http://gcc.gnu.org/onlinedocs/cpp/Swallowing-the-Semicolon.html#Swallowing-the-Semicolon
+struct radixWork;
+
+struct strHash {
+    SEXP *s; int *v;                                                // open addressing on the CHARSXP pointer; empty slots are NULL
+    size_t mask;                                                    // number of slots - 1, a power of 2
+    int n;                                                          // used
+};
+
+struct sortContext {
+    int *gs[2];                                                     // gs = groupsizes e.g. 23,12,87,2,1,34,...
+    int flip;                                                       // two vectors flip flopped: flip and 1-flip
+    int gsalloc[2];                                                 // allocated stack size
+    int gsngrp[2];                                                  // used
+    int gsmax[2];                                                   // max grpn so far
+    int gsmaxalloc;                                                 // max size of stack, set by forder to nrows
+    Rboolean stackgrps;                                             // switched off for last column when not needed by setkey
+    Rboolean sortStr;                                               // TRUE for setkey, FALSE for by=
+    Rboolean collate;                                               // sort strings by their strxfrm keys in the collating locale rather than by bytes
+    int *newo, newo_alloc;                                          // used by forder and [i|d|c]sort to reorder order. not needed if length(by)==1
+    void *xsub; int xsub_alloc;                                     // forder's copy of a group of the next column, 8 bytes per item
+    
+    int nalast;                                                     // =1, 0, -1 for TRUE, NA, FALSE respectively. Set by forder() for each call.
+                                                                    // note that na.last=NA (0) removes NAs, not retains them.
+    int order;                                                      // =1, -1 for ascending and descending order respectively. Set for each column.
+    unsigned long long (*twiddle)(void *, int, int, int);           // dtwiddle_na or i64twiddle_na for the column being sorted
+    Rboolean (*is_nan)(void *, int);                                // dnan or i64nan, likewise
+    
+    int range, xmin;                                                // used by both icount and forder
+    unsigned int *icounts;                                          // N_RANGE+1 counts for icount, left all 0 after use
+    int skip[8];                                                    // set by iradix and dradix for their recursion
+    unsigned int *batchcounts; int batchcounts_alloc;               // see iradix
+    struct radixWork *work; int nwork;                              // one per thread, see iradix
+    int *csort_otmp, csort_otmp_alloc;
+    int *cradix_counts, cradix_counts_alloc, maxlen;
+    SEXP *cradix_xtmp; int cradix_xtmp_alloc;
+    SEXP *ustr; int ustr_alloc, ustr_n;
+    Rboolean tl;                                                    // savetl_init() has been called, so TRUELENGTH must be restored on error
+    
+    Rboolean strhash;                                               // large character columns are ranked via hash below rather than TRUELENGTH
+    struct strHash hash;                                            // CHARSXP -> its index in hstr
+    SEXP *hstr; int hstr_alloc, hstr_n;                             // unique strings in first appearance order
+    int *hrank, hrank_alloc, hrank_n;                               // sorted rank of each of the first hrank_n of hstr; NA_INTEGER for NA
+};
+
+#define CTX_POOL 8                                                  // contexts kept for reuse between calls
+#define CTX_RETAIN 1048576                                          // working memory up to this many items stays with a pooled context; larger is freed
+
+static struct sortContext *ctxPool[CTX_POOL];
+static int nctxPool = 0;
+
+static void ctx_free(struct sortContext *ctx);
+static void ctx_abort(struct sortContext *ctx);
+
+static void ctx_error(struct sortContext *ctx, const char *format, ...) {
+    // the message is formatted before the context is freed as it may refer to the context
+    char msg[1000];
+    va_list ap;
+    va_start(ap, format);
+    vsnprintf(msg, 1000, format, ap);
+    va_end(ap);
+    ctx_abort(ctx);
+    error("%s", msg);
+}
+#define Error(...) ctx_error(ctx, __VA_ARGS__)                      // restores any saved TRUELENGTH and frees the context before error()
 #undef warning
 #define warning(...) Do not use warning in this file                // since it can be turned to error via warn=2
 /* use malloc/realloc (not Calloc/Realloc) so we can trap errors 
-and call savetl_end() before the error(). */
+and call ctx_abort() before the error(). */
 
-static void growstack(int newlen) {
-    if (newlen==0) newlen=100000;                                   // no link to icount range restriction, just 100,000 seems a good minimum at 0.4MB.
-    if (newlen>gsmaxalloc) newlen=gsmaxalloc;
-    gs[flip] = realloc(gs[flip], newlen*sizeof(int));
-    if (gs[flip] == NULL) Error("Failed to realloc working memory stack to %d*4bytes (flip=%d)", newlen, flip);
-    gsalloc[flip] = newlen;
+static struct sortContext *ctx_get() {
+    struct sortContext *ctx = NULL;
+    #pragma omp critical(forderPool)
+    {
+        if (nctxPool) ctx = ctxPool[--nctxPool];
+    }
+    if (ctx == NULL) {
+        ctx = (struct sortContext *)calloc(1, sizeof(struct sortContext));
+        if (ctx == NULL) error("Failed to allocate a sort context of %d bytes", sizeof(struct sortContext));
+    }
+    ctx->flip = 0;
+    ctx->gsngrp[0] = ctx->gsngrp[1] = 0;
+    ctx->gsmax[0] = ctx->gsmax[1] = 0;
+    ctx->gsmaxalloc = 0;
+    ctx->stackgrps = TRUE;
+    ctx->sortStr = TRUE;
+    ctx->collate = FALSE;
+    ctx->nalast = -1;
+    ctx->order = 1;
+    ctx->twiddle = NULL;
+    ctx->is_nan = NULL;
+    ctx->maxlen = 1;                                                // Minimum needed to count "" and NA
+    ctx->ustr_n = 0;
+    ctx->tl = FALSE;
+    ctx->strhash = FALSE;
+    ctx->hstr_n = ctx->hrank_n = 0;                                 // hash is emptied by ctx_put
+    return ctx;
 }
 
-static void push(int x) {
-    if (!stackgrps || x==0) return;
-    if (gsalloc[flip] == gsngrp[flip]) growstack(gsngrp[flip]*2);
-    gs[flip][gsngrp[flip]++] = x;
-    if (x > gsmax[flip]) gsmax[flip] = x;
+static void growstack(struct sortContext *ctx, int newlen) {
+    if (newlen==0) newlen=100000;                                   // no link to icount range restriction, just 100,000 seems a good minimum at 0.4MB.
+    if (newlen>ctx->gsmaxalloc) newlen=ctx->gsmaxalloc;
+    int flip = ctx->flip;
+    ctx->gs[flip] = realloc(ctx->gs[flip], newlen*sizeof(int));
+    if (ctx->gs[flip] == NULL) Error("Failed to realloc working memory stack to %d*4bytes (flip=%d)", newlen, flip);
+    ctx->gsalloc[flip] = newlen;
 }
 
-static void mpush(int x, int n) {
-    if (!stackgrps || x==0) return;
-    if (gsalloc[flip] < gsngrp[flip]+n) growstack((gsngrp[flip]+n)*2);
-    for (int i=0; i<n; i++) gs[flip][gsngrp[flip]++] = x;
-    if (x > gsmax[flip]) gsmax[flip] = x;
+static void push(struct sortContext *ctx, int x) {
+    if (!ctx->stackgrps || x==0) return;
+    int flip = ctx->flip;
+    if (ctx->gsalloc[flip] == ctx->gsngrp[flip]) growstack(ctx, ctx->gsngrp[flip]*2);
+    ctx->gs[flip][ctx->gsngrp[flip]++] = x;
+    if (x > ctx->gsmax[flip]) ctx->gsmax[flip] = x;
 }
 
-static void flipflop() {
-    flip = 1-flip;
-    gsngrp[flip] = 0;
-    gsmax[flip] = 0;
-    if (gsalloc[flip] < gsalloc[1-flip]) growstack(gsalloc[1-flip]*2);
+static void mpush(struct sortContext *ctx, int x, int n) {
+    if (!ctx->stackgrps || x==0) return;
+    int flip = ctx->flip;
+    if (ctx->gsalloc[flip] < ctx->gsngrp[flip]+n) growstack(ctx, (ctx->gsngrp[flip]+n)*2);
+    for (int i=0; i<n; i++) ctx->gs[flip][ctx->gsngrp[flip]++] = x;
+    if (x > ctx->gsmax[flip]) ctx->gsmax[flip] = x;
 }
 
-static void gsfree() {
-    free(gs[0]); free(gs[1]);
-    gs[0] = NULL; gs[1]= NULL;
-    flip = 0;
-    gsalloc[0] = gsalloc[1] = 0;
-    gsngrp[0] = gsngrp[1] = 0;
-    gsmax[0] = gsmax[1] = 0;
-    gsmaxalloc = 0;
+static void flipflop(struct sortContext *ctx) {
+    int flip = ctx->flip = 1-ctx->flip;
+    ctx->gsngrp[flip] = 0;
+    ctx->gsmax[flip] = 0;
+    if (ctx->gsalloc[flip] < ctx->gsalloc[1-flip]) growstack(ctx, ctx->gsalloc[1-flip]*2);
 }
 
 #ifdef TIMING_ON
@@ -93,11 +170,10 @@ static void gsfree() {
      3. Separated setRange so forder can redirect to iradix
 */
 
-static int range, xmin;                                                  // used by both icount and forder
-static void setRange(int *x, int n)
+static void setRange(struct sortContext *ctx, int *x, int n)
 {
     int i, tmp;
-    xmin = NA_INTEGER;     // used by forder
+    int xmin = NA_INTEGER; // used by forder
     int xmax = NA_INTEGER; // declared locally as we only need xmin outside
     double overflow;
     
@@ -110,22 +186,24 @@ static void setRange(int *x, int n)
         if (tmp > xmax) xmax = tmp;
         else if (tmp < xmin) xmin = tmp;
     }
-    if(xmin == NA_INTEGER) {range = NA_INTEGER; return;}                    // all NAs, nothing to do    
+    ctx->xmin = xmin;
+    if(xmin == NA_INTEGER) {ctx->range = NA_INTEGER; return;}               // all NAs, nothing to do    
     
     overflow = (double)xmax - (double)xmin + 1;                             // ex: x=c(-2147483647L, NA_integer_, 1L) results in overflowing int range.
-    if (overflow > INT_MAX) {range = INT_MAX; return;}                      // detect and force iradix here, since icount is out of the picture
-    range = xmax-xmin+1;
+    if (overflow > INT_MAX) {ctx->range = INT_MAX; return;}                 // detect and force iradix here, since icount is out of the picture
+    ctx->range = xmax-xmin+1;
     
     return;
 }
 
 // x*order results in integer overflow when -1*NA, so careful to avoid that here :
-static inline int icheck(int x) {
-    return ((nalast != 1) ? ((x != NA_INTEGER) ? x*order : x) : ((x != NA_INTEGER) ? (x*order)-1 : INT_MAX)); // if nalast==1, NAs must go last.
+static inline int icheck(const struct sortContext *ctx, int x) {
+    int order = ctx->order;
+    return ((ctx->nalast != 1) ? ((x != NA_INTEGER) ? x*order : x) : ((x != NA_INTEGER) ? (x*order)-1 : INT_MAX)); // if nalast==1, NAs must go last.
 }
 
 
-static void icount(int *x, int *o, int n)
+static void icount(struct sortContext *ctx, int *x, int *o, int n)
 /* Counting sort:
     1. Places the ordering into o directly, overwriting whatever was there
     2. Doesn't change x
@@ -133,8 +211,13 @@ static void icount(int *x, int *o, int n)
 */
 {
     int i=0, tmp;
+    int range = ctx->range, xmin = ctx->xmin, nalast = ctx->nalast, order = ctx->order;
     int napos = range;  // always count NA in last bucket and we'll account for nalast option in due course
-    static unsigned int counts[N_RANGE+1] = {0};                            // static is IMPORTANT, counting sort is called repetitively.
+    if (ctx->icounts == NULL) {
+        ctx->icounts = (unsigned int *)calloc(N_RANGE+1, sizeof(unsigned int));
+        if (ctx->icounts == NULL) Error("Failed to allocate working memory for icount. Requested %d * %d bytes", N_RANGE+1, sizeof(unsigned int));
+    }
+    unsigned int *counts = ctx->icounts;                                    // kept with the context, IMPORTANT, counting sort is called repetitively.
     /* counts are set back to 0 at the end efficiently. 1e5 = 0.4MB i.e 
     tiny. We'll only use the front part of it, as large as range. So it's 
     just reserving space, not using it. Have defined N_RANGE to be 100000.*/
@@ -148,7 +231,7 @@ static void icount(int *x, int *o, int n)
     
     tmp = 0;
     if (nalast!=1 && counts[napos]) {
-        push(counts[napos]);
+        push(ctx, counts[napos]);
         tmp += counts[napos];
     }
     int w = (order==1) ? 0 : range-1;                                   // *** BLOCK 4 ***
@@ -157,13 +240,13 @@ static void icount(int *x, int *o, int n)
        need to go to max, unlike 256 loops elsewhere in forder.c */
     {
         if (counts[w]) {                                                    // cumulate but not through 0's. Helps resetting zeros when n<range, below.
-            push(counts[w]);
+            push(ctx, counts[w]);
             counts[w] = (tmp += counts[w]);
         }
         w += order; // order is +1 or -1
     }
     if (nalast==1 && counts[napos]) {
-        push(counts[napos]);
+        push(ctx, counts[napos]);
         counts[napos] = (tmp += counts[napos]);
     }
     for(i=n-1; i>=0; i--) {
@@ -188,7 +271,158 @@ static void icount(int *x, int *o, int n)
     return;
 }
 
-static void iinsert(int *x, int *o, int n)
+/*
+   iradix and dradix below are multi-threaded for large n. The first radix pass is done the way fsort does it :
+   each batch of x counts its own histogram, the MSD counts are cumulated across batches so that each batch knows
+   where its items go, and the batches then scatter into o in parallel. That's stable since items keep their order
+   within a batch and the batches are in order. The buckets of the first radix are then independent and each is
+   recursed by one thread using that thread's radixWork: its own counts, working memory and stack of group sizes.
+   The groups are pushed onto the global stack in bucket order afterwards, so the result is identical to 1 thread.
+*/
+#define N_PAR 100000                                                // below this n, iradix and dradix stay single threaded
+
+struct radixWork {
+    unsigned int counts[8][257];    // 4 are used for iradix, 8 for dradix. Left all 0 after use, to benefit from skipped radix.
+    void *xsub, *xtmp;              // xsub is the bucket being recursed and xtmp its reorder buffer; 8 bytes per item
+    int *otmp;
+    int alloc;                      // xsub, xtmp and otmp are each this many items long
+    int *grp, ngrp, grpalloc;       // group sizes found by this thread, in the order found
+    Rboolean oom;                   // Error() can't be called from a parallel region so it's recorded and raised afterwards
+};
+
+static void alloc_work(struct sortContext *ctx, int nth) {
+    if (ctx->nwork >= nth) return;
+    ctx->work = (struct radixWork *)realloc(ctx->work, nth * sizeof(struct radixWork));
+    if (ctx->work == NULL) { ctx->nwork = 0; Error("Failed to allocate working memory for %d threads. Requested %d * %d bytes", nth, nth, sizeof(struct radixWork)); }
+    memset(ctx->work + ctx->nwork, 0, (nth-ctx->nwork) * sizeof(struct radixWork));
+    ctx->nwork = nth;
+}
+
+static void free_work(struct sortContext *ctx, int retain) {
+    // frees working memory larger than retain items; all of it when retain is 0
+    for (int i=0; i<ctx->nwork; i++) {
+        struct radixWork *w = ctx->work + i;
+        if (w->alloc > retain || retain == 0) {
+            free(w->xsub); free(w->xtmp); free(w->otmp);
+            w->xsub = w->xtmp = NULL; w->otmp = NULL; w->alloc = 0;
+        }
+        if (w->grpalloc > retain || retain == 0) {
+            free(w->grp); w->grp = NULL; w->grpalloc = 0;
+        }
+    }
+    if (retain == 0) { free(ctx->work); ctx->work = NULL; ctx->nwork = 0; }
+}
+
+static Rboolean grow_work(struct radixWork *w, int n) {
+    // called from parallel regions; each thread only touches its own w
+    if (w->alloc >= n) return TRUE;
+    void *tmp;
+    if ((tmp = realloc(w->xsub, n * sizeof(double))) == NULL) { w->oom = TRUE; return FALSE; }
+    w->xsub = tmp;
+    if ((tmp = realloc(w->xtmp, n * sizeof(double))) == NULL) { w->oom = TRUE; return FALSE; }
+    w->xtmp = tmp;
+    if ((tmp = realloc(w->otmp, n * sizeof(int))) == NULL) { w->oom = TRUE; return FALSE; }
+    w->otmp = tmp;
+    w->alloc = n;
+    return TRUE;
+}
+
+static void wpush(struct sortContext *ctx, struct radixWork *w, int x) {
+    // as push() but onto w's own stack when called from the parallel recursion; w is NULL from single threaded callers
+    if (w == NULL) { push(ctx, x); return; }
+    if (!ctx->stackgrps || x==0) return;
+    if (w->ngrp == w->grpalloc) {
+        int newalloc = (w->grpalloc == 0) ? 10000 : w->grpalloc*2;
+        int *tmp = (int *)realloc(w->grp, newalloc * sizeof(int));
+        if (tmp == NULL) { w->oom = TRUE; return; }
+        w->grp = tmp;
+        w->grpalloc = newalloc;
+    }
+    w->grp[w->ngrp++] = x;
+}
+
+static void push_buckets(struct sortContext *ctx, const int *start, const int *bthread, const int *bfrom, const int *bto)
+// Push the groups of each bucket of the first radix, in bucket order. bthread[b] is -1 when bucket b is a group itself.
+{
+    struct radixWork *work = ctx->work;
+    int nwork = ctx->nwork, oom = -1;
+    for (int t=0; t<nwork; t++) if (work[t].oom) { oom = t; work[t].oom = FALSE; }
+    if (oom != -1) {
+        for (int t=0; t<nwork; t++) work[t].ngrp = 0;
+        Error("Failed to allocate working memory in thread %d of the parallel radix sort", oom);
+    }
+    for (int b=0; b<256; b++) {
+        int thisgrpn = start[b+1]-start[b];
+        if (thisgrpn == 0) continue;
+        if (bthread[b] == -1) { push(ctx, thisgrpn); continue; }
+        int *grp = work[bthread[b]].grp;
+        for (int k=bfrom[b]; k<bto[b]; k++) push(ctx, grp[k]);
+    }
+    for (int t=0; t<nwork; t++) work[t].ngrp = 0;
+}
+
+static Rboolean isbig(int thisgrpn, int n, int nth, int nextradix)
+// A bucket of the first radix larger than a thread's share would leave one thread recursing it while the others wait
+// (skew; e.g. one very common value). Those are sorted first by all the threads together, see sort_big.
+{
+    return nth > 1 && nextradix != -1 && thisgrpn > (n-1)/nth + 1;
+}
+
+static void sort_big(struct sortContext *ctx, int *osub, int n, int radix, int nth, int *bfrom, int *bto)
+// Sorts osub by the unsigned keys already in ctx->work[0].xsub using fsort.c's task-parallel radix, which splits the bucket
+// between the threads, and pushes its groups (the runs of equal keys) onto work[0]. Only the bits below radix remain.
+{
+    struct radixWork *w = ctx->work;
+    unsigned long long *k = (unsigned long long *)w->xsub;
+    R_xlen_t from = 0, len = n;
+    int toBit = radix*8 - 1;
+    *bfrom = *bto = w->ngrp;
+    if (ksort_buckets(k, osub, (unsigned long long *)w->xtmp, w->otmp, &from, &len, 1, 0, toBit-7, toBit, (n-1)/nth + 1, nth)) {
+        w->oom = TRUE;                                                  // push_buckets() raises the error
+        return;
+    }
+    int tt = 1;
+    for (int i=1; i<n; i++) if (k[i]==k[i-1]) tt++; else { wpush(ctx, w, tt); tt=1; }
+    wpush(ctx, w, tt);
+    *bto = w->ngrp;
+}
+
+static unsigned int *alloc_batchcounts(struct sortContext *ctx, int nBatch) {
+    // nBatch * 8 * 256 histograms of the first radix pass. Left all 0 after use.
+    int nalloc = ctx->batchcounts_alloc;  // in batches
+    if (nalloc < nBatch) {
+        ctx->batchcounts = (unsigned int *)realloc(ctx->batchcounts, nBatch * 8 * 256 * sizeof(unsigned int));
+        if (ctx->batchcounts == NULL) { ctx->batchcounts_alloc = 0; Error("Failed to allocate working memory for batchcounts. Requested %d * %d bytes", nBatch * 8 * 256, sizeof(unsigned int)); }
+        memset(ctx->batchcounts + nalloc * 8 * 256, 0, (nBatch-nalloc) * 8 * 256 * sizeof(unsigned int));
+        ctx->batchcounts_alloc = nBatch;
+    }
+    return ctx->batchcounts;
+}
+
+static unsigned int batchtotal(const unsigned int *batchcounts, int nBatch, int radix, int b) {
+    unsigned int ans = 0;
+    for (int batch=0; batch<nBatch; batch++) ans += batchcounts[(batch*8 + radix)*256 + b];
+    return ans;
+}
+
+static void batchcumulate(unsigned int *batchcounts, int nBatch, int radix, int *start)
+// Cumulate the counts of this radix across the batches, so batch i's count of b becomes where its first b goes.
+// start[b] is where bucket b starts in o; start[256]==n.
+{
+    int cum = 0;
+    for (int b=0; b<256; b++) {
+        start[b] = cum;
+        for (int batch=0; batch<nBatch; batch++) {
+            unsigned int *c = batchcounts + (batch*8 + radix)*256 + b;
+            unsigned int tmp = *c;
+            *c = cum;
+            cum += tmp;
+        }
+    }
+    start[256] = cum;
+}
+
+static void iinsert(struct sortContext *ctx, int *x, int *o, int n, struct radixWork *w)
 /*  orders both x and o by reference in-place. Fast for small vectors, low overhead.
     don't be tempted to binsearch backwards here, have to shift anyway; 
     many memmove would have overhead and do the same thing. */
@@ -211,8 +445,8 @@ static void iinsert(int *x, int *o, int n)
         }
     }    
     tt = 0;
-    for (i=1; i<n; i++) if (x[i]==x[i-1]) tt++; else { push(tt+1); tt=0; }
-    push(tt+1);
+    for (i=1; i<n; i++) if (x[i]==x[i-1]) tt++; else { wpush(ctx, w, tt+1); tt=0; }
+    wpush(ctx, w, tt+1);
 }
 
 /*
@@ -244,142 +478,119 @@ static void iinsert(int *x, int *o, int n)
      in each LSD radix pass, though.
 */
 
-static unsigned int radixcounts[8][257] = {{0}};                            // 4 are used for iradix, 8 for dradix and i64radix
-static int skip[8];
-/* global because iradix and iradix_r interact and are called repetitively. 
-   counts are set back to 0 after each use, to benefit from skipped radix. */
-static void *radix_xsub=NULL;
-static size_t radix_xsuballoc=0;
-
-static int *otmp=NULL, otmp_alloc=0;
-static void alloc_otmp(int n) {
-    if (otmp_alloc >= n) return;
-    otmp = (int *)realloc(otmp, n * sizeof(int));
-    if (otmp == NULL) Error("Failed to allocate working memory for otmp. Requested %d * %d bytes", n, sizeof(int));
-    otmp_alloc = n;
-}
-
-static void *xtmp=NULL; int xtmp_alloc=0;                                   // TO DO: save xtmp if possible, see allocs in forder
-static void alloc_xtmp(int n) {                                             // TO DO: currently always the largest type (double) but 
-                                                                            // could be int if that's all that's needed
-    if (xtmp_alloc >= n) return;
-    xtmp = (double *)realloc(xtmp, n * sizeof(double));
-    if (xtmp == NULL) Error("Failed to allocate working memory for xtmp. Requested %d * %d bytes", n, sizeof(double));
-    xtmp_alloc = n;
-}
+/* ctx->skip[] is set by iradix and dradix before the parallel recursion and only read by it. */
 
-static void iradix_r(int *xsub, int *osub, int n, int radix);
+static void iradix_r(struct sortContext *ctx, int *xsub, int *osub, int n, int radix, struct radixWork *w);
 
-static void iradix(int *x, int *o, int n)
+static void iradix(struct sortContext *ctx, int *x, int *o, int n)
    /* As icount :
        Places the ordering into o directly, overwriting whatever was there
        Doesn't change x
        Pushes group sizes onto stack */
 {
-    int i, j, radix, nextradix, itmp, thisgrpn, maxgrpn;
-    unsigned int thisx=0, shift, *thiscounts;
-
-    for (i=0;i<n;i++) {
+    int i, radix, nextradix, start[257], bthread[256], bfrom[256], bto[256], *skip = ctx->skip;
+    unsigned int thisx = (unsigned int)(icheck(ctx, x[n-1])) - INT_MIN, shift;  // the last x, to detect skip below
+    int nth = (n < N_PAR) ? 1 : getDTthreads();
+    int batchSize = (n-1)/nth + 1;
+    int nBatch = (n-1)/batchSize + 1;
+    unsigned int *batchcounts = alloc_batchcounts(ctx, nBatch);
+
+    #pragma omp parallel for num_threads(nth)
+    for (int batch=0; batch<nBatch; batch++) {
         /* parallel histogramming pass; i.e. count occurrences of 
-        0:255 in each byte.  Sequential so almost negligible. */
-        thisx = (unsigned int)(icheck(x[i])) - INT_MIN;                     // relies on overflow behaviour. And shouldn't -INT_MIN be up in iradix?
-        radixcounts[0][thisx & 0xFF]++;                                     // unrolled since inside n-loop
-        radixcounts[1][thisx >> 8 & 0xFF]++;
-        radixcounts[2][thisx >> 16 & 0xFF]++;
-        radixcounts[3][thisx >> 24 & 0xFF]++;
+        0:255 in each byte.  Sequential within each batch so almost negligible. */
+        unsigned int *thiscounts = batchcounts + batch*8*256;
+        int to = (batch==nBatch-1) ? n : (batch+1)*batchSize;
+        for (int i=batch*batchSize; i<to; i++) {
+            unsigned int thisx = (unsigned int)(icheck(ctx, x[i])) - INT_MIN;   // relies on overflow behaviour. And shouldn't -INT_MIN be up in iradix?
+            thiscounts[thisx & 0xFF]++;                                      // unrolled since inside n-loop
+            thiscounts[256 + (thisx >> 8 & 0xFF)]++;
+            thiscounts[512 + (thisx >> 16 & 0xFF)]++;
+            thiscounts[768 + (thisx >> 24 & 0xFF)]++;
+        }
     }
     for (radix=0; radix<4; radix++) {
         /* any(count == n) => all radix must have been that value => 
-        last x (still thisx) was that value */
-        i = thisx >> (radix*8) & 0xFF;
-        skip[radix] = radixcounts[radix][i] == n;
-        if (skip[radix]) radixcounts[radix][i] = 0;                         // clear it now, the other counts must be 0 already
+        last x (thisx) was that value */
+        skip[radix] = batchtotal(batchcounts, nBatch, radix, thisx >> (radix*8) & 0xFF) == n;
     }
     
     radix = 3;  // MSD
     while (radix>=0 && skip[radix]) radix--;
     if (radix==-1) {                                                        // All radix are skipped; i.e. one number repeated n times.
-        if (nalast == 0 && x[0] == NA_INTEGER)                              // all values are identical. return 0 if nalast=0 & all NA
+        memset(batchcounts, 0, nBatch*8*256*sizeof(unsigned int));
+        if (ctx->nalast == 0 && x[0] == NA_INTEGER)                         // all values are identical. return 0 if nalast=0 & all NA
             for (i=0; i<n; i++) o[i] = 0;                                   // because of 'return', have to take care of it here.
         else for (i=0; i<n; i++) o[i] = (i+1);
-        push(n); 
+        push(ctx, n); 
         return; 
     }
-    for (i=radix-1; i>=0; i--) {
-        if (!skip[i]) memset(radixcounts[i], 0, 257*sizeof(unsigned int));
-        /* clear the counts as we only needed the parallel pass for skip[] 
-           and we're going to use radixcounts again below. Can't use parallel 
-           lower counts in MSD radix, unlike LSD. */
-    }
-    thiscounts = radixcounts[radix];
     shift = radix * 8;
-    
-    itmp = thiscounts[0];
-    maxgrpn = itmp;
-    for (i=1; itmp<n && i<256; i++) {
-        thisgrpn = thiscounts[i];
-        if (thisgrpn) {                                                     // don't cummulate through 0s, important below.
-            if (thisgrpn>maxgrpn) maxgrpn = thisgrpn;
-            thiscounts[i] = (itmp += thisgrpn);
-        }
-    }
-    for (i=n-1; i>=0; i--) {
-        thisx = ((unsigned int)(icheck(x[i])) - INT_MIN) >> shift & 0xFF;
-        o[--thiscounts[thisx]] = i+1;
-    }
-    
-    if (radix_xsuballoc < maxgrpn) {
-        // The largest group according to the first non-skipped radix, so could be big (if radix is needed on first column)
-        // TO DO: could include extra bits to divide the first radix up more. Often the MSD has groups in just 0-4 out of 256.
-        // free'd at the end of forder once we're done calling iradix repetitively
-        radix_xsub = (int *)realloc(radix_xsub, maxgrpn*sizeof(double));    // realloc(NULL) == malloc
-        if (!radix_xsub) Error("Failed to realloc working memory %d*8bytes (xsub in iradix), radix=%d", maxgrpn, radix);
-        radix_xsuballoc = maxgrpn;
-    }
-    
-    alloc_otmp(maxgrpn);   // TO DO: can we leave this to forder and remove these calls??
-    alloc_xtmp(maxgrpn);   // TO DO: doesn't need to be sizeof(double) always, see inside
-    
+    batchcumulate(batchcounts, nBatch, radix, start);
+    #pragma omp parallel for num_threads(nth)
+    for (int batch=0; batch<nBatch; batch++) {
+        unsigned int *thiscounts = batchcounts + (batch*8 + radix)*256;
+        int to = (batch==nBatch-1) ? n : (batch+1)*batchSize;
+        for (int i=batch*batchSize; i<to; i++)
+            o[ thiscounts[((unsigned int)(icheck(ctx, x[i])) - INT_MIN) >> shift & 0xFF]++ ] = i+1;
+    }
+    memset(batchcounts, 0, nBatch*8*256*sizeof(unsigned int));             // clear the counts as we only needed the lower radix for skip[]. Can't use
+                                                                            // parallel lower counts in MSD radix, unlike LSD.
     nextradix = radix-1;
     while (nextradix>=0 && skip[nextradix]) nextradix--;
-    if (thiscounts[0] != 0) Error("Internal error. thiscounts[0]=%d but should have been decremented to 0. dradix=%d", thiscounts[0], radix);
-    thiscounts[256] = n;
-    itmp = 0;
-    for (i=1; itmp<n && i<=256; i++) {
-        if (thiscounts[i] == 0) continue;
-        thisgrpn = thiscounts[i] - itmp;                                    // undo cumulate; i.e. diff
-        if (thisgrpn == 1 || nextradix==-1) {
-            push(thisgrpn);
-        } else {
-            for (j=0; j<thisgrpn; j++)
-                ((int *)radix_xsub)[j] = icheck(x[o[itmp+j]-1]);            // this is why this xsub here can't be the same memory as xsub in forder.
-            iradix_r(radix_xsub, o+itmp, thisgrpn, nextradix);              // changes xsub and o by reference recursively.
-        }
-        itmp = thiscounts[i];
-        thiscounts[i] = 0;
-    }
-    if (nalast == 0)                                                        // nalast = 1, -1 are both taken care already.
-        for (i=0; i<n; i++) o[i] = (x[o[i]-1] == NA_INTEGER) ? 0 : o[i];    // nalast = 0 is dealt with separately as it just sets o to 0
+    alloc_work(ctx, nth);
+    for (int b=0; b<256; b++) {
+        int thisgrpn = start[b+1] - start[b];
+        bthread[b] = -1;
+        if (!isbig(thisgrpn, n, nth, nextradix) || !grow_work(ctx->work, thisgrpn)) continue;
+        int *osub = o + start[b];
+        unsigned long long *k = (unsigned long long *)ctx->work->xsub;
+        #pragma omp parallel for num_threads(nth)
+        for (int j=0; j<thisgrpn; j++)
+            k[j] = (unsigned int)(icheck(ctx, x[osub[j]-1])) - INT_MIN;
+        bthread[b] = 0;
+        sort_big(ctx, osub, thisgrpn, radix, nth, bfrom+b, bto+b);
+    }
+    #pragma omp parallel for schedule(dynamic) num_threads(nth)
+    for (int b=0; b<256; b++) {
+        int thisgrpn = start[b+1] - start[b];
+        if (bthread[b] != -1 || thisgrpn <= 1 || nextradix==-1) continue;   // done above or this bucket is a group
+        struct radixWork *w = ctx->work + omp_get_thread_num();
+        if (!grow_work(w, thisgrpn)) continue;                              // push_buckets() raises the error
+        int *osub = o + start[b];
+        for (int j=0; j<thisgrpn; j++)
+            ((int *)w->xsub)[j] = icheck(ctx, x[osub[j]-1]);                     // this is why this xsub here can't be the same memory as xsub in forder.
+        bthread[b] = omp_get_thread_num();
+        bfrom[b] = w->ngrp;
+        iradix_r(ctx, w->xsub, osub, thisgrpn, nextradix, w);               // changes xsub and o by reference recursively.
+        bto[b] = w->ngrp;
+    }
+    push_buckets(ctx, start, bthread, bfrom, bto);
+    if (ctx->nalast == 0) {                                                 // nalast = 1, -1 are both taken care already.
+        #pragma omp parallel for num_threads(nth)
+        for (int i=0; i<n; i++) o[i] = (x[o[i]-1] == NA_INTEGER) ? 0 : o[i];   // nalast = 0 is dealt with separately as it just sets o to 0
                                                                             // at those indices where x is NA. x[o[i]-1] because x is not 
                                                                             // modified by reference unlike iinsert or iradix_r
+    }
 }
 
-static void iradix_r(int *xsub, int *osub, int n, int radix)
+static void iradix_r(struct sortContext *ctx, int *xsub, int *osub, int n, int radix, struct radixWork *w)
     // xsub is a recursive offset into xsub working memory above in iradix, reordered by reference.
     // osub is a an offset into the main answer o, reordered by reference.
     // radix iterates 3,2,1,0
+    // Runs inside a parallel region, so only w (this thread's) is written to besides xsub and osub; ctx is only read. No Error() here.
 {
     int i, j, itmp, thisx, thisgrpn, nextradix, shift;
     unsigned int *thiscounts;
     
     if (n < N_SMALL) {              // N_SMALL=200 is guess based on limited testing. Needs calibrate().
                                     // Was 50 based on sum(1:50)=1275 worst -vs- 256 cummulate + 256 memset + allowance since reverse order is unlikely.
-        iinsert(xsub, osub, n);     // when nalast==0, iinsert will be called only from within iradix.
+        iinsert(ctx, xsub, osub, n, w);  // when nalast==0, iinsert will be called only from within iradix.
         return;
     }
     
     shift = radix*8;
-    thiscounts = radixcounts[radix];
+    thiscounts = w->counts[radix];
     
     for (i=0; i<n; i++) {
         thisx = (unsigned int)xsub[i] - INT_MIN;                                // sequential in xsub
@@ -391,27 +602,27 @@ static void iradix_r(int *xsub, int *osub, int n, int radix)
     for (i=n-1; i>=0; i--) {
         thisx = ((unsigned int)xsub[i] - INT_MIN) >> shift & 0xFF;
         j = --thiscounts[thisx];
-        otmp[j] = osub[i];
-        ((int *)xtmp)[j] = xsub[i];
+        w->otmp[j] = osub[i];
+        ((int *)w->xtmp)[j] = xsub[i];
     }
-    memcpy(osub, otmp, n*sizeof(int));
-    memcpy(xsub, xtmp, n*sizeof(int));
+    memcpy(osub, w->otmp, n*sizeof(int));
+    memcpy(xsub, w->xtmp, n*sizeof(int));
     
     nextradix = radix-1;
-    while (nextradix>=0 && skip[nextradix]) nextradix--;
+    while (nextradix>=0 && ctx->skip[nextradix]) nextradix--;
     /* TO DO:  If nextradix==-1 AND no further columns from forder AND !retGrp, we're 
                done. We have o. Remember to memset thiscounts before returning. */
     
-    if (thiscounts[0] != 0) Error("Logical error. thiscounts[0]=%d but should have been decremented to 0. radix=%d", thiscounts[0], radix);
+    // thiscounts[0] must have been decremented to 0 here
     thiscounts[256] = n;
     itmp = 0;
     for (i=1; itmp<n && i<=256; i++) {
         if (thiscounts[i] == 0) continue;
         thisgrpn = thiscounts[i] - itmp;  // undo cummulate; i.e. diff
         if (thisgrpn == 1 || nextradix==-1) {
-            push(thisgrpn);
+            wpush(ctx, w, thisgrpn);
         } else {
-            iradix_r(xsub+itmp, osub+itmp, thisgrpn, nextradix);
+            iradix_r(ctx, xsub+itmp, osub+itmp, thisgrpn, nextradix, w);
         }
         itmp = thiscounts[i];
         thiscounts[i] = 0;
@@ -443,13 +654,15 @@ SEXP getNumericRounding()
     return ScalarInteger(dround);
 }
 
-static union {double d;
-              unsigned long long ull;} u;
-            //  int i;
-            //  unsigned int ui;} u;
+union ud {double d;
+          unsigned long long ull;};
+        //  int i;
+        //  unsigned int ui;};
+static union ud u;  // for binary() only. The twiddles below declare their own since they're called from parallel regions.
 
-unsigned long long dtwiddle(void *p, int i, int order)
+unsigned long long dtwiddle_na(void *p, int i, int order, int nalast)
 {
+    union ud u;
     u.d = order*((double *)p)[i];                               // take care of 'order' right at the beginning
     if (R_FINITE(u.d)) {
         u.ull = (u.d) ? u.ull + ((u.ull & dmask1) << 1) : 0;    // handle 0, -0 case. Fix for issues/743.
@@ -471,11 +684,12 @@ unsigned long long dtwiddle(void *p, int i, int order)
     return( (u.ull ^ mask) & dmask2 );
 }
 
-unsigned long long i64twiddle(void *p, int i, int order)
+unsigned long long i64twiddle_na(void *p, int i, int order, int nalast)
 // 'order' is in effect now - ascending and descending order implemented. Default 
 // case (setkey) will not be affected much because nalast != 1 and order == 1 are 
 // defaults. 
 {
+    union ud u;
     u.d = ((double *)p)[i];
     u.ull ^= 0x8000000000000000;
     if (nalast != 1) {
@@ -493,12 +707,26 @@ unsigned long long i64twiddle(void *p, int i, int order)
     return u.ull;
 }
 
+// dtwiddle and i64twiddle are for use by other C code in data.table (bmerge and uniqlist) which compare keys
+// ordered by forder with the default na.last=FALSE. extsort in reorder.c uses the _na versions directly.
+unsigned long long dtwiddle(void *p, int i, int order)
+{
+    return dtwiddle_na(p, i, order, -1);
+}
+
+unsigned long long i64twiddle(void *p, int i, int order)
+{
+    return i64twiddle_na(p, i, order, -1);
+}
+
 Rboolean dnan(void *p, int i) {
+    union ud u;
     u.d = ((double *)p)[i];
     return (ISNAN(u.d));
 }
 
 Rboolean i64nan(void *p, int i) {
+    union ud u;
     u.d = ((double *)p)[i];
     return ((u.ull ^ 0x8000000000000000) == 0);
 }
@@ -513,15 +741,14 @@ unsigned long long i32twiddle(void *p, int i)
 }
 */
 
-unsigned long long (*twiddle)(void *, int, int);
+unsigned long long (*twiddle)(void *, int, int);                    // for bmerge and uniqlist; forder uses ctx->twiddle
 // integer64 has NA = 0x8000000000000000. And it gives TRUE for all ISNAN(.) when '.' is -ve number.
 // So, ISNAN(.) would just provide wrong results. This was particularly an issue while implementing
-// DT[order(., na.last=NA)] where '.' is an integer64 column. Therefore, 'is_nan'. This is basically 
+// DT[order(., na.last=NA)] where '.' is an integer64 column. Therefore, ctx->is_nan. This is basically 
 // ISNAN(.) for double and (u.ull ^ 0x8000000000000000 == 0) for integer64.
-Rboolean (*is_nan)(void *, int);
 size_t colSize=8;  // the size of the column type (4 or 8). Just 8 currently until iradix is merged in.
 
-static void dradix_r(unsigned char *xsub, int *osub, int n, int radix);
+static void dradix_r(struct sortContext *ctx, unsigned char *xsub, int *osub, int n, int radix, struct radixWork *w);
 
 #ifdef WORDS_BIGENDIAN
 #define RADIX_BYTE colSize-radix-1
@@ -529,92 +756,94 @@ static void dradix_r(unsigned char *xsub, int *osub, int n, int radix);
 #define RADIX_BYTE radix
 #endif
 
-static void dradix(unsigned char *x, int *o, int n)
+static void dradix(struct sortContext *ctx, unsigned char *x, int *o, int n)
 {
-    int i, j, radix, nextradix, itmp, thisgrpn, maxgrpn;
-    unsigned int *thiscounts;
-    unsigned long long thisx=0;
+    int i, radix, nextradix, start[257], bthread[256], bfrom[256], bto[256], *skip = ctx->skip;
+    int order = ctx->order, nalast = ctx->nalast;
+    unsigned long long (*twiddle)(void *, int, int, int) = ctx->twiddle;
+    unsigned long long thisx = twiddle(x,n-1,order,nalast);             // the last x, to detect skip below
+    int nth = (n < N_PAR) ? 1 : getDTthreads();
+    int batchSize = (n-1)/nth + 1;
+    int nBatch = (n-1)/batchSize + 1;
+    unsigned int *batchcounts = alloc_batchcounts(ctx, nBatch);
     // see comments in iradix for structure.  This follows the same. TO DO: merge iradix in here (almost ready)
-    for (i=0;i<n;i++) {
-        thisx = twiddle(x,i,order);
-        for (radix=0; radix<colSize; radix++)
-            radixcounts[radix][((unsigned char *)&thisx)[RADIX_BYTE]]++;
-        // if dround==2 then radix 0 and 1 will be all 0 here and skipped.
-        /* on little endian, 0 is the least significant bits (the right) 
-        / and 7 is the most including sign (the left); i.e. reversed. */
+    #pragma omp parallel for num_threads(nth)
+    for (int batch=0; batch<nBatch; batch++) {
+        unsigned int *thiscounts = batchcounts + batch*8*256;
+        int to = (batch==nBatch-1) ? n : (batch+1)*batchSize;
+        for (int i=batch*batchSize; i<to; i++) {
+            unsigned long long thisx = twiddle(x,i,order,nalast);
+            for (int radix=0; radix<colSize; radix++)
+                thiscounts[radix*256 + ((unsigned char *)&thisx)[RADIX_BYTE]]++;
+            // if dround==2 then radix 0 and 1 will be all 0 here and skipped.
+            /* on little endian, 0 is the least significant bits (the right) 
+            / and 7 is the most including sign (the left); i.e. reversed. */
+        }
     }
     for (radix=0; radix<colSize; radix++) {
-        i = ((unsigned char *)&thisx)[RADIX_BYTE];                           // thisx is the last x after loop above
-        skip[radix] = radixcounts[radix][i] == n;
-        if (skip[radix]) radixcounts[radix][i] = 0;                     // clear it now, the other counts must be 0 already
+        skip[radix] = batchtotal(batchcounts, nBatch, radix, ((unsigned char *)&thisx)[RADIX_BYTE]) == n;
     }
     radix = colSize-1;  // MSD
     while (radix>=0 && skip[radix]) radix--;
     if (radix==-1) {                                                    // All radix are skipped; i.e. one number repeated n times.
-        if (nalast == 0 && is_nan(x, 0))                               // all values are identical. return 0 if nalast=0 & all NA
+        memset(batchcounts, 0, nBatch*8*256*sizeof(unsigned int));
+        if (nalast == 0 && ctx->is_nan(x, 0))                          // all values are identical. return 0 if nalast=0 & all NA
             for (i=0; i<n; i++) o[i] = 0;                               // because of 'return', have to take care of it here.
         else for (i=0; i<n; i++) o[i] = (i+1);
-        push(n);
+        push(ctx, n);
         return;
     }
-    for (i=radix-1; i>=0; i--) {  // clear the lower radix counts, we only did them to know skip. will be reused within each group
-        if (!skip[i]) memset(radixcounts[i], 0, 257*sizeof(unsigned int));
-    }
-    thiscounts = radixcounts[radix];
-    itmp = thiscounts[0];
-    maxgrpn = itmp;
-    for (i=1; itmp<n && i<256; i++) {
-        thisgrpn = thiscounts[i];
-        if (thisgrpn) {  // don't cummulate through 0s, important below
-            if (thisgrpn>maxgrpn) maxgrpn = thisgrpn;
-            thiscounts[i] = (itmp += thisgrpn);
+    batchcumulate(batchcounts, nBatch, radix, start);
+    #pragma omp parallel for num_threads(nth)
+    for (int batch=0; batch<nBatch; batch++) {
+        unsigned int *thiscounts = batchcounts + (batch*8 + radix)*256;
+        int to = (batch==nBatch-1) ? n : (batch+1)*batchSize;
+        for (int i=batch*batchSize; i<to; i++) {
+            unsigned long long thisx = twiddle(x,i,order,nalast);
+            o[ thiscounts[((unsigned char *)&thisx)[RADIX_BYTE]]++ ] = i+1;
         }
     }
-    for (i=n-1; i>=0; i--) {
-        thisx = twiddle(x,i,order);
-        o[ --thiscounts[((unsigned char *)&thisx)[RADIX_BYTE]] ] = i+1;
-    }
-
-    if (radix_xsuballoc < maxgrpn) {                                            // TO DO: centralize this alloc
-        // The largest group according to the first non-skipped radix, so could be big (if radix is needed on first column)
-        // TO DO: could include extra bits to divide the first radix up more. Often the MSD has groups in just 0-4 out of 256.
-        // free'd at the end of forder once we're done calling iradix repetitively
-        radix_xsub = (double *)realloc(radix_xsub, maxgrpn*sizeof(double));  // realloc(NULL) == malloc
-        if (!radix_xsub) Error("Failed to realloc working memory %d*8bytes (xsub in dradix), radix=%d", maxgrpn, radix);
-        radix_xsuballoc = maxgrpn;
-    }
-    
-    alloc_otmp(maxgrpn);   // TO DO: leave to forder and remove these calls?
-    alloc_xtmp(maxgrpn);
+    memset(batchcounts, 0, nBatch*8*256*sizeof(unsigned int));        // the lower radix were only needed for skip[]
     
     nextradix = radix-1;
     while (nextradix>=0 && skip[nextradix]) nextradix--;
-    if (thiscounts[0] != 0) Error("Logical error. thiscounts[0]=%d but should have been decremented to 0. dradix=%d", thiscounts[0], radix);
-    thiscounts[256] = n;
-    itmp = 0;
-    for (i=1; itmp<n && i<=256; i++) {
-        if (thiscounts[i] == 0) continue;
-        thisgrpn = thiscounts[i] - itmp;  // undo cummulate; i.e. diff
-        if (thisgrpn == 1 || nextradix==-1) {
-            push(thisgrpn);
-        } else {
-            if (colSize==4) { // ready for merging in iradix ...
-                error("Not yet used, still using iradix instead");
-                for (j=0; j<thisgrpn; j++) ((int *)radix_xsub)[j] = twiddle(x, o[itmp+j]-1, order);  
-            } else for (j=0; j<thisgrpn; j++) ((unsigned long long *)radix_xsub)[j] = twiddle(x, o[itmp+j]-1, order); // this is why this xsub here can't be the same memory as xsub in forder
-            dradix_r(radix_xsub, o+itmp, thisgrpn, nextradix); // changes xsub and o by reference recursively.
-        }
-        itmp = thiscounts[i];
-        thiscounts[i] = 0;
+    alloc_work(ctx, nth);
+    for (int b=0; b<256; b++) {                                         // as iradix
+        int thisgrpn = start[b+1] - start[b];
+        bthread[b] = -1;
+        if (!isbig(thisgrpn, n, nth, nextradix) || !grow_work(ctx->work, thisgrpn)) continue;
+        int *osub = o + start[b];
+        unsigned long long *k = (unsigned long long *)ctx->work->xsub;
+        #pragma omp parallel for num_threads(nth)
+        for (int j=0; j<thisgrpn; j++)
+            k[j] = twiddle(x, osub[j]-1, order, nalast);
+        bthread[b] = 0;
+        sort_big(ctx, osub, thisgrpn, radix, nth, bfrom+b, bto+b);
+    }
+    #pragma omp parallel for schedule(dynamic) num_threads(nth)
+    for (int b=0; b<256; b++) {
+        int thisgrpn = start[b+1] - start[b];
+        if (bthread[b] != -1 || thisgrpn <= 1 || nextradix==-1) continue;
+        struct radixWork *w = ctx->work + omp_get_thread_num();
+        if (!grow_work(w, thisgrpn)) continue;                          // push_buckets() raises the error
+        int *osub = o + start[b];
+        for (int j=0; j<thisgrpn; j++)
+            ((unsigned long long *)w->xsub)[j] = twiddle(x, osub[j]-1, order, nalast);  // this is why this xsub here can't be the same memory as xsub in forder
+        bthread[b] = omp_get_thread_num();
+        bfrom[b] = w->ngrp;
+        dradix_r(ctx, w->xsub, osub, thisgrpn, nextradix, w);                // changes xsub and o by reference recursively.
+        bto[b] = w->ngrp;
+    }
+    push_buckets(ctx, start, bthread, bfrom, bto);
+    if (nalast == 0) {                                                  // nalast = 1, -1 are both taken care already.
+        #pragma omp parallel for num_threads(nth)
+        for (int i=0; i<n; i++) o[i] = ctx->is_nan(x, o[i]-1) ? 0 : o[i];   // nalast = 0 is dealt with separately as it just sets o to 0 
+                                                                        // at those indices where x is NA. x[o[i]-1] because x is not 
+                                                                        // modified by reference unlike iinsert or iradix_r
     }
-    if (nalast == 0)                                                 // nalast = 1, -1 are both taken care already.
-        for (i=0; i<n; i++) o[i] = is_nan(x, o[i]-1) ? 0 : o[i];     // nalast = 0 is dealt with separately as it just sets o to 0 
-                                                                     // at those indices where x is NA. x[o[i]-1] because x is not 
-                                                                     // modified by reference unlike iinsert or iradix_r
-
 }
 
-static void dinsert(unsigned long long *x, int *o, int n)
+static void dinsert(struct sortContext *ctx, unsigned long long *x, int *o, int n, struct radixWork *w)
 // orders both x and o by reference in-place. Fast for small vectors, low overhead.
 // don't be tempted to binsearch backwards here, have to shift anyway; many memmove would have overhead and do the same thing
 // 'dinsert' will not be called when nalast = 0 and o[0] = -1.
@@ -632,14 +861,15 @@ static void dinsert(unsigned long long *x, int *o, int n)
         }
     }
     tt = 0;
-    for (i=1; i<n; i++) if (x[i]==x[i-1]) tt++; else { push(tt+1); tt=0; }
-    push(tt+1);
+    for (i=1; i<n; i++) if (x[i]==x[i-1]) tt++; else { wpush(ctx, w, tt+1); tt=0; }
+    wpush(ctx, w, tt+1);
 }
 
-static void dradix_r(unsigned char *xsub, int *osub, int n, int radix)
+static void dradix_r(struct sortContext *ctx, unsigned char *xsub, int *osub, int n, int radix, struct radixWork *w)
     /* xsub is a recursive offset into xsub working memory above in dradix, reordered by reference.
        osub is a an offset into the main answer o, reordered by reference.
-       dradix iterates 7,6,5,4,3,2,1,0 */
+       dradix iterates 7,6,5,4,3,2,1,0
+       Runs inside a parallel region as iradix_r does. */
 {
     int i, j, itmp, thisgrpn, nextradix;
     unsigned int *thiscounts;
@@ -648,10 +878,10 @@ static void dradix_r(unsigned char *xsub, int *osub, int n, int radix)
         /* 200 is guess based on limited testing. Needs calibrate(). Was 50 
         based on sum(1:50)=1275 worst -vs- 256 cummulate + 256 memset + 
         allowance since reverse order is unlikely */
-        dinsert((void *)xsub, osub, n);                                         // order=1 here because it's already taken care of in iradix
+        dinsert(ctx, (void *)xsub, osub, n, w);                                      // order=1 here because it's already taken care of in iradix
         return;
     }
-    thiscounts = radixcounts[radix];
+    thiscounts = w->counts[radix];
     p = xsub + RADIX_BYTE;
     for (i=0; i<n; i++) {
         thiscounts[*p]++;
@@ -662,38 +892,38 @@ static void dradix_r(unsigned char *xsub, int *osub, int n, int radix)
         if (thiscounts[i]) thiscounts[i] = (itmp += thiscounts[i]);             // don't cummulate through 0s, important below
     p = xsub + (n-1)*colSize;
     if (colSize == 4) {
-        error("Not yet used, still using iradix instead");
+        // Not yet used, still using iradix instead
         for (i=n-1; i>=0; i--) {
             j = --thiscounts[*(p+RADIX_BYTE)];
-            otmp[j] = osub[i];
-            ((int *)xtmp)[j] = *(int *)p;
+            w->otmp[j] = osub[i];
+            ((int *)w->xtmp)[j] = *(int *)p;
             p -= colSize;
         }
     } else { 
         for (i=n-1; i>=0; i--) {
             j = --thiscounts[*(p+RADIX_BYTE)];
-            otmp[j] = osub[i];
-            ((unsigned long long *)xtmp)[j] = *(unsigned long long *)p;
+            w->otmp[j] = osub[i];
+            ((unsigned long long *)w->xtmp)[j] = *(unsigned long long *)p;
             p -= colSize;
         }
     }
-    memcpy(osub, otmp, n*sizeof(int));
-    memcpy(xsub, xtmp, n*colSize);
+    memcpy(osub, w->otmp, n*sizeof(int));
+    memcpy(xsub, w->xtmp, n*colSize);
     
     nextradix = radix-1;
-    while (nextradix>=0 && skip[nextradix]) nextradix--;
+    while (nextradix>=0 && ctx->skip[nextradix]) nextradix--;
     // TO DO:  If nextradix==-1 and no further columns from forder,  we're done. We have o. Remember to memset thiscounts before returning.
     
-    if (thiscounts[0] != 0) Error("Logical error. thiscounts[0]=%d but should have been decremented to 0. radix=%d", thiscounts[0], radix);    
+    // thiscounts[0] must have been decremented to 0 here
     thiscounts[256] = n;
     itmp = 0;
     for (i=1; itmp<n && i<=256; i++) {
         if (thiscounts[i] == 0) continue;
         thisgrpn = thiscounts[i] - itmp;  // undo cummulate; i.e. diff
         if (thisgrpn == 1 || nextradix==-1) {
-            push(thisgrpn);
+            wpush(ctx, w, thisgrpn);
         } else {
-            dradix_r(xsub + itmp*colSize, osub+itmp, thisgrpn, nextradix);
+            dradix_r(ctx, xsub + itmp*colSize, osub+itmp, thisgrpn, nextradix, w);
         }
         itmp = thiscounts[i];
         thiscounts[i] = 0;
@@ -703,17 +933,11 @@ static void dradix_r(unsigned char *xsub, int *osub, int n, int radix)
 // TO DO?: dcount. Find step size, then range = (max-min)/step and proceed as icount. Many fixed precision floats (such as prices)
 // may be suitable. Fixed precision such as 1.10, 1.15, 1.20, 1.25, 1.30 ... do use all bits so dradix skipping may not help.
 
-static int *cradix_counts = NULL;
-static int cradix_counts_alloc = 0;
-static int maxlen = 1;
-static SEXP *cradix_xtmp = NULL;
-static int cradix_xtmp_alloc = 0;
-
-int StrCmp2(SEXP x, SEXP y) {    // same as StrCmp but also takes into account 'na.last' argument.
+static int StrCmp2(const struct sortContext *ctx, SEXP x, SEXP y) {    // same as StrCmp but also takes into account 'na.last' argument.
     if (x == y) return 0;                   // same cached pointer (including NA_STRING==NA_STRING)
-    if (x == NA_STRING) return nalast;      // if x=NA, nalast=1 ? then x > y else x < y (Note: nalast == 0 is already taken care of in 'csorted', won't be 0 here)
-    if (y == NA_STRING) return -nalast;     // if y=NA, nalast=1 ? then y > x
-    return order*strcmp(CHAR(ENC2UTF8(x)), CHAR(ENC2UTF8(y)));  // same as explanation in StrCmp
+    if (x == NA_STRING) return ctx->nalast; // if x=NA, nalast=1 ? then x > y else x < y (Note: nalast == 0 is already taken care of in 'csorted', won't be 0 here)
+    if (y == NA_STRING) return -ctx->nalast;// if y=NA, nalast=1 ? then y > x
+    return ctx->order*strcmp(CHAR(ENC2UTF8(x)), CHAR(ENC2UTF8(y)));  // same as explanation in StrCmp
 }
 
 int StrCmp(SEXP x, SEXP y)            // also used by bmerge and chmatch
@@ -732,7 +956,7 @@ int StrCmp(SEXP x, SEXP y)            // also used by bmerge and chmatch
 //        or UTF-8 is used by user, not both. Then error if not. If ok, then can proceed with byte level. ascii is never marked known by R, but non-ascii (i.e. knowable encoding) could be marked unknown.
 //        does R internals have is_ascii function exported?  If not, simple enough.
 
-static void cradix_r(SEXP *xsub, int n, int radix)
+static void cradix_r(struct sortContext *ctx, SEXP *xsub, int n, int radix)
 // xsub is a unique set of CHARSXP, to be ordered by reference
 // First time, radix==0, and xsub==x. Then recursively moves SEXP together for L1 cache efficiency.
 // Quite different to iradix because 
@@ -757,13 +981,13 @@ static void cradix_r(SEXP *xsub, int n, int radix)
     }
     // TO DO: if (n<50) cinsert (continuing from radix offset into CHAR) or using StrCmp. But 256 is narrow, so quick and not too much an issue.
     
-    thiscounts = cradix_counts + radix*256;
+    thiscounts = ctx->cradix_counts + radix*256;
     for (i=0; i<n; i++) {
         thisx = xsub[i]==NA_STRING ? 0 : (radix<LENGTH(xsub[i]) ? (unsigned char)(CHAR(xsub[i])[radix]) : 1);
         thiscounts[ thisx ]++;   // 0 for NA,  1 for ""
     }
-    if (thiscounts[thisx] == n && radix < maxlen-1) {   // this also catches when subx has shorter strings than the rest, thiscounts[0]==n and we'll recurse very quickly through to the overall maxlen with no 256 overhead each time
-        cradix_r(xsub, n, radix+1);
+    if (thiscounts[thisx] == n && radix < ctx->maxlen-1) {   // this also catches when subx has shorter strings than the rest, thiscounts[0]==n and we'll recurse very quickly through to the overall maxlen with no 256 overhead each time
+        cradix_r(ctx, xsub, n, radix+1);
         thiscounts[thisx] = 0;  // the rest must be 0 already, save the memset
         return;
     }
@@ -773,10 +997,10 @@ static void cradix_r(SEXP *xsub, int n, int radix)
     for (i=n-1; i>=0; i--) {
         thisx = xsub[i]==NA_STRING ? 0 : (radix<LENGTH(xsub[i]) ? (unsigned char)(CHAR(xsub[i])[radix]) : 1);
         j = --thiscounts[thisx];
-        cradix_xtmp[j] = xsub[i];
+        ctx->cradix_xtmp[j] = xsub[i];
     }
-    memcpy(xsub, cradix_xtmp, n*sizeof(SEXP));
-    if (radix == maxlen-1) {
+    memcpy(xsub, ctx->cradix_xtmp, n*sizeof(SEXP));
+    if (radix == ctx->maxlen-1) {
         memset(thiscounts, 0, 256*sizeof(int)); 
         return;
     }
@@ -785,17 +1009,252 @@ static void cradix_r(SEXP *xsub, int n, int radix)
     for (i=1;i<256;i++) {
         if (thiscounts[i] == 0) continue;
         thisgrpn = thiscounts[i] - itmp;  // undo cummulate; i.e. diff
-        cradix_r(xsub+itmp, thisgrpn, radix+1);
+        cradix_r(ctx, xsub+itmp, thisgrpn, radix+1);
         itmp = thiscounts[i];
         thiscounts[i] = 0;  // set to 0 now since we're here, saves memset afterwards. Important to clear! Also more portable for machines where 0 isn't all bits 0 (?!)
     }
-    if (itmp<n-1) cradix_r(xsub+itmp, n-itmp, radix+1);  // final group
+    if (itmp<n-1) cradix_r(ctx, xsub+itmp, n-itmp, radix+1);  // final group
+}
+
+/*
+   Large character columns (forder sets strhash from N_PAR rows) are ranked without R's global TRUELENGTH, so savetl isn't
+   needed and the work can be split across threads:
+     shash_pre   collects the unique CHARSXP into a private hash; each thread hashes a batch of rows, then the batches'
+                 uniques are merged in row order so hstr is in first appearance order. If sortStr, hstr is then ranked by
+                 sorting 8-byte big endian prefixes of the strings with dradix, and each run of equal prefixes by the next 8
+                 bytes, and so on.
+     shash_ranks looks up each row's rank in parallel, for csort (sorted rank) or cgroup (first appearance).
+   As cradix_r, strings are compared by their bytes; i.e. as strcmp.
+*/
+
+static inline size_t shash_slot(SEXP s, size_t mask) {
+    return (size_t)(((unsigned long long)(uintptr_t)s * 0x9E3779B97F4A7C15ULL) >> 32) & mask;  // Fibonacci hashing of the pointer
+}
+
+static Rboolean shash_grow(struct strHash *h, size_t size) {
+    // called from parallel regions on a thread's own hash, so returns FALSE rather than Error
+    SEXP *s = (SEXP *)calloc(size, sizeof(SEXP));
+    int *v = (int *)malloc(size * sizeof(int));
+    if (s == NULL || v == NULL) { free(s); free(v); return FALSE; }
+    for (size_t i=0; h->s && i<=h->mask; i++) {
+        if (h->s[i] == NULL) continue;
+        size_t j = shash_slot(h->s[i], size-1);
+        while (s[j]) j = (j+1) & (size-1);
+        s[j] = h->s[i];
+        v[j] = h->v[i];
+    }
+    free(h->s); free(h->v);
+    h->s = s; h->v = v; h->mask = size-1;
+    return TRUE;
+}
+
+static int shash_add(struct strHash *h, SEXP s, int v) {
+    // returns the value already held for s, or v when s is added. -2 when out of memory.
+    if ((h->s == NULL || 2*((size_t)h->n+1) > h->mask+1) && !shash_grow(h, h->s ? 2*(h->mask+1) : 1024)) return -2;
+    size_t i = shash_slot(s, h->mask);
+    while (h->s[i]) {
+        if (h->s[i] == s) return h->v[i];
+        i = (i+1) & h->mask;
+    }
+    h->s[i] = s;
+    h->v[i] = v;
+    h->n++;
+    return v;
+}
+
+static inline int shash_find(const struct strHash *h, SEXP s) {
+    size_t i = shash_slot(s, h->mask);
+    while (h->s[i] != s) {
+        if (h->s[i] == NULL) return -1;
+        i = (i+1) & h->mask;
+    }
+    return h->v[i];
+}
+
+static Rboolean shash_append(struct sortContext *ctx, SEXP s) {
+    // adds s to hstr if it's not there already
+    if (ctx->hstr_n == ctx->hstr_alloc) {
+        int newalloc = (ctx->hstr_alloc == 0) ? 10000 : ctx->hstr_alloc*2;
+        SEXP *tmp = (SEXP *)realloc(ctx->hstr, newalloc * sizeof(SEXP));
+        if (tmp == NULL) return FALSE;
+        ctx->hstr = tmp;
+        ctx->hstr_alloc = newalloc;
+    }
+    int v = shash_add(&ctx->hash, s, ctx->hstr_n);
+    if (v == -2) return FALSE;
+    if (v == ctx->hstr_n) ctx->hstr[ctx->hstr_n++] = s;
+    return TRUE;
+}
+
+static unsigned long long skey(const char *s, int len, int off) {
+    // bytes off to off+7 of s, most significant first and 0 padded. R's strings contain no 0 bytes so a shorter string sorts first.
+    const unsigned char *c = (const unsigned char *)s;
+    unsigned long long k = 0;
+    for (int j=0; j<8; j++) k = (k<<8) | (off+j<len ? c[off+j] : 0);
+    return k;
+}
+
+static unsigned long long ukey(void *p, int i, int order, int nalast) {
+    (void)order; (void)nalast;                                      // the shared key function signature of skey_sort
+    return ((unsigned long long *)p)[i];                            // the twiddle for skey, already in sort order
+}
+
+static void skey_sort(struct sortContext *ctx, const char **str, const int *len, int *idx, int m, int off)
+// Stable sort of idx (into str and len) by the bytes of the strings from off onwards. Their bytes before off are all equal.
+{
+    if (m < N_SMALL) {
+        for (int i=1; i<m; i++) {
+            int itmp = idx[i], j = i-1;
+            const char *stmp = str[itmp] + off;
+            while (j>=0 && strcmp(stmp, str[idx[j]] + off) < 0) { idx[j+1] = idx[j]; j--; }
+            idx[j+1] = itmp;
+        }
+        return;
+    }
+    unsigned long long *key = (unsigned long long *)malloc(m * sizeof(unsigned long long));
+    int *o = (int *)malloc(m * sizeof(int)), *tmp = (int *)malloc(m * sizeof(int));
+    if (key == NULL || o == NULL || tmp == NULL) {
+        free(key); free(o); free(tmp);
+        Error("Failed to allocate working memory to sort %d unique strings", m);
+    }
+    int nth = (m < N_PAR) ? 1 : getDTthreads();
+    #pragma omp parallel for num_threads(nth)
+    for (int j=0; j<m; j++) key[j] = skey(str[idx[j]], len[idx[j]], off);
+    
+    int order = ctx->order, nalast = ctx->nalast;
+    Rboolean stackgrps = ctx->stackgrps;
+    unsigned long long (*twiddle)(void *, int, int, int) = ctx->twiddle;
+    ctx->order = 1; ctx->nalast = -1; ctx->stackgrps = FALSE; ctx->twiddle = &ukey;
+    dradix(ctx, (unsigned char *)key, o, m);                        // multi-threaded from N_PAR unique strings
+    ctx->order = order; ctx->nalast = nalast; ctx->stackgrps = stackgrps; ctx->twiddle = twiddle;
+    
+    for (int j=0; j<m; j++) tmp[j] = idx[o[j]-1];
+    memcpy(idx, tmp, m * sizeof(int));
+    free(tmp);
+    // a run of equal keys ending in a 0 byte are the same string. Otherwise they're all at least off+8 long and the next 8 bytes decide.
+    for (int a=0, j=1; j<=m; j++) {
+        if (j<m && key[o[j]-1] == key[o[a]-1]) continue;
+        if (j-a > 1 && (key[o[a]-1] & 0xff)) skey_sort(ctx, str, len, idx+a, j-a, off+8);
+        a = j;
+    }
+    free(key); free(o);
+}
+
+static int ustr_sort(struct sortContext *ctx, SEXP *s, int m, int *idx)
+// Places the indices of the non-NA of the unique strings s[0..m) in idx, in sorted order, and returns how many there are.
+// With collate, their strxfrm keys are computed once each, into one contiguous buffer, and those are sorted instead.
+{
+    const char **str = (const char **)malloc(m * sizeof(char *));
+    int *len = (int *)malloc(m * sizeof(int)), *p = (int *)malloc(m * sizeof(int));
+    size_t *start = NULL;
+    char *buf = NULL;
+    if (str == NULL || len == NULL || p == NULL) { free(str); free(len); free(p); Error("Failed to allocate working memory to sort %d unique strings", m); }
+    int k = 0;
+    const void *vmax = vmaxget();
+    for (int i=0; i<m; i++) {
+        if (s[i] == NA_STRING) continue;
+        str[k] = ctx->collate ? translateChar(s[i]) : CHAR(s[i]);  // translateChar is R API so isn't in the parallel region
+        len[k] = LENGTH(s[i]);
+        idx[k++] = i;
+    }
+    if (ctx->collate) {
+        int nth = (k < N_PAR) ? 1 : getDTthreads();
+        start = (size_t *)malloc((k+1) * sizeof(size_t));
+        if (start == NULL) { vmaxset(vmax); free(str); free(len); free(p); Error("Failed to allocate working memory for %d collation keys", k); }
+        start[0] = 0;
+        #pragma omp parallel for num_threads(nth)
+        for (int j=0; j<k; j++) start[j+1] = strxfrm(NULL, str[j], 0) + 1;
+        for (int j=0; j<k; j++) start[j+1] += start[j];
+        size_t nbytes = start[k];
+        buf = (char *)malloc(nbytes);
+        if (buf == NULL) { vmaxset(vmax); free(str); free(len); free(p); free(start); Error("Failed to allocate %.0f bytes for collation keys", (double)nbytes); }
+        #pragma omp parallel for num_threads(nth)
+        for (int j=0; j<k; j++) {
+            strxfrm(buf + start[j], str[j], start[j+1]-start[j]);
+            len[j] = (int)(start[j+1]-start[j]-1);
+        }
+        for (int j=0; j<k; j++) str[j] = buf + start[j];
+        vmaxset(vmax);                                              // translations no longer needed
+    }
+    for (int j=0; j<k; j++) p[j] = j;
+    skey_sort(ctx, str, len, p, k, 0);
+    for (int j=0; j<k; j++) len[j] = idx[p[j]];                     // len reused as temp
+    memcpy(idx, len, k * sizeof(int));
+    free(str); free(len); free(p); free(start); free(buf);
+    return k;
+}
+
+static void shash_pre(struct sortContext *ctx, SEXP *x, int n)
+// The strhash equivalent of csort_pre. As ustr there, hstr is grown on each character column.
+{
+    int nth = (n < N_PAR) ? 1 : getDTthreads();
+    if (nth == 1) {
+        for (int i=0; i<n; i++) if (!shash_append(ctx, x[i])) Error("Failed to allocate working memory for the unique strings");
+    } else {
+        struct { struct strHash h; SEXP *u; int nu, ualloc; Rboolean oom; } *loc = calloc(nth, sizeof(*loc));
+        if (loc == NULL) Error("Failed to allocate working memory for %d threads", nth);
+        int batchSize = (n-1)/nth + 1;
+        int nBatch = (n-1)/batchSize + 1;
+        #pragma omp parallel for num_threads(nth)
+        for (int batch=0; batch<nBatch; batch++) {
+            int to = (batch==nBatch-1) ? n : (batch+1)*batchSize;
+            for (int i=batch*batchSize; i<to && !loc[batch].oom; i++) {
+                int v = shash_add(&loc[batch].h, x[i], loc[batch].nu);
+                if (v == -2) { loc[batch].oom = TRUE; break; }
+                if (v != loc[batch].nu) continue;
+                if (loc[batch].nu == loc[batch].ualloc) {
+                    int newalloc = (loc[batch].ualloc == 0) ? 10000 : loc[batch].ualloc*2;
+                    SEXP *tmp = (SEXP *)realloc(loc[batch].u, newalloc * sizeof(SEXP));
+                    if (tmp == NULL) { loc[batch].oom = TRUE; break; }
+                    loc[batch].u = tmp;
+                    loc[batch].ualloc = newalloc;
+                }
+                loc[batch].u[loc[batch].nu++] = x[i];
+            }
+        }
+        Rboolean oom = FALSE;
+        for (int batch=0; batch<nBatch; batch++) {                  // in batch order to keep first appearance order
+            oom |= loc[batch].oom;
+            for (int k=0; k<loc[batch].nu && !oom; k++) oom = !shash_append(ctx, loc[batch].u[k]);
+        }
+        for (int batch=0; batch<nBatch; batch++) { free(loc[batch].h.s); free(loc[batch].h.v); free(loc[batch].u); }
+        free(loc);
+        if (oom) Error("Failed to allocate working memory for the unique strings in the parallel hash");
+    }
+    if (!ctx->sortStr || ctx->hrank_n == ctx->hstr_n) return;       // cgroup ranks by first appearance; or no new strings since the previous column
+    // rank them all.  TO DO: as csort_pre, just sort the new ones and merge them in.
+    int m = ctx->hstr_n;
+    if (ctx->hrank_alloc < m) {
+        free(ctx->hrank);
+        ctx->hrank = (int *)malloc(ctx->hstr_alloc * sizeof(int));
+        ctx->hrank_alloc = ctx->hrank ? ctx->hstr_alloc : 0;
+        if (ctx->hrank == NULL) Error("Failed to allocate working memory for the ranks of %d unique strings", m);
+    }
+    int *idx = ctx->hrank;                                          // sort the indices in place and then invert into ranks
+    int k = ustr_sort(ctx, ctx->hstr, m, idx);
+    int *rank = (int *)malloc(m * sizeof(int));
+    if (rank == NULL) Error("Failed to allocate working memory for the ranks of %d unique strings", m);
+    for (int i=0; i<k; i++) rank[idx[i]] = i+1;
+    for (int i=0; i<m; i++) if (ctx->hstr[i] == NA_STRING) rank[i] = NA_INTEGER;
+    memcpy(ctx->hrank, rank, m * sizeof(int));
+    free(rank);
+    ctx->hrank_n = m;
+}
+
+static void shash_ranks(struct sortContext *ctx, SEXP *x, int *ans, int n, Rboolean sorted) {
+    const struct strHash *h = &ctx->hash;
+    const int *hrank = ctx->hrank;
+    int nth = (n < N_PAR) ? 1 : getDTthreads();
+    #pragma omp parallel for num_threads(nth)
+    for (int i=0; i<n; i++) {
+        int v = shash_find(h, x[i]);                                // all of x was added by shash_pre
+        ans[i] = sorted ? hrank[v] : v+1;
+    }
 }
 
-static SEXP *ustr = NULL;
-static int ustr_alloc = 0, ustr_n = 0;
+static void csort_ranks(struct sortContext *ctx, int *o, int n);
 
-static void cgroup(SEXP *x, int *o, int n)
+static void cgroup(struct sortContext *ctx, SEXP *x, int *o, int n)
 // As icount :
 //   Places the ordering into o directly, overwriting whatever was there
 //   Doesn't change x
@@ -804,10 +1263,19 @@ static void cgroup(SEXP *x, int *o, int n)
 // Since it doesn't sort the strings, the name is cgroup.
 // there is no _pre for this.  ustr created and cleared each time.
 {
-    SEXP s;
-    int i, k, cumsum;
+    if (ctx->strhash) {
+        // first appearance ranks; the counting sort is stable so each group's rows stay in order
+        int order = ctx->order, nalast = ctx->nalast;
+        shash_ranks(ctx, x, ctx->csort_otmp, n, FALSE);
+        ctx->order = 1; ctx->nalast = -1;                           // as below, NA is just another group here
+        csort_ranks(ctx, o, n);
+        ctx->order = order; ctx->nalast = nalast;
+        return;
+    }
+    SEXP s, *ustr = ctx->ustr;
+    int i, k, cumsum, ustr_n = 0, ustr_alloc = ctx->ustr_alloc;
     // savetl_init() is called once at the start of forder
-    if (ustr_n != 0) Error("Internal error. ustr isn't empty when starting cgroup: ustr_n=%d, ustr_alloc=%d", ustr_n, ustr_alloc);
+    if (ctx->ustr_n != 0) Error("Internal error. ustr isn't empty when starting cgroup: ustr_n=%d, ustr_alloc=%d", ctx->ustr_n, ustr_alloc);
     for(i=0; i<n; i++) {
         s = x[i];
         if (TRUELENGTH(s)<0) {                   // this case first as it's the most frequent
@@ -821,37 +1289,38 @@ static void cgroup(SEXP *x, int *o, int n)
         if (ustr_alloc<=ustr_n) {
             ustr_alloc = (ustr_alloc == 0) ? 10000 : ustr_alloc*2;  // 10000 = 78k of 8byte pointers. Small initial guess, negligible time to alloc. 
             if (ustr_alloc>n) ustr_alloc = n;
-            ustr = realloc(ustr, ustr_alloc * sizeof(SEXP));
-            if (ustr == NULL) Error("Unable to realloc %d * %d bytes in cgroup", ustr_alloc, sizeof(SEXP));
+            ctx->ustr = ustr = realloc(ustr, ustr_alloc * sizeof(SEXP));
+            if (ustr == NULL) { ctx->ustr_alloc = 0; Error("Unable to realloc %d * %d bytes in cgroup", ustr_alloc, sizeof(SEXP)); }
+            ctx->ustr_alloc = ustr_alloc;
         }
         SET_TRUELENGTH(s, -1); 
         ustr[ustr_n++] = s;
+        ctx->ustr_n = ustr_n;  // so Error() resets these TRUELENGTH
     }
     // TO DO: the same string in different encodings will be considered different here. Sweep through ustr and merge counts where equal (sort needed therefore, unfortunately?, only if there are any marked encodings present)
     cumsum = 0;
     for(i=0; i<ustr_n; i++) {                                    // 0.000
-        push(-TRUELENGTH(ustr[i]));                            
+        push(ctx, -TRUELENGTH(ustr[i]));                       
         SET_TRUELENGTH(ustr[i], cumsum += -TRUELENGTH(ustr[i]));
     }
-    int *target = (o[0] != -1) ? newo : o;
+    int *target = (o[0] != -1) ? ctx->newo : o;
     for(i=n-1; i>=0; i--) {                     
         s = x[i];                                            // 0.400 (page fetches on string cache)
         SET_TRUELENGTH(s, k = TRUELENGTH(s)-1);
         target[k] = i+1;                                     // 0.800 (random access to o)
     }
     for(i=0; i<ustr_n; i++) SET_TRUELENGTH(ustr[i],0);     // The cummulate meant counts are left non zero, so reset for next time (0.00s).
-    ustr_n = 0;
+    ctx->ustr_n = 0;
 }
 
-static int *csort_otmp=NULL, csort_otmp_alloc=0;
-static void alloc_csort_otmp(int n) {
-    if (csort_otmp_alloc >= n) return;
-    csort_otmp = (int *)realloc(csort_otmp, n * sizeof(int));
-    if (csort_otmp == NULL) Error("Failed to allocate working memory for csort_otmp. Requested %d * %d bytes", n, sizeof(int));
-    csort_otmp_alloc = n;
+static void alloc_csort_otmp(struct sortContext *ctx, int n) {
+    if (ctx->csort_otmp_alloc >= n) return;
+    ctx->csort_otmp = (int *)realloc(ctx->csort_otmp, n * sizeof(int));
+    if (ctx->csort_otmp == NULL) { ctx->csort_otmp_alloc = 0; Error("Failed to allocate working memory for csort_otmp. Requested %d * %d bytes", n, sizeof(int)); }
+    ctx->csort_otmp_alloc = n;
 }
 
-static void csort(SEXP *x, int *o, int n)
+static void csort(struct sortContext *ctx, SEXP *x, int *o, int n)
 /* 
    As icount :
     Places the ordering into o directly, overwriting whatever was there
@@ -860,40 +1329,49 @@ static void csort(SEXP *x, int *o, int n)
    Requires csort_pre() to have created and sorted ustr already 
 */
 {
-    int i;
-    /* can't use otmp, since iradix might be called here and that uses otmp (and xtmp).
+    int i, *csort_otmp = ctx->csort_otmp;
+    /* can't use otmp, since iradix might be called here and that uses its own otmp (and xtmp).
        alloc_csort_otmp(n) is called from forder for either n=nrow if 1st column, 
        or n=maxgrpn if onwards columns */
-    for(i=0; i<n; i++) csort_otmp[i] = (x[i] == NA_STRING) ? NA_INTEGER : -TRUELENGTH(x[i]);
-    if (nalast == 0 && n == 2) {                        // special case for nalast==0. n==1 is handled inside forder. at least 1 will be NA here
+    if (ctx->strhash) shash_ranks(ctx, x, csort_otmp, n, TRUE);
+    else for(i=0; i<n; i++) csort_otmp[i] = (x[i] == NA_STRING) ? NA_INTEGER : -TRUELENGTH(x[i]);
+    csort_ranks(ctx, o, n);
+}
+
+static void csort_ranks(struct sortContext *ctx, int *o, int n)
+// sorts the ranks csort placed in csort_otmp
+{
+    int i, *csort_otmp = ctx->csort_otmp;
+    if (ctx->nalast == 0 && n == 2 && (csort_otmp[0] == NA_INTEGER || csort_otmp[1] == NA_INTEGER)) {  // special case for nalast==0. n==1 is handled inside forder. at least 1 will be NA here unless collate
         if (o[0] == -1) for (i=0; i<n; i++) o[i] = i+1;    // else use o from caller directly (not 1st column)
         for (int i=0; i<n; i++) if (csort_otmp[i] == NA_INTEGER) o[i] = 0;
-        push(1); push(1);
+        push(ctx, 1); push(ctx, 1);
         return; 
     }
-    if (n < N_SMALL && nalast != 0) {                                    // TO DO: calibrate() N_SMALL=200
+    if (n < N_SMALL && ctx->nalast != 0) {                               // TO DO: calibrate() N_SMALL=200
         if (o[0] == -1) for (i=0; i<n; i++) o[i] = i+1;    // else use o from caller directly (not 1st column)
-        for (int i=0; i<n; i++) csort_otmp[i] = icheck(csort_otmp[i]);
-        iinsert(csort_otmp, o, n);
+        for (int i=0; i<n; i++) csort_otmp[i] = icheck(ctx, csort_otmp[i]);
+        iinsert(ctx, csort_otmp, o, n, NULL);
     } else {
-        setRange(csort_otmp, n);
-        if (range == NA_INTEGER) Error("Internal error. csort's otmp contains all-NA");
-        int *target = (o[0] != -1) ? newo : o; 
-        if (range <= N_RANGE) // && range<n)            // TO DO: calibrate(). radix was faster (9.2s "range<=10000" instead of 11.6s 
-            icount(csort_otmp, target, n);       // "range<=N_RANGE && range<n") for run(7) where range=N_RANGE n=10000000
-        else iradix(csort_otmp, target, n);
+        setRange(ctx, csort_otmp, n);
+        if (ctx->range == NA_INTEGER) Error("Internal error. csort's otmp contains all-NA");
+        int *target = (o[0] != -1) ? ctx->newo : o; 
+        if (ctx->range <= N_RANGE) // && range<n)       // TO DO: calibrate(). radix was faster (9.2s "range<=10000" instead of 11.6s 
+            icount(ctx, csort_otmp, target, n);  // "range<=N_RANGE && range<n") for run(7) where range=N_RANGE n=10000000
+        else iradix(ctx, csort_otmp, target, n);
     }
     // all i* push onto stack. Using their counts may be faster here than thrashing SEXP fetches over several passes as cgroup does
     // (but cgroup needs that to keep orginal order, and cgroup saves the sort in csort_pre).
 }
 
-static void csort_pre(SEXP *x, int n)
+static void csort_pre(struct sortContext *ctx, SEXP *x, int n)
 // Finds ustr and sorts it.
 // Runs once for each column (if sortStr==TRUE), then ustr is used by csort within each group
 // ustr is grown on each character column, to save sorting the same strings again if several columns contain the same strings
 {
-    SEXP s;
-    int i, old_un, new_un;
+    if (ctx->strhash) { shash_pre(ctx, x, n); return; }
+    SEXP s, *ustr = ctx->ustr;
+    int i, old_un, new_un, ustr_n = ctx->ustr_n, ustr_alloc = ctx->ustr_alloc, maxlen = ctx->maxlen;
     // savetl_init() is called once at the start of forder
     old_un = ustr_n;
     for(i=0; i<n; i++) {
@@ -906,30 +1384,41 @@ static void csort_pre(SEXP *x, int n)
         if (ustr_alloc<=ustr_n) {
             ustr_alloc = (ustr_alloc == 0) ? 10000 : ustr_alloc*2;  // 10000 = 78k of 8byte pointers. Small initial guess, negligible time to alloc. 
             if (ustr_alloc > old_un+n) ustr_alloc = old_un + n;
-            ustr = realloc(ustr, ustr_alloc * sizeof(SEXP));
-            if (ustr==NULL) Error("Failed to realloc ustr. Requested %d * %d bytes", ustr_alloc, sizeof(SEXP));
+            ctx->ustr = ustr = realloc(ustr, ustr_alloc * sizeof(SEXP));
+            if (ustr==NULL) { ctx->ustr_alloc = 0; Error("Failed to realloc ustr. Requested %d * %d bytes", ustr_alloc, sizeof(SEXP)); }
+            ctx->ustr_alloc = ustr_alloc;
         }
         SET_TRUELENGTH(s, -1);  // this -1 will become its ordering later below
         ustr[ustr_n++] = s;
+        ctx->ustr_n = ustr_n;   // so Error() resets these TRUELENGTH
         if (s!=NA_STRING && LENGTH(s)>maxlen) maxlen=LENGTH(s);  // length on CHARSXP is the nchar of char * (excluding \0), and treats marked encodings as if ascii.
     }
+    ctx->maxlen = maxlen;
     new_un = ustr_n;
     if (new_un == old_un) return;  // No new strings observed, seen them all before in previous column. ustr already sufficient.
     // If we ever make ustr permanently held by data.table, we'll just need to make the final loop to set -i-1 before returning here.
     // sort ustr.  TO DO: just sort new ones and merge them in.
     // These allocs are here, to save them being in the recursive cradix_r()
-    if (cradix_counts_alloc < maxlen) {
-        cradix_counts_alloc = maxlen + 10;   // +10 to save too many reallocs
-        cradix_counts = (int *)realloc(cradix_counts, cradix_counts_alloc * 256 * sizeof(int) );  // stack of counts
-        if (!cradix_counts) Error("Failed to alloc cradix_counts");
-        memset(cradix_counts, 0, cradix_counts_alloc * 256 * sizeof(int));
-    }
-    if (cradix_xtmp_alloc < ustr_n) {
-        cradix_xtmp = (SEXP *)realloc( cradix_xtmp,  ustr_n * sizeof(SEXP) );  // TO DO: Reuse the one we have in forder. Does it need to be n length?
-        if (!cradix_xtmp) Error("Failed to alloc cradix_tmp");
-        cradix_xtmp_alloc = ustr_n;
-    }
-    cradix_r(ustr, ustr_n, 0);  // sorts ustr in-place by reference
+    if (ctx->cradix_counts_alloc < maxlen) {
+        ctx->cradix_counts_alloc = maxlen + 10;   // +10 to save too many reallocs
+        ctx->cradix_counts = (int *)realloc(ctx->cradix_counts, ctx->cradix_counts_alloc * 256 * sizeof(int) );  // stack of counts
+        if (!ctx->cradix_counts) { ctx->cradix_counts_alloc = 0; Error("Failed to alloc cradix_counts"); }
+        memset(ctx->cradix_counts, 0, ctx->cradix_counts_alloc * 256 * sizeof(int));
+    }
+    if (ctx->cradix_xtmp_alloc < ustr_n) {
+        ctx->cradix_xtmp = (SEXP *)realloc( ctx->cradix_xtmp,  ustr_n * sizeof(SEXP) );  // TO DO: Reuse the one we have in forder. Does it need to be n length?
+        if (!ctx->cradix_xtmp) { ctx->cradix_xtmp_alloc = 0; Error("Failed to alloc cradix_tmp"); }
+        ctx->cradix_xtmp_alloc = ustr_n;
+    }
+    if (ctx->collate) {
+        int *idx = (int *)malloc(ustr_n * sizeof(int));
+        if (idx == NULL) Error("Failed to allocate working memory to sort %d unique strings", ustr_n);
+        int k = ustr_sort(ctx, ustr, ustr_n, idx), j = 0;
+        if (k < ustr_n) ctx->cradix_xtmp[j++] = NA_STRING;           // NA first, as cradix_r
+        for (i=0; i<k; i++) ctx->cradix_xtmp[j++] = ustr[idx[i]];
+        memcpy(ustr, ctx->cradix_xtmp, ustr_n * sizeof(SEXP));
+        free(idx);
+    } else cradix_r(ctx, ustr, ustr_n, 0);  // sorts ustr in-place by reference
     for(i=0; i<ustr_n; i++)     // save ordering in the CHARSXP. negative so as to distinguish with R's own usage.
         SET_TRUELENGTH(ustr[i], -i-1);
 }
@@ -941,152 +1430,373 @@ static void csort_pre(SEXP *x, int n)
 // If a vector is in decreasing order *with ties*, then an in-place reverse (no sort) would result in instability of ties (TO DO).
 // For use by forder only, which now returns NULL if already sorted (hence no need for separate is.sorted).
 // TO DO: test in big steps first to return faster if unsortedness is at the end (a common case of rbind'ing data to end)
+//        Numeric columns that are a few sorted runs like that are now merged by runmerge() rather than radix sorted.
 // These are all sequential access to x, so very quick and cache efficient.
 
-static int isorted(int *x, int n)                           // order = 1 is ascending and order=-1 is descending
+static int isorted(struct sortContext *ctx, int *x, int n)  // order = 1 is ascending and order=-1 is descending
 {                                                           // also takes care of na.last argument with check through 'icheck'
                                                             // Relies on NA_INTEGER==INT_MIN, checked in init.c
     int i=1,j=0;
-    if (nalast == 0) {                                      // when nalast = NA, 
+    if (ctx->nalast == 0) {                                 // when nalast = NA, 
         for (int k=0; k<n; k++) if (x[k] != NA_INTEGER) j++;
-        if (j == 0) { push(n); return(-2); }                // all NAs ? return special value to replace all o's values with '0'
+        if (j == 0) { push(ctx, n); return(-2); }           // all NAs ? return special value to replace all o's values with '0'
         if (j != n) return(0);                              // any NAs ? return 0 = unsorted and leave it to sort routines to replace o's with 0's
     }                                                       // no NAs  ? continue to check the rest of isorted - the same routine as usual
-    if (n<=1) { push(n); return(1); }
-    if (icheck(x[1]) < icheck(x[0])) {
+    if (n<=1) { push(ctx, n); return(1); }
+    if (icheck(ctx, x[1]) < icheck(ctx, x[0])) {
         i = 2;
-        while (i<n && icheck(x[i]) < icheck(x[i-1])) i++;
-        if (i==n) { mpush(1,n); return(-1);}                // strictly opposite to expected 'order', no ties; 
+        while (i<n && icheck(ctx, x[i]) < icheck(ctx, x[i-1])) i++;
+        if (i==n) { mpush(ctx, 1,n); return(-1);}           // strictly opposite to expected 'order', no ties; 
                                                             // e.g. no more than one NA at the beginning/end (for order=-1/1)
         else return(0);
     }
-    int old = gsngrp[flip];
+    int old = ctx->gsngrp[ctx->flip];
     int tt = 1;
     for (i=1; i<n; i++) {
-        if (icheck(x[i]) < icheck(x[i-1])) { gsngrp[flip] = old; return(0); }
-        if (x[i]==x[i-1]) tt++; else { push(tt); tt=1; }
+        if (icheck(ctx, x[i]) < icheck(ctx, x[i-1])) { ctx->gsngrp[ctx->flip] = old; return(0); }
+        if (x[i]==x[i-1]) tt++; else { push(ctx, tt); tt=1; }
     }
-    push(tt);
+    push(ctx, tt);
     return(1);                                              // same as 'order', NAs at the beginning for order=1, at end for order=-1, possibly with ties
 }
 
-static int dsorted(double *x, int n)                        // order=1 is ascending and -1 is descending
+static int dsorted(struct sortContext *ctx, double *x, int n) // order=1 is ascending and -1 is descending
 {                                                           // also accounts for nalast=0 (=NA), =1 (TRUE), -1 (FALSE) (in twiddle)
     int i=1,j=0;
     unsigned long long prev, this;
-    if (nalast == 0) {                                      // when nalast = NA, 
-        for (int k=0; k<n; k++) if (!is_nan(x, k)) j++;
-        if (j == 0) { push(n); return(-2); }                // all NAs ? return special value to replace all o's values with '0'
+    if (ctx->nalast == 0) {                                 // when nalast = NA, 
+        for (int k=0; k<n; k++) if (!ctx->is_nan(x, k)) j++;
+        if (j == 0) { push(ctx, n); return(-2); }           // all NAs ? return special value to replace all o's values with '0'
         if (j != n) return(0);                              // any NAs ? return 0 = unsorted and leave it to sort routines to replace o's with 0's
     }                                                       // no NAs  ? continue to check the rest of isorted - the same routine as usual
-    if (n<=1) { push(n); return(1); }
-    prev = twiddle(x,0,order);
-    this = twiddle(x,1,order);
+    if (n<=1) { push(ctx, n); return(1); }
+    prev = ctx->twiddle(x,0,ctx->order,ctx->nalast);
+    this = ctx->twiddle(x,1,ctx->order,ctx->nalast);
     if (this < prev) {
         i = 2;
         prev=this;
-        while (i<n && (this=twiddle(x,i,order)) < prev) {i++; prev=this; }
-        if (i==n) { mpush(1,n); return(-1);}                // strictly opposite of expected 'order', no ties; 
+        while (i<n && (this=ctx->twiddle(x,i,ctx->order,ctx->nalast)) < prev) {i++; prev=this; }
+        if (i==n) { mpush(ctx, 1,n); return(-1);}           // strictly opposite of expected 'order', no ties; 
                                                             // e.g. no more than one NA at the beginning/end (for order=-1/1)
         else return(0);                                     // TO DO: improve to be stable for ties in reverse
     }
-    int old = gsngrp[flip];
+    int old = ctx->gsngrp[ctx->flip];
     int tt = 1;
     for (i=1; i<n; i++) {
-        this = twiddle(x,i,order);                          // TO DO: once we get past -Inf, NA and NaN at the bottom,  and +Inf at the top, 
+        this = ctx->twiddle(x,i,ctx->order,ctx->nalast);    // TO DO: once we get past -Inf, NA and NaN at the bottom,  and +Inf at the top, 
                                                             //        the middle only need be twiddled for tolerance (worth it?)
-        if (this < prev) { gsngrp[flip] = old; return(0); }
-        if (this==prev) tt++; else { push(tt); tt=1; }
+        if (this < prev) { ctx->gsngrp[ctx->flip] = old; return(0); }
+        if (this==prev) tt++; else { push(ctx, tt); tt=1; }
         prev = this;
     }
-    push(tt);
+    push(ctx, tt);
     return(1);                                              // exactly as expected in 'order' (1=increasing, -1=decreasing), possibly with ties
 }
 
-static int csorted(SEXP *x, int n)                          // order=1 is ascending and -1 is descending
+static int csorted(struct sortContext *ctx, SEXP *x, int n) // order=1 is ascending and -1 is descending
 {                                                           // also accounts for nalast=0 (=NA), =1 (TRUE), -1 (FALSE)
     int i=1, j=0, tmp;
-    if (nalast == 0) {                                      // when nalast = NA, 
+    if (ctx->nalast == 0) {                                 // when nalast = NA, 
         for (int k=0; k<n; k++) if (x[k] != NA_STRING) j++;
-        if (j == 0) { push(n); return(-2); }                // all NAs ? return special value to replace all o's values with '0'
+        if (j == 0) { push(ctx, n); return(-2); }           // all NAs ? return special value to replace all o's values with '0'
         if (j != n) return(0);                              // any NAs ? return 0 = unsorted and leave it to sort routines to replace o's with 0's
     }                                                       // no NAs  ? continue to check the rest of isorted - the same routine as usual
-    if (n<=1) { push(n); return(1); }
-    if (StrCmp2(x[1],x[0])<0) {
+    if (n<=1) { push(ctx, n); return(1); }
+    if (ctx->collate) return(0);                            // StrCmp2 compares bytes. csort finds the ties.
+    if (StrCmp2(ctx, x[1],x[0])<0) {
         i = 2;
-        while (i<n && StrCmp2(x[i],x[i-1])<0) i++;
-        if (i==n) { mpush(1,n); return(-1);}                // strictly opposite of expected 'order', no ties; 
+        while (i<n && StrCmp2(ctx, x[i],x[i-1])<0) i++;
+        if (i==n) { mpush(ctx, 1,n); return(-1);}           // strictly opposite of expected 'order', no ties; 
                                                             // e.g. no more than one NA at the beginning/end (for order=-1/1)
         else return(0);
     }
-    int old = gsngrp[flip];
+    int old = ctx->gsngrp[ctx->flip];
     int tt = 1;
     for (i=1; i<n; i++) {
-        tmp = StrCmp2(x[i],x[i-1]);
-        if (tmp < 0) { gsngrp[flip] = old; return(0); }
-        if (tmp == 0) tt++; else { push(tt); tt=1; }
+        tmp = StrCmp2(ctx, x[i],x[i-1]);
+        if (tmp < 0) { ctx->gsngrp[ctx->flip] = old; return(0); }
+        if (tmp == 0) tt++; else { push(ctx, tt); tt=1; }
     }
-    push(tt);
+    push(ctx, tt);
     return(1);                                              // exactly as expected in 'order', possibly with ties 
 }
 
-static void isort(int *x, int *o, int n)
+static void isort(struct sortContext *ctx, int *x, int *o, int n)
 {
     if (n<=2) {
-        if (nalast == 0 && n == 2) {                        // nalast = 0 and n == 2 (check bottom of this file for explanation)
+        if (ctx->nalast == 0 && n == 2) {                   // nalast = 0 and n == 2 (check bottom of this file for explanation)
             if (o[0]==-1) { o[0]=1; o[1]=2; }
             for (int i=0; i<n; i++) if (x[i] == NA_INTEGER) o[i] = 0; 
-            push(1); push(1);
+            push(ctx, 1); push(ctx, 1);
             return;
         } else Error("Internal error: isort received n=%d. isorted should have dealt with this (e.g. as a reverse sorted vector) already",n);
     }
-    if (n<N_SMALL && o[0] != -1 && nalast != 0) {                 // see comment above in iradix_r on N_SMALL=200.
+    if (n<N_SMALL && o[0] != -1 && ctx->nalast != 0) {            // see comment above in iradix_r on N_SMALL=200.
         /* if not o[0] then can't just populate with 1:n here, since x is changed by ref too (so would need to be copied). */
         /* pushes inside too. Changes x and o by reference, so not suitable  in first column when o hasn't been populated yet 
            and x is the actual column in DT (hence check on o[0]). */
-        if (order != 1 || nalast != -1)                     // so that default case, i.e., order=1, nalast=FALSE will not be affected (ex: `setkey`)
-            for (int i=0; i<n; i++) x[i] = icheck(x[i]);
-        iinsert(x, o, n);
+        if (ctx->order != 1 || ctx->nalast != -1)           // so that default case, i.e., order=1, nalast=FALSE will not be affected (ex: `setkey`)
+            for (int i=0; i<n; i++) x[i] = icheck(ctx, x[i]);
+        iinsert(ctx, x, o, n, NULL);
     } else {
         /* Tighter range (e.g. copes better with a few abormally large values in some groups), but also, when setRange was once at 
            colum level that caused an extra scan of (long) x first. 10,000 calls to setRange takes just 0.04s i.e. negligible. */
-        setRange(x, n);
-        if (range==NA_INTEGER) Error("Internal error: isort passed all-NA. isorted should have caught this before this point");
-        int *target = (o[0] != -1) ? newo : o;
-        if (range<=N_RANGE && range<=n) {                   // was range<10000 for subgroups, but 1e5 for the first column, 
-            icount(x, target, n);                           // tried to generalise here.  1e4 rather than 1e5 here because iterated
+        setRange(ctx, x, n);
+        if (ctx->range==NA_INTEGER) Error("Internal error: isort passed all-NA. isorted should have caught this before this point");
+        int *target = (o[0] != -1) ? ctx->newo : o;
+        if (ctx->range<=N_RANGE && ctx->range<=n) {         // was range<10000 for subgroups, but 1e5 for the first column, 
+            icount(ctx, x, target, n);                      // tried to generalise here.  1e4 rather than 1e5 here because iterated
         } else {                                            // was (thisgrpn < 200 || range > 20000) then radix
-            iradix(x, target, n);                           // a short vector with large range can bite icount when iterated (BLOCK 4 and 6)
+            iradix(ctx, x, target, n);                      // a short vector with large range can bite icount when iterated (BLOCK 4 and 6)
         }
     }
     // TO DO: add calibrate() to init.c
 }
 
-static void dsort(double *x, int *o, int n)
+static void dsort(struct sortContext *ctx, double *x, int *o, int n)
 {
     if (n <= 2) {                                           // nalast = 0 and n == 2 (check bottom of this file for explanation)
-        if (nalast == 0 && n == 2) {                        // don't have to twiddle here.. at least one will be NA and 'n' WILL BE 2.
+        if (ctx->nalast == 0 && n == 2) {                   // don't have to twiddle here.. at least one will be NA and 'n' WILL BE 2.
             if (o[0]==-1) { o[0]=1; o[1]=2; }
-            for (int i=0; i<n; i++) if (is_nan(x, i)) o[i] = 0;
-            push(1); push(1);
+            for (int i=0; i<n; i++) if (ctx->is_nan(x, i)) o[i] = 0;
+            push(ctx, 1); push(ctx, 1);
             return;
         } Error("Internal error: dsort received n=%d. dsorted should have dealt with this (e.g. as a reverse sorted vector) already",n);
     }
-    if (n<N_SMALL && o[0] != -1 && nalast != 0) {                                    // see comment above in iradix_r re N_SMALL=200,  and isort for o[0]
-        for (int i=0; i<n; i++) ((unsigned long long *)x)[i] = twiddle(x,i,order);   // have to twiddle here anyways, can't speed up default case like in isort
-        dinsert((unsigned long long *)x, o, n);
+    if (n<N_SMALL && o[0] != -1 && ctx->nalast != 0) {                               // see comment above in iradix_r re N_SMALL=200,  and isort for o[0]
+        for (int i=0; i<n; i++) ((unsigned long long *)x)[i] = ctx->twiddle(x,i,ctx->order,ctx->nalast); // have to twiddle here anyways, can't speed up default case like in isort
+        dinsert(ctx, (unsigned long long *)x, o, n, NULL);
     } else {
-        dradix((unsigned char *)x, (o[0] != -1) ? newo : o, n);
+        dradix(ctx, (unsigned char *)x, (o[0] != -1) ? ctx->newo : o, n);
+    }
+}
+
+static void ctx_free(struct sortContext *ctx) {
+    free(ctx->gs[0]); free(ctx->gs[1]);
+    free(ctx->newo); free(ctx->xsub);
+    free(ctx->icounts);
+    free(ctx->batchcounts);
+    free_work(ctx, 0);
+    free(ctx->csort_otmp);
+    free(ctx->cradix_counts); free(ctx->cradix_xtmp);
+    free(ctx->ustr);
+    free(ctx->hash.s); free(ctx->hash.v);
+    free(ctx->hstr); free(ctx->hrank);
+    free(ctx);
+}
+
+static void ctx_abort(struct sortContext *ctx) {
+    // on error part way through, the working memory may be in any state so it isn't pooled
+    if (ctx->tl) {
+        for (int i=0; i<ctx->ustr_n; i++) SET_TRUELENGTH(ctx->ustr[i],0);
+        savetl_end();
+    }
+    ctx_free(ctx);
+}
+
+static void ctx_put(struct sortContext *ctx) {
+    // keep the working memory for the next call, up to CTX_RETAIN items per buffer so one big sort doesn't hold onto it
+    #define TRIM(p, a) if (ctx->a > CTX_RETAIN) { free(ctx->p); ctx->p = NULL; ctx->a = 0; }
+    TRIM(gs[0], gsalloc[0]); TRIM(gs[1], gsalloc[1]);
+    TRIM(newo, newo_alloc); TRIM(xsub, xsub_alloc);
+    TRIM(batchcounts, batchcounts_alloc);
+    TRIM(csort_otmp, csort_otmp_alloc);
+    TRIM(cradix_counts, cradix_counts_alloc); TRIM(cradix_xtmp, cradix_xtmp_alloc);
+    TRIM(ustr, ustr_alloc);
+    TRIM(hstr, hstr_alloc); TRIM(hrank, hrank_alloc);
+    #undef TRIM
+    if (ctx->hash.n) {
+        if (ctx->hash.mask >= CTX_RETAIN) {
+            free(ctx->hash.s); free(ctx->hash.v);
+            ctx->hash.s = NULL; ctx->hash.v = NULL; ctx->hash.mask = 0;
+        } else memset(ctx->hash.s, 0, (ctx->hash.mask+1)*sizeof(SEXP));
+        ctx->hash.n = 0;
+    }
+    free_work(ctx, CTX_RETAIN);
+    Rboolean pooled = FALSE;
+    #pragma omp critical(forderPool)
+    {
+        if (nctxPool < CTX_POOL) { ctxPool[nctxPool++] = ctx; pooled = TRUE; }
+    }
+    if (!pooled) ctx_free(ctx);
+}
+
+// The unsigned key of row i of a numeric column in ctx's order and na.last, as iradix (integer) and dradix (double) sort it
+static inline unsigned long long okey(const struct sortContext *ctx, void *xd, Rboolean isInt, int i)
+{
+    return isInt ? (unsigned int)(icheck(ctx, ((int *)xd)[i])) - INT_MIN : ctx->twiddle(xd, i, ctx->order, ctx->nalast);
+}
+
+// A large single numeric column with no groups wanted (and not na.last=NA, which needs 0s in o) goes to fsort.c's parallel
+// MSD sort instead. Keys are the same twiddles isort/dsort use and fsort_keys is stable, so o is identical either way.
+// Integer columns only come here when their range is too wide for icount.
+static Rboolean fsortv(struct sortContext *ctx, SEXP x, int *o, int n)
+{
+    if (ctx->stackgrps || ctx->nalast == 0 || n < N_PAR) return FALSE;
+    if (TYPEOF(x) == INTSXP) {
+        setRange(ctx, INTEGER(x), n);
+        if (ctx->range <= N_RANGE) return FALSE;
+    } else if (TYPEOF(x) != REALSXP) return FALSE;
+    unsigned long long *xk = malloc(n * sizeof(unsigned long long));
+    unsigned long long *sk = malloc(n * sizeof(unsigned long long));
+    int *wo = malloc(n * sizeof(int));
+    if (xk==NULL || sk==NULL || wo==NULL) {
+        free(xk); free(sk); free(wo);
+        return FALSE;                                               // isort/dsort need less working memory; let them try
+    }
+    int nth = getDTthreads();
+    void *xd = DATAPTR(x);
+    Rboolean isInt = TYPEOF(x) == INTSXP;
+    #pragma omp parallel for num_threads(nth)
+    for (int i=0; i<n; i++) xk[i] = okey(ctx, xd, isInt, i);
+    int failed = fsort_keys(xk, sk, o, wo, n, nth, FALSE);
+    free(xk); free(sk); free(wo);
+    if (failed) Error("Unable to allocate working memory in fsort for a column of %d rows", n);
+    return TRUE;
+}
+
+// A first column made of a few long sorted runs (e.g. sorted data with more rows rbind'ed to the end, or appended daily files)
+// is merged rather than radix sorted. The runs are found with an early exit once there are more than N_RUNS, so unsorted input
+// costs a short scan only. Keys are computed once and merged a pair of runs at a time, all pairs of a round in parallel; the
+// merge takes from the left run on ties so it's stable and o is the same as isort/dsort would give. Groups are pushed from the
+// merged keys. Integer and double (including integer64) only; not na.last=NA which needs 0s in o.
+#define N_RUNS 16                                                   // beyond ~16 runs the log2(runs) merge rounds cost more than a radix sort
+static Rboolean runmerge(struct sortContext *ctx, SEXP x, int *o, int n)
+{
+    if (ctx->nalast == 0 || n < N_SMALL || (TYPEOF(x) != INTSXP && TYPEOF(x) != REALSXP)) return FALSE;
+    void *xd = DATAPTR(x);
+    Rboolean isInt = TYPEOF(x) == INTSXP;
+    int starts[N_RUNS+1], nruns = 1;
+    starts[0] = 0;
+    unsigned long long prev = okey(ctx, xd, isInt, 0), this;
+    for (int i=1; i<n; i++) {
+        this = okey(ctx, xd, isInt, i);
+        if (this < prev) {
+            if (nruns == N_RUNS) return FALSE;
+            starts[nruns++] = i;
+        }
+        prev = this;
+    }
+    if (nruns == 1) return FALSE;                                   // isorted/dsorted deal with sorted input
+    starts[nruns] = n;
+    unsigned long long *ka = malloc(n * sizeof(unsigned long long));
+    unsigned long long *kb = malloc(n * sizeof(unsigned long long));
+    int *ob = malloc(n * sizeof(int));
+    if (ka==NULL || kb==NULL || ob==NULL) {
+        free(ka); free(kb); free(ob);
+        return FALSE;                                               // isort/dsort need less working memory; let them try
+    }
+    int nth = (n < N_PAR) ? 1 : getDTthreads();
+    #pragma omp parallel for num_threads(nth)
+    for (int i=0; i<n; i++) { ka[i] = okey(ctx, xd, isInt, i); o[i] = i+1; }
+    unsigned long long *kin = ka, *kout = kb;
+    int *oin = o, *oout = ob;
+    while (nruns > 1) {
+        int npairs = (nruns+1)/2;
+        #pragma omp parallel for schedule(dynamic) num_threads(nth < npairs ? nth : npairs)
+        for (int p=0; p<npairs; p++) {
+            int i = starts[2*p], iend = starts[2*p+1], k = i;
+            int j = iend, jend = (2*p+1 < nruns) ? starts[2*p+2] : iend;   // an odd run out at the end is just copied
+            while (i<iend && j<jend) {
+                if (kin[j] < kin[i]) { kout[k] = kin[j]; oout[k++] = oin[j++]; }
+                else                 { kout[k] = kin[i]; oout[k++] = oin[i++]; }
+            }
+            memcpy(kout+k, kin+i, (iend-i)*sizeof(unsigned long long)); memcpy(oout+k, oin+i, (iend-i)*sizeof(int)); k += iend-i;
+            memcpy(kout+k, kin+j, (jend-j)*sizeof(unsigned long long)); memcpy(oout+k, oin+j, (jend-j)*sizeof(int));
+        }
+        for (int p=0; p<npairs; p++) starts[p] = starts[2*p];
+        starts[npairs] = n;
+        nruns = npairs;
+        unsigned long long *ktmp = kin; kin = kout; kout = ktmp;
+        int *otmp = oin; oin = oout; oout = otmp;
+    }
+    if (oin != o) memcpy(o, oin, n * sizeof(int));
+    if (ctx->stackgrps) {
+        int tt = 1;
+        for (int i=1; i<n; i++) {
+            if (kin[i]==kin[i-1]) tt++; else { push(ctx, tt); tt=1; }
+        }
+        push(ctx, tt);
     }
+    free(ka); free(kb); free(ob);
+    return TRUE;
 }
 
-SEXP forder(SEXP DT, SEXP by, SEXP retGrp, SEXP sortStrArg, SEXP orderArg, SEXP naArg)
+// Planning step for several key columns. When they're all integer (including logical, factor and IDate) and their ranges, each
+// with one more value for NA, fit in 64 bits between them, each row is packed into one unsigned key with the first column in the
+// most significant bits. That key is radix sorted once by dradix (which pushes the groups too) rather than column by column
+// within each group. Returns FALSE, having done nothing, when the key doesn't fit or na.last=NA (which needs 0s in o).
+static Rboolean packsort(struct sortContext *ctx, SEXP DT, SEXP by, SEXP orderArg, int *o, int n, Rboolean retGrp, Rboolean *isSorted)
+{
+    int ncol = length(by);
+    if (ncol < 2 || ctx->nalast == 0 || n < N_SMALL) return FALSE;
+    int xmin[ncol], bits[ncol], totbits = 0;
+    long long span[ncol];
+    for (int j=0; j<ncol; j++) {
+        SEXP x = VECTOR_ELT(DT, INTEGER(by)[j]-1);
+        if (TYPEOF(x) != INTSXP && TYPEOF(x) != LGLSXP) return FALSE;
+        setRange(ctx, INTEGER(x), n);
+        xmin[j] = ctx->xmin;
+        span[j] = ctx->range == NA_INTEGER ? 0 :                    // all NA
+                  ctx->range == INT_MAX ? (long long)INT_MAX - xmin[j] + 1 : ctx->range;  // overflowed: INT_MAX is an upper bound on xmax
+        bits[j] = 0;
+        while ((1LL << bits[j]) < span[j] + 1) bits[j]++;             // +1 for NA
+        if ((totbits += bits[j]) > 64) return FALSE;
+    }
+    if ((double)span[0] * span[1] <= n) return FALSE;               // groups of the first column are dense in the second, which icount
+                                                                    // then sorts within each group faster than a radix sort of the key
+    if (ctx->xsub_alloc < n) {                                      // the key is kept in xsub, so it's freed on error too
+        free(ctx->xsub);
+        ctx->xsub = malloc(n * sizeof(unsigned long long));
+        ctx->xsub_alloc = ctx->xsub ? n : 0;
+        if (ctx->xsub == NULL) return FALSE;                        // the column by column sort needs less working memory
+    }
+    unsigned long long *key = ctx->xsub;
+    int nth = (n < N_PAR) ? 1 : getDTthreads();
+    memset(key, 0, n * sizeof(unsigned long long));
+    for (int j=0; j<ncol; j++) {
+        const int *x = INTEGER(VECTOR_ELT(DT, INTEGER(by)[j]-1));
+        int order = INTEGER(orderArg)[j], nalast = ctx->nalast, thisbits = bits[j], thismin = xmin[j];
+        long long thisspan = span[j];
+        #pragma omp parallel for num_threads(nth)
+        for (int i=0; i<n; i++) {
+            unsigned long long code;
+            if (x[i] == NA_INTEGER) code = (nalast == 1) ? thisspan : 0;
+            else {
+                long long v = (long long)x[i] - thismin;                // [0, span)
+                code = (order == 1 ? v : thisspan-1-v) + (nalast == 1 ? 0 : 1);
+            }
+            key[i] = thisbits ? (key[i] << (thisbits-1) << 1) | code : key[i];   // two shifts as a shift by 64 is undefined
+        }
+    }
+    ctx->stackgrps = retGrp;
+    int i = 1;
+    while (i<n && key[i] >= key[i-1]) i++;                          // e.g. setkey on a table that's already keyed
+    if (i == n) {
+        *isSorted = TRUE;
+        for (i=0; i<n; i++) o[i] = i+1;
+        int tt = 1;
+        for (i=1; i<n; i++) if (key[i]==key[i-1]) tt++; else { push(ctx, tt); tt=1; }
+        push(ctx, tt);
+        return TRUE;
+    }
+    unsigned long long (*twiddle)(void *, int, int, int) = ctx->twiddle;
+    int order = ctx->order, nalast = ctx->nalast;
+    ctx->twiddle = &ukey; ctx->order = 1; ctx->nalast = -1;
+    dradix(ctx, (unsigned char *)key, o, n);
+    ctx->twiddle = twiddle; ctx->order = order; ctx->nalast = nalast;
+    *isSorted = FALSE;                                              // stable, so o isn't 1:n as key wasn't sorted
+    return TRUE;
+}
+
+SEXP forder(SEXP DT, SEXP by, SEXP retGrp, SEXP sortStrArg, SEXP orderArg, SEXP naArg, SEXP collateArg)
 // sortStr TRUE from setkey, FALSE from by=
 {
     int i, j, k, grp, ngrp, tmp, *osub, thisgrpn, n, col;
     Rboolean isSorted = TRUE;
     SEXP x, class;
     void *xd;
+    struct sortContext *ctx;
 #ifdef TIMING_ON
     memset(tblock, 0, NBLOCK*sizeof(clock_t));
     memset(nblock, 0, NBLOCK*sizeof(int));
@@ -1112,49 +1822,57 @@ SEXP forder(SEXP DT, SEXP by, SEXP retGrp, SEXP sortStrArg, SEXP orderArg, SEXP
     }
     if (!isLogical(retGrp) || LENGTH(retGrp)!=1 || INTEGER(retGrp)[0]==NA_LOGICAL) error("retGrp must be TRUE or FALSE");
     if (!isLogical(sortStrArg) || LENGTH(sortStrArg)!=1 || INTEGER(sortStrArg)[0]==NA_LOGICAL ) error("sortStr must be TRUE or FALSE");
+    if (!isLogical(collateArg) || LENGTH(collateArg)!=1 || LOGICAL(collateArg)[0]==NA_LOGICAL ) error("collate must be TRUE or FALSE");
     if (!isLogical(naArg) || LENGTH(naArg) != 1) error("na.last must be logical TRUE, FALSE or NA of length 1");
-    sortStr = LOGICAL(sortStrArg)[0];
-    // static global set on top...
-    nalast = (LOGICAL(naArg)[0] == NA_LOGICAL) ? 0 : (LOGICAL(naArg)[0] == TRUE) ? 1 : -1; // 1=TRUE, -1=FALSE, 0=NA
-    gsmaxalloc = n;  // upper limit for stack size (all size 1 groups). We'll detect and avoid that limit, but if just one non-1 group (say 2), that can't be avoided.
-    
     // TODO: check for 'orderArg'
     
     SEXP ans = PROTECT(allocVector(INTSXP, n)); // once for the result, needs to be length n.
+    ctx = ctx_get();                            // from now on use Error not error.
+    ctx->sortStr = LOGICAL(sortStrArg)[0];
+    ctx->collate = LOGICAL(collateArg)[0] && ctx->sortStr;         // by= (sortStr=FALSE) doesn't sort strings
+    ctx->nalast = (LOGICAL(naArg)[0] == NA_LOGICAL) ? 0 : (LOGICAL(naArg)[0] == TRUE) ? 1 : -1; // 1=TRUE, -1=FALSE, 0=NA
+    ctx->gsmaxalloc = n;  // upper limit for stack size (all size 1 groups). We'll detect and avoid that limit, but if just one non-1 group (say 2), that can't be avoided.
     int *o = INTEGER(ans);                      // TO DO: save allocation if NULL is returned (isSorted==TRUE)
     o[0] = -1;                                  // so [i|c|d]sort know they can populate o directly with no working memory needed to reorder existing order
                                                 // had to repace this from '0' to '-1' because 'nalast = 0' replace 'o[.]' with 0 values.
     xd = DATAPTR(x);
-    stackgrps = length(by)>1 || LOGICAL(retGrp)[0];
-    savetl_init();   // from now on use Error not error.
-
-    order = INTEGER(orderArg)[0];
-    switch(TYPEOF(x)) {
+    ctx->stackgrps = length(by)>1 || LOGICAL(retGrp)[0];
+    ctx->strhash = n >= N_PAR;
+    for (col=1; col<=length(by) && !ctx->strhash; col++) {
+        // only character columns use TRUELENGTH, so a sort of numeric columns leaves savetl free for other sorts running at the same time
+        if (TYPEOF(isNull(by) ? DT : VECTOR_ELT(DT, INTEGER(by)[col-1]-1)) == STRSXP) { savetl_init(); ctx->tl = TRUE; break; }
+    }
+
+    ctx->order = INTEGER(orderArg)[0];
+    int nsortcol = length(by);                  // columns left to sort one at a time
+    if (packsort(ctx, DT, by, orderArg, o, n, LOGICAL(retGrp)[0], &isSorted)) {
+        tmp = 2; nsortcol = 1;                  // 2: all the columns were sorted together as one packed key
+    } else switch(TYPEOF(x)) {
     case INTSXP : case LGLSXP :
-        tmp = isorted(xd, n); break;
+        tmp = isorted(ctx, xd, n); break;
     case REALSXP :
         class = getAttrib(x, R_ClassSymbol);
         if (isString(class) && STRING_ELT(class, 0) == char_integer64) {
-            twiddle = &i64twiddle;
-            is_nan  = &i64nan; // see explanation under `is_nan` as to why we need this
+            ctx->twiddle = &i64twiddle_na;
+            ctx->is_nan  = &i64nan; // see explanation under `twiddle` as to why we need this
         } else {
-            twiddle = &dtwiddle;
-            is_nan  = &dnan;
+            ctx->twiddle = &dtwiddle_na;
+            ctx->is_nan  = &dnan;
         }
-        tmp = dsorted(xd, n); break;
+        tmp = dsorted(ctx, xd, n); break;
     case STRSXP :
-        tmp = csorted(xd, n); break;
+        tmp = csorted(ctx, xd, n); break;
     default :
         Error("First column being ordered is type '%s', not yet supported", type2char(TYPEOF(x)));
     }
-    if (tmp) {                                  // -1 or 1. NEW: or -2 in case of nalast == 0 and all NAs
+    if (tmp) {                                  // -1 or 1. NEW: or -2 in case of nalast == 0 and all NAs. 2 for packsort, done
         if (tmp == 1) {                         // same as expected in 'order' (1 = increasing, -1 = decreasing)
             isSorted = TRUE;
             for (i=0; i<n; i++) o[i] = i+1;     // TO DO: we don't need this if returning NULL? Save it? Unlikely huge gain, though.
         } else if (tmp == -1) {                 // -1 (or -n for result of strcmp), strictly opposite to expected 'order'
             isSorted = FALSE;
             for (i=0; i<n; i++) o[i] = n-i;
-        } else if (nalast == 0 && tmp == -2) {  // happens only when nalast=NA/0. Means all NAs, replace with 0's therefore!
+        } else if (ctx->nalast == 0 && tmp == -2) {  // happens only when nalast=NA/0. Means all NAs, replace with 0's therefore!
             isSorted = FALSE;
             for (i=0; i<n; i++) o[i] = 0;
         }
@@ -1162,12 +1880,15 @@ SEXP forder(SEXP DT, SEXP by, SEXP retGrp, SEXP sortStrArg, SEXP orderArg, SEXP
         isSorted = FALSE;
         switch(TYPEOF(x)) {
         case INTSXP : case LGLSXP :
-            isort(xd, o, n); break;
+            if (!runmerge(ctx, x, o, n) && !fsortv(ctx, x, o, n)) isort(ctx, xd, o, n);
+            break;
         case REALSXP :
-            dsort(xd, o, n); break;
+            if (!runmerge(ctx, x, o, n) && !fsortv(ctx, x, o, n)) dsort(ctx, xd, o, n);
+            break;
         case STRSXP :
-            if (sortStr) { csort_pre(xd, n); alloc_csort_otmp(n); csort(xd, o, n); }
-            else cgroup(xd, o, n);
+            if (ctx->sortStr || ctx->strhash) { csort_pre(ctx, xd, n); alloc_csort_otmp(ctx, n); }
+            if (ctx->sortStr) csort(ctx, xd, o, n);
+            else cgroup(ctx, xd, o, n);
             break;
         default :
             Error("Internal error: previous default should have caught unsupported type");
@@ -1175,42 +1896,54 @@ SEXP forder(SEXP DT, SEXP by, SEXP retGrp, SEXP sortStrArg, SEXP orderArg, SEXP
     }
     TEND(0)
     
-    int maxgrpn = gsmax[flip];   // biggest group in the first column
-    void *xsub = NULL;           // local to forder
+    int maxgrpn = ctx->gsmax[ctx->flip];   // biggest group in the first column
+    void *xsub = NULL;                     // kept with the context
+    int *newo = NULL;
     int (*f)(); void (*g)();
     
-    if (length(by)>1 && gsngrp[flip]<n) {
-        xsub = (void *)malloc(maxgrpn * sizeof(double));    // double is the largest type, 8
-        if (xsub==NULL) Error("Couldn't allocate xsub in forder, requested %d * %d bytes.", maxgrpn, sizeof(double));
-        newo = (int *)malloc(maxgrpn * sizeof(int));        // global variable, used by isort, dsort, sort and cgroup
-        if (newo==NULL) Error("Couldn't allocate newo in forder, requested %d * %d bytes.", maxgrpn, sizeof(int));
+    if (nsortcol>1 && ctx->gsngrp[ctx->flip]<n) {
+        if (ctx->xsub_alloc < maxgrpn) {
+            free(ctx->xsub);  // the contents needn't be kept, so not realloc
+            ctx->xsub = (void *)malloc(maxgrpn * sizeof(double));    // double is the largest type, 8
+            ctx->xsub_alloc = ctx->xsub ? maxgrpn : 0;
+            if (ctx->xsub==NULL) Error("Couldn't allocate xsub in forder, requested %d * %d bytes.", maxgrpn, sizeof(double));
+        }
+        if (ctx->newo_alloc < maxgrpn) {
+            free(ctx->newo);
+            ctx->newo = (int *)malloc(maxgrpn * sizeof(int));        // used by isort, dsort, sort and cgroup
+            ctx->newo_alloc = ctx->newo ? maxgrpn : 0;
+            if (ctx->newo==NULL) Error("Couldn't allocate newo in forder, requested %d * %d bytes.", maxgrpn, sizeof(int));
+        }
+        xsub = ctx->xsub;
+        newo = ctx->newo;
     }
     TEND(1)  // should be negligible time to malloc even large blocks, but time it anyway to be sure
     
-    for (col=2; col<=length(by); col++) {
+    for (col=2; col<=nsortcol; col++) {
         x = VECTOR_ELT(DT,INTEGER(by)[col-1]-1);
         xd = DATAPTR(x);
-        ngrp = gsngrp[flip];
-        if (ngrp == n && nalast != 0) break;
-        flipflop();
-        stackgrps = col!=LENGTH(by) || LOGICAL(retGrp)[0];
-        order = INTEGER(orderArg)[col-1];
+        ngrp = ctx->gsngrp[ctx->flip];
+        if (ngrp == n && ctx->nalast != 0) break;
+        flipflop(ctx);
+        ctx->stackgrps = col!=LENGTH(by) || LOGICAL(retGrp)[0];
+        ctx->order = INTEGER(orderArg)[col-1];
         switch(TYPEOF(x)) {
         case INTSXP : case LGLSXP :
             f = &isorted; g = &isort; break;
         case REALSXP :
             class = getAttrib(x, R_ClassSymbol);
             if (isString(class) && STRING_ELT(class, 0) == char_integer64) {
-                twiddle = &i64twiddle;
-                is_nan  = &i64nan;
+                ctx->twiddle = &i64twiddle_na;
+                ctx->is_nan  = &i64nan;
             } else {
-                twiddle = &dtwiddle;
-                is_nan  = &dnan;
+                ctx->twiddle = &dtwiddle_na;
+                ctx->is_nan  = &dnan;
             }
             f = &dsorted; g = &dsort; break;
         case STRSXP :
             f = &csorted;
-            if (sortStr) { csort_pre(xd, n); alloc_csort_otmp(gsmax[1-flip]); g = &csort; }
+            if (ctx->sortStr || ctx->strhash) { csort_pre(ctx, xd, n); alloc_csort_otmp(ctx, ctx->gsmax[1-ctx->flip]); }
+            if (ctx->sortStr) g = &csort;
             else g = &cgroup; // no increasing/decreasing order required if sortStr = FALSE, just a dummy argument
             break;
         default:
@@ -1221,9 +1954,12 @@ SEXP forder(SEXP DT, SEXP by, SEXP retGrp, SEXP sortStrArg, SEXP orderArg, SEXP
         // sizes of int and double are checked to be 4 and 8 respectively in init.c
         i = 0;
         for (grp=0; grp<ngrp; grp++) {
-            thisgrpn = gs[1-flip][grp];
+            thisgrpn = ctx->gs[1-ctx->flip][grp];
+            if (ctx->nalast==0 && o[i]==0) {             // a group of NA removed by a previous column; there are no rows to look at
+                i += thisgrpn; push(ctx, thisgrpn); continue;
+            }
             if (thisgrpn == 1) {
-                if (nalast==0) {                    // this edge case had to be taken care of here.. (see the bottom of this file for more explanation)
+                if (ctx->nalast==0) {                    // this edge case had to be taken care of here.. (see the bottom of this file for more explanation)
                     switch(TYPEOF(x)) {
                     case INTSXP :
                         if (INTEGER(x)[o[i]-1] == NA_INTEGER) { isSorted=FALSE; o[i] = 0; } break;
@@ -1237,7 +1973,7 @@ SEXP forder(SEXP DT, SEXP by, SEXP retGrp, SEXP sortStrArg, SEXP orderArg, SEXP
                         Error("Internal error: previous default should have caught unsupported type");
                     }
                 }
-                i++; push(1); continue;
+                i++; push(ctx, 1); continue;
             }
             TBEG()
             osub = o+i;
@@ -1250,7 +1986,7 @@ SEXP forder(SEXP DT, SEXP by, SEXP retGrp, SEXP sortStrArg, SEXP orderArg, SEXP
             TEND(2)
             
             // continue;  // BASELINE short circuit timing point. Up to here is the cost of creating xsub.
-            tmp = (*f)(xsub, thisgrpn);     // [i|d|c]sorted(); very low cost, sequential
+            tmp = (*f)(ctx, xsub, thisgrpn);    // [i|d|c]sorted(); very low cost, sequential
             TEND(3)
             
             if (tmp) {
@@ -1263,7 +1999,7 @@ SEXP forder(SEXP DT, SEXP by, SEXP retGrp, SEXP sortStrArg, SEXP orderArg, SEXP
                         osub[thisgrpn-1-k] = tmp;
                     }
                     TEND(4)
-                } else if (nalast == 0 && tmp==-2) {    // all NAs, replace osub[.] with 0s.
+                } else if (ctx->nalast == 0 && tmp==-2) {   // all NAs, replace osub[.] with 0s.
                     isSorted = FALSE;
                     for (k=0; k<thisgrpn; k++) osub[k] = 0;
                 }
@@ -1271,12 +2007,12 @@ SEXP forder(SEXP DT, SEXP by, SEXP retGrp, SEXP sortStrArg, SEXP orderArg, SEXP
             }
             isSorted = FALSE;
             newo[0] = -1;                               // nalast=NA will result in newo[0] = 0. So had to change to -1.
-            (*g)(xsub, osub, thisgrpn);                 // may update osub directly, or if not will put the result in global newo
+            (*g)(ctx, xsub, osub, thisgrpn);            // may update osub directly, or if not will put the result in ctx->newo
                                                         
             TEND(5)
             
             if (newo[0] != -1) {
-                if (nalast != 0) for (j=0; j<thisgrpn; j++) ((int *)xsub)[j] = osub[ newo[j]-1 ];           // reuse xsub to reorder osub
+                if (ctx->nalast != 0) for (j=0; j<thisgrpn; j++) ((int *)xsub)[j] = osub[ newo[j]-1 ];           // reuse xsub to reorder osub
                 else for (j=0; j<thisgrpn; j++) ((int *)xsub)[j] = (newo[j] == 0) ? 0 : osub[ newo[j]-1 ];  // final nalast case to handle!
                 memcpy(osub, xsub, thisgrpn*sizeof(int));            
             }
@@ -1288,45 +2024,35 @@ SEXP forder(SEXP DT, SEXP by, SEXP retGrp, SEXP sortStrArg, SEXP orderArg, SEXP
         Rprintf("Timing block %d = %8.3f   %8d\n", i, 1.0*tblock[i]/CLOCKS_PER_SEC, nblock[i]);
         if (i==12) Rprintf("\n");
     }
-    Rprintf("Found %d groups and maxgrpn=%d\n", gsngrp[flip], gsmax[flip]);
+    Rprintf("Found %d groups and maxgrpn=%d\n", ctx->gsngrp[ctx->flip], ctx->gsmax[ctx->flip]);
 #endif
     
-    if (!sortStr && ustr_n!=0) Error("Internal error: at the end of forder sortStr==FALSE but ustr_n!=0 [%d]", ustr_n);
-    for(int i=0; i<ustr_n; i++)
-        SET_TRUELENGTH(ustr[i],0);
-    maxlen = 1;  // reset global. Minimum needed to count "" and NA
-    ustr_n = 0;
-    savetl_end();
-    free(ustr);                ustr=NULL;          ustr_alloc=0;
+    if (!ctx->sortStr && ctx->ustr_n!=0) Error("Internal error: at the end of forder sortStr==FALSE but ustr_n!=0 [%d]", ctx->ustr_n);
+    for(int i=0; i<ctx->ustr_n; i++)
+        SET_TRUELENGTH(ctx->ustr[i],0);
+    ctx->ustr_n = 0;
+    if (ctx->tl) { savetl_end(); ctx->tl = FALSE; }
     
     if (isSorted) {
         UNPROTECT(1);  // The existing o vector, which we may save in future, if in future we only create when isSorted becomes FALSE
         ans = PROTECT(allocVector(INTSXP, 0));  // Can't attach attributes to NULL
     }
     if (LOGICAL(retGrp)[0]) {
-        ngrp = gsngrp[flip];
+        ngrp = ctx->gsngrp[ctx->flip];
+        int *gs = ctx->gs[ctx->flip];
         setAttrib(ans, install("starts"), x = allocVector(INTSXP, ngrp));
         //if (isSorted || LOGICAL(sort)[0])
-            for (INTEGER(x)[0]=1, i=1; i<ngrp; i++) INTEGER(x)[i] = INTEGER(x)[i-1] + gs[flip][i-1];
+            for (INTEGER(x)[0]=1, i=1; i<ngrp; i++) INTEGER(x)[i] = INTEGER(x)[i-1] + gs[i-1];
         //else {
             // it's not sorted already and we want to keep original group order
         //    cumsum = 0;
-        //    for (i=0; i<ngrp; i++) { INTEGER(x)[i] = o[i+cumsum]; cumsum+=gs[flip][i]; }
+        //    for (i=0; i<ngrp; i++) { INTEGER(x)[i] = o[i+cumsum]; cumsum+=gs[i]; }
         //    isort(INTEGER(x), ngrp);
         //}
-        setAttrib(ans, install("maxgrpn"), ScalarInteger(gsmax[flip]));
+        setAttrib(ans, install("maxgrpn"), ScalarInteger(ctx->gsmax[ctx->flip]));
     }
     
-    gsfree();
-    free(radix_xsub);          radix_xsub=NULL;    radix_xsuballoc=0;
-    free(xsub); free(newo);    xsub=newo=NULL;
-    free(xtmp);                xtmp=NULL;          xtmp_alloc=0;
-    free(otmp);                otmp=NULL;          otmp_alloc=0;
-    free(csort_otmp);          csort_otmp=NULL;    csort_otmp_alloc=0;
-
-    free(cradix_counts);       cradix_counts=NULL; cradix_counts_alloc=0;
-    free(cradix_xtmp);         cradix_xtmp=NULL;   cradix_xtmp_alloc=0;   // TO DO: use xtmp already got
-    
+    ctx_put(ctx);  // back to the pool with its working memory for the next sort
     UNPROTECT(1);
     return( ans );
 }
@@ -1338,22 +2064,36 @@ SEXP fsorted(SEXP x)
     // Just checks if ordered and returns FALSE early if not (and don't return ordering if so, unlike forder).
     int tmp,n;
     void *xd;
+    struct sortContext *ctx;
     n = length(x);
     if (n <= 1) return(ScalarLogical(TRUE));
-    if (!isVectorAtomic(x)) Error("is.sorted (R level) and fsorted (C level) only to be used on vectors. If needed on a list/data.table, you'll need the order anyway if not sorted, so use if (length(o<-forder(...))) for efficiency in one step, or equivalent at C level");
+    if (!isVectorAtomic(x)) error("is.sorted (R level) and fsorted (C level) only to be used on vectors. If needed on a list/data.table, you'll need the order anyway if not sorted, so use if (length(o<-forder(...))) for efficiency in one step, or equivalent at C level");
+    switch(TYPEOF(x)) {
+    case INTSXP : case LGLSXP : case REALSXP : case STRSXP :
+        break;
+    default :
+        error("type '%s' is not yet supported", type2char(TYPEOF(x)));
+    }
     xd = DATAPTR(x);
-    stackgrps = FALSE;
-    order = 1;
+    ctx = ctx_get();  // csorted doesn't use TRUELENGTH so no savetl needed
+    ctx->stackgrps = FALSE;
+    ctx->order = 1;
     switch(TYPEOF(x)) {
     case INTSXP : case LGLSXP :
-        tmp = isorted(xd, n); break;
-    case REALSXP :
-        tmp = dsorted(xd, n); break;
-    case STRSXP :
-        tmp = csorted(xd, n); break;
-    default :
-        Error("type '%s' is not yet supported", type2char(TYPEOF(x)));
+        tmp = isorted(ctx, xd, n); break;
+    case REALSXP : {
+        SEXP class = getAttrib(x, R_ClassSymbol);
+        if (isString(class) && STRING_ELT(class, 0) == char_integer64) {
+            ctx->twiddle = &i64twiddle_na; ctx->is_nan = &i64nan;
+        } else {
+            ctx->twiddle = &dtwiddle_na;   ctx->is_nan = &dnan;
+        }
+        tmp = dsorted(ctx, xd, n); break;
+    }
+    default :  // STRSXP
+        tmp = csorted(ctx, xd, n); break;
     }
+    ctx_put(ctx);
     return(ScalarLogical( tmp==1 ? TRUE : FALSE ));
 }
 
@@ -0,0 +1,212 @@
+#include "data.table.h"
+#include <Rdefines.h>
+
+/* Rolling window aggregates: frollsum, frollmean, frollmin and frollmax. Each is O(n) in the length of x whatever the
+   window. Sums are kept running in long double, adding the row entering the window and taking off the one leaving it, with
+   Inf, -Inf, NA and NaN counted rather than added so that they leave the window cleanly. Min and max keep a monotonic
+   deque of the rows in the window that could still be its min (max); each row is pushed and popped at most once.
+   The windows are taken in blocks of ROLL_BLOCK (or, for wide windows, ROLL_REFRESH windows) that are independent: a
+   block's first window is added up from scratch, which also bounds the rounding a running sum can accumulate. The blocks of
+   all the columns and window sizes are shared between the threads. Where a block starts depends only on the window size,
+   so the results are the same for any number of threads. */
+#define ROLL_BLOCK 4096     // windows per block at least
+#define ROLL_REFRESH 8      // and at least this many times the window, so that starting a block costs at most 1/8 more
+#define ROLL_PAR 100000     // fewer windows than this in total stay single threaded, as in forder.c
+
+enum {RSUM, RMEAN, RMIN, RMAX};
+
+typedef struct {
+    const void *x;      // the column, INTSXP/LGLSXP or REALSXP
+    Rboolean isint;
+    int len, n;         // its length and the window
+    int shift;          // result of the window ending at row i goes to i-shift: 0 align="right", n-1 "left", n/2 "center"
+    double *ans;
+} rolltask;
+
+static int rollblock(int n) {
+    // windows per block
+    long long b = (long long)ROLL_REFRESH*n;
+    return (b < ROLL_BLOCK) ? ROLL_BLOCK : (b > INT_MAX) ? INT_MAX : (int)b;
+}
+
+static inline double xat(const rolltask *t, int i) {
+    if (t->isint) { int v = ((const int *)t->x)[i]; return (v == NA_INTEGER) ? NA_REAL : v; }
+    return ((const double *)t->x)[i];
+}
+
+static inline void rolladd(double v, int d, long double *s, int *cnt)
+// d is 1 as v enters the window, -1 as it leaves. cnt: NA, NaN, Inf, -Inf
+{
+    if (R_FINITE(v)) *s += d*v;
+    else if (ISNA(v)) cnt[0] += d;
+    else if (ISNAN(v)) cnt[1] += d;
+    else cnt[v > 0 ? 2 : 3] += d;
+}
+
+static double rollsumval(long double s, const int *cnt, int n, int fun, Rboolean narm)
+{
+    if (!narm && cnt[0]) return NA_REAL;
+    if (!narm && cnt[1]) return R_NaN;
+    if (cnt[2] && cnt[3]) return R_NaN;   // Inf-Inf
+    if (cnt[2]) return R_PosInf;
+    if (cnt[3]) return R_NegInf;
+    if (fun == RSUM) return (double)s;
+    int nok = n - cnt[0] - cnt[1];
+    return nok ? (double)(s / nok) : R_NaN;  // NaN to follow base::mean
+}
+
+static void rollsum(const rolltask *t, int from, int to, int fun, Rboolean narm)
+// windows ending at rows from..to-1, from >= n-1
+{
+    const int n = t->n;
+    long double s = 0;
+    int cnt[4] = {0,0,0,0};
+    for (int j=from-n+1; j<=from; j++) rolladd(xat(t, j), 1, &s, cnt);
+    t->ans[from - t->shift] = rollsumval(s, cnt, n, fun, narm);
+    for (int i=from+1; i<to; i++) {
+        rolladd(xat(t, i), 1, &s, cnt);
+        rolladd(xat(t, i-n), -1, &s, cnt);
+        t->ans[i - t->shift] = rollsumval(s, cnt, n, fun, narm);
+    }
+}
+
+static void rollminmax(const rolltask *t, int from, int to, int fun, Rboolean narm, int *dq)
+// As rollsum. dq has room for n rows; it holds the window's rows whose values are strictly increasing (min) or
+// decreasing (max) from its head, so the head is the window's min (max). NA and NaN aren't pushed but counted.
+{
+    const int n = t->n;
+    int head = 0, cnt = 0, nna = 0, nnan = 0;
+    for (int i=from-n+1; i<to; i++) {
+        if (i > from) {  // row i-n leaves
+            double v = xat(t, i-n);
+            if (ISNAN(v)) { if (ISNA(v)) nna--; else nnan--; }
+            else if (cnt && dq[head] == i-n) { head = (head+1 == n) ? 0 : head+1; cnt--; }
+        }
+        double v = xat(t, i);
+        if (ISNAN(v)) { if (ISNA(v)) nna++; else nnan++; }
+        else {
+            while (cnt) {
+                int b = head+cnt-1; if (b >= n) b -= n;
+                double w = xat(t, dq[b]);
+                if ((fun == RMIN) ? w < v : w > v) break;
+                cnt--;
+            }
+            int b = head+cnt; if (b >= n) b -= n;
+            dq[b] = i; cnt++;
+        }
+        if (i < from) continue;
+        t->ans[i - t->shift] = (!narm && nna) ? NA_REAL : (!narm && nnan) ? R_NaN : cnt ? xat(t, dq[head]) : NA_REAL;
+    }
+}
+
+SEXP froll(SEXP fun, SEXP obj, SEXP k, SEXP fill, SEXP align, SEXP narmArg) {
+    SEXP x, ans, this, tmp;
+    int ifun, nx, nk, i, j;
+    if (!length(obj) && !isVectorAtomic(obj)) return(obj); // NULL, list(); a 0-length column is a 0-length double as any other
+    if (isVectorAtomic(obj)) {
+        x = PROTECT(allocVector(VECSXP, 1));
+        SET_VECTOR_ELT(x, 0, obj);
+    } else x = PROTECT(obj);
+    if (!isNewList(x))
+        error("x must be a vector, list, data.frame or data.table");
+    if (!isString(fun) || length(fun) != 1)
+        error("Internal error: fun must be a character vector of length 1");
+    const char *cfun = CHAR(STRING_ELT(fun, 0));
+    if (!strcmp(cfun, "sum")) ifun = RSUM;
+    else if (!strcmp(cfun, "mean")) ifun = RMEAN;
+    else if (!strcmp(cfun, "min")) ifun = RMIN;
+    else if (!strcmp(cfun, "max")) ifun = RMAX;
+    else error("Internal error: invalid fun '%s' for froll", cfun);
+    if (!isInteger(k))
+        error("Internal error: n must be integer");
+    if (length(fill) != 1 || !(isReal(fill) || isInteger(fill) || isLogical(fill)))
+        error("fill must be a numeric or logical vector of length 1");
+    if (!isString(align) || length(align) != 1)
+        error("align must be a character vector of length 1");
+    if (!isLogical(narmArg) || LENGTH(narmArg)!=1 || LOGICAL(narmArg)[0]==NA_LOGICAL)
+        error("na.rm must be TRUE or FALSE");
+    Rboolean narm = LOGICAL(narmArg)[0];
+    const char *calign = CHAR(STRING_ELT(align, 0));
+    int ialign;  // 0 right, 1 left, 2 center
+    if (!strcmp(calign, "right")) ialign = 0;
+    else if (!strcmp(calign, "left")) ialign = 1;
+    else if (!strcmp(calign, "center")) ialign = 2;
+    else error("Internal error: invalid align for froll(), should have been caught before. Please report to datatable-help");
+
+    nx = length(x); nk = length(k);
+    if (!nk) error("n must be a non-empty vector of window sizes");
+    int maxn = 0;
+    for (j=0; j<nk; j++) {
+        if (INTEGER(k)[j] == NA_INTEGER || INTEGER(k)[j] < 1)
+            error("n must be positive integer values (>= 1)");
+        if (INTEGER(k)[j] > maxn) maxn = INTEGER(k)[j];
+    }
+    double dfill = asReal(fill);
+    for (i=0; i<nx; i++) {
+        this = VECTOR_ELT(x, i);
+        if (!(isInteger(this) || isLogical(this) || isReal(this)) || isFactor(this))
+            error("Unsupported type '%s' of column %d; froll functions need integer, logical or double columns",
+                  isFactor(this) ? "factor" : type2char(TYPEOF(this)), i+1);
+        if (inherits(this, "integer64"))
+            error("Column %d is integer64 which froll functions don't support. Please convert it with as.double() first.", i+1);
+    }
+
+    // a result for each column and window, each filled outside the windows, and the blocks of windows to do
+    ans = PROTECT(allocVector(VECSXP, nx*nk));
+    rolltask *task = (rolltask *)R_alloc(nx*nk, sizeof(rolltask));
+    size_t nblock = 0;
+    double nwin = 0;
+    for (i=0; i<nx; i++) {
+        this = VECTOR_ELT(x, i);
+        for (j=0; j<nk; j++) {
+            rolltask *t = task + i*nk+j;
+            t->len = length(this);
+            t->n = INTEGER(k)[j];
+            t->x = isReal(this) ? (const void *)REAL(this) : (const void *)INTEGER(this);
+            t->isint = !isReal(this);
+            t->shift = (ialign == 0) ? 0 : (ialign == 1) ? t->n-1 : t->n/2;
+            tmp = allocVector(REALSXP, t->len);
+            SET_VECTOR_ELT(ans, i*nk+j, tmp);
+            t->ans = REAL(tmp);
+            int nfirst = MIN(t->n-1-t->shift, t->len), nlast = MIN(t->shift, t->len);
+            for (int m=0; m<nfirst; m++) t->ans[m] = dfill;               // no full window ends here
+            for (int m=t->len-nlast; m<t->len; m++) t->ans[m] = dfill;
+            if (t->n <= t->len) {
+                int bsize = rollblock(t->n);
+                nblock += (t->len - t->n) / bsize + 1;
+                nwin += t->len - t->n + 1;
+            }
+        }
+    }
+    int *btask = (int *)R_alloc(nblock, sizeof(int)), *bfrom = (int *)R_alloc(nblock, sizeof(int));
+    size_t b = 0;
+    for (i=0; i<nx*nk; i++) {
+        rolltask *t = task + i;
+        if (t->n > t->len) continue;
+        int bsize = rollblock(t->n);
+        for (long long from=t->n-1; from<t->len; from+=bsize) { btask[b] = i; bfrom[b++] = (int)from; }
+    }
+
+    int nth = (nwin < ROLL_PAR) ? 1 : getDTthreads();
+    if ((size_t)nth > nblock) nth = (int)nblock;
+    if (nth < 1) nth = 1;
+    int *dq = NULL;
+    if (ifun == RMIN || ifun == RMAX) {
+        dq = malloc((size_t)nth * maxn * sizeof(int));
+        if (!dq) error("Unable to allocate %d * %d bytes for the deques of froll", nth, (int)(maxn*sizeof(int)));
+    }
+    #pragma omp parallel for num_threads(nth) schedule(dynamic)
+    for (size_t bb=0; bb<nblock; bb++) {
+        const rolltask *t = task + btask[bb];
+        int from = bfrom[bb];
+        int bsize = rollblock(t->n);
+        int to = (t->len - from > bsize) ? from + bsize : t->len;
+        if (dq) rollminmax(t, from, to, ifun, narm, dq + (size_t)omp_get_thread_num()*maxn);
+        else rollsum(t, from, to, ifun, narm);
+    }
+    free(dq);
+    UNPROTECT(2);
+    if (isVectorAtomic(obj) && length(ans) == 1)
+        return (VECTOR_ELT(ans, 0));
+    return(ans);
+}
@@ -2,48 +2,55 @@
 
 #define INSERT_THRESH 200  // TODO: expose via api and test
 
-static void dinsert(double *x, int n) {   // TODO: if and when twiddled, double => ull
+/* The sort works on unsigned 64bit keys rather than on the input type. Twiddling the input to keys (fsort() below for doubles,
+   integer and integer64; forder.c's dtwiddle_na/i64twiddle_na/icheck for forder) takes care of negatives, -0, NA/NaN
+   placement and decreasing order, so that what's left is a plain unsigned sort. The sort is stable, so when the 1-based
+   positions are carried along with the keys they are the order vector; that's how forder uses it for a large single numeric
+   column. The min key is passed down rather than being a static global so concurrent sorts don't interfere. */
+
+static void kinsert(unsigned long long *x, int *o, int n) {
+  // stable insertion sort of keys, carrying the positions in o along if o isn't NULL
   if (n<2) return;
   for (int i=1; i<n; i++) {
-    double xtmp = x[i];
+    unsigned long long xtmp = x[i];
     int j = i-1;
     if (xtmp<x[j]) {
+      int otmp = o ? o[i] : 0;
       x[j+1] = x[j];
+      if (o) o[j+1] = o[j];
       j--;
-      while (j>=0 && xtmp<x[j]) { x[j+1] = x[j]; j--; }
+      while (j>=0 && xtmp<x[j]) { x[j+1] = x[j]; if (o) o[j+1] = o[j]; j--; }
       x[j+1] = xtmp;
+      if (o) o[j+1] = otmp;
     }
   }
 }
 
-static union {
-  double d;
-  unsigned long long ull;
-} u;
-static unsigned long long minULL;
-
-static void dradix_r(  // single-threaded recursive worker
-  double *in,          // n doubles to be sorted
-  double *working,     // working memory to put the sorted items before copying over *in; must not overlap *in
-  R_xlen_t n,          // number of items to sort.  *in and *working must be at least n long
-  int fromBit,         // After twiddle to ordered ull, the bits [fromBit,toBit] are used to count  
-  int toBit,           //   fromBit<toBit; bit 0 is the least significant; fromBit is right shift amount too
-  R_xlen_t *counts     // already zero'd counts vector, 2^(toBit-fromBit+1) long. A stack of these is reused.
+static void kradix_r(  // single-threaded recursive worker
+  unsigned long long *in,       // n keys to be sorted
+  int *oin,                     // the positions to carry along with in, or NULL
+  unsigned long long *working,  // working memory to put the sorted items before copying over *in; must not overlap *in
+  int *oworking,                // likewise for oin. Unused when oin is NULL
+  R_xlen_t n,                   // number of items to sort.  *in and *working must be at least n long
+  unsigned long long min,       // the smallest key overall, subtracted first so the bits counted are those of the range
+  int fromBit,                  // The bits [fromBit,toBit] of key-min are used to count
+  int toBit,                    //   fromBit<toBit; bit 0 is the least significant; fromBit is right shift amount too
+  R_xlen_t *counts              // already zero'd counts vector, 2^(toBit-fromBit+1) long. A stack of these is reused.
 ) {
   unsigned long long width = 1ULL<<(toBit-fromBit+1);
   unsigned long long mask = width-1;
-  
-  const double *tmp=in;
+
+  const unsigned long long *tmp=in;
   for (R_xlen_t i=0; i<n; i++) {
-    counts[(*(unsigned long long *)tmp - minULL) >> fromBit & mask]++;
+    counts[(*tmp - min) >> fromBit & mask]++;
     tmp++;
   }
-  int last = (*(unsigned long long *)--tmp - minULL) >> fromBit & mask;
+  int last = (*--tmp - min) >> fromBit & mask;
   if (counts[last] == n) {
     // Single value for these bits here. All counted in one bucket which must be the bucket for the last item.
-    counts[last] = 0;  // clear ready for reuse. All other counts must be zero already so save time by not setting to 0. 
-    if (fromBit > 0)   // move on to next bits (if any remain) to resolve 
-      dradix_r(in, working, n, fromBit<8 ? 0 : fromBit-8, toBit-8, counts+256);
+    counts[last] = 0;  // clear ready for reuse. All other counts must be zero already so save time by not setting to 0.
+    if (fromBit > 0)   // move on to next bits (if any remain) to resolve
+      kradix_r(in, oin, working, oworking, n, min, fromBit<8 ? 0 : fromBit-8, toBit-8, counts+256);
     return;
   }
 
@@ -55,40 +62,162 @@ static void dradix_r(  // single-threaded recursive worker
       cumSum += tmp;
     }
   } // leaves cumSum==n && 0<i && i<=width
-  
+
   tmp=in;
-  for (R_xlen_t i=0; i<n; i++) {  // go forwards not backwards to give cpu pipeline better chance
-    int thisx = (*(unsigned long long *)tmp - minULL) >> fromBit & mask;
+  for (R_xlen_t i=0; i<n; i++) {  // go forwards not backwards to give cpu pipeline better chance, and to keep it stable
+    int thisx = (*tmp - min) >> fromBit & mask;
+    if (oin) oworking[ counts[thisx] ] = oin[i];
     working[ counts[thisx]++ ] = *tmp;
     tmp++;
   }
-  
-  memcpy(in, working, n*sizeof(double));
-  
+
+  memcpy(in, working, n*sizeof(unsigned long long));
+  if (oin) memcpy(oin, oworking, n*sizeof(int));
+
   if (fromBit==0) {
     // nothing left to do other than reset the counts to 0, ready for next recursion
     // the final bucket must contain n and it might be close to the start. After that must be all 0 so no need to reset.
     // Also this way, we don't need to know how big thisCounts is and therefore no possibility of getting that wrong.
     // wasteful thisCounts[i]=0 even when already 0 is better than a branch. We are highly recursive at this point
-    // so avoiding memset() is known to be worth it.
-    for (int i=0; counts[i]<n; i++) counts[i]=0;
+    // so avoiding memset() is known to be worth it. The final bucket itself must be reset too, else the next use of this
+    // level of the counts stack starts with n left in it.
+    int i=0;
+    while (counts[i]<n) counts[i++]=0;
+    counts[i]=0;
     return;
   }
-  
+
   cumSum=0;
   for (int i=0; cumSum<n; i++) {   // again, cumSum<n better than i<width as it can return early
     if (counts[i] == 0) continue;
     R_xlen_t thisN = counts[i] - cumSum;  // undo cummulate; i.e. diff
     if (thisN <= INSERT_THRESH) {
-      dinsert(in+cumSum, thisN);  // for thisN==1 this'll return instantly. Probably better than several branches here.
+      kinsert(in+cumSum, oin ? oin+cumSum : NULL, thisN);  // for thisN==1 this'll return instantly. Probably better than several branches here.
     } else {
-      dradix_r(in+cumSum, working, thisN, fromBit<=8 ? 0 : fromBit-8, toBit-8, counts+256);
-    }  
+      kradix_r(in+cumSum, oin ? oin+cumSum : NULL, working, oworking, thisN, min, fromBit<=8 ? 0 : fromBit-8, toBit-8, counts+256);
+    }
     cumSum = counts[i];
     counts[i] = 0; // reset to 0 to save wasteful memset afterwards
   }
 }
 
+/* Skew. Buckets of very different sizes (a dominant value, or a few hot ranges of keys) leave one thread sorting the largest
+   alone while the others finish early, however the buckets are scheduled. So the buckets are sorted as OpenMP tasks and any
+   bucket larger than grain (a thread's fair share) is split: its next radix pass is done in chunks, each chunk a task
+   histogramming and then scattering its part, and each resulting bucket becomes a task of its own; recursively, so that a
+   single repeated key is still sorted by all the threads. Buckets within grain are one task running kradix_r. Tasks are
+   tied (the default), so a task's counts stack tcounts[thread] is only used by that thread while it runs, and leaf tasks
+   have no scheduling points. Shared by fsort_keys below and by forder.c's iradix and dradix for their largest buckets. */
+
+struct ktaskArgs {
+  unsigned long long min;
+  R_xlen_t grain;
+  int nchunk;               // chunks a split bucket's pass is done in
+  R_xlen_t **tcounts;       // a counts stack per thread for kradix_r, each (toBit/8+1)*256 long
+};
+
+static void ktask(unsigned long long *in, int *oin, unsigned long long *working, int *oworking, R_xlen_t n,
+                  int fromBit, int toBit, const struct ktaskArgs *a)
+{
+  if (n <= INSERT_THRESH) { kinsert(in, oin, n); return; }
+  R_xlen_t *hist = NULL;
+  int nchunk = a->nchunk;
+  if (n > a->grain) {
+    if (nchunk > n/1024) nchunk = n/1024;
+    if (nchunk > 1) hist = calloc((size_t)nchunk*256, sizeof(R_xlen_t));
+  }
+  if (hist == NULL) {   // within grain; or couldn't allocate so the thread does it all itself as before
+    kradix_r(in, oin, working, oworking, n, a->min, fromBit, toBit, a->tcounts[omp_get_thread_num()]);
+    return;
+  }
+  unsigned long long mask = (1ULL<<(toBit-fromBit+1)) - 1;
+  unsigned long long min = a->min;
+  R_xlen_t chunkSize = (n-1)/nchunk + 1;
+  nchunk = (n-1)/chunkSize + 1;
+  for (int c=0; c<nchunk; c++) {
+    #pragma omp task
+    {
+      R_xlen_t *h = hist + c*256, to = MIN(n, (c+1)*chunkSize);
+      for (R_xlen_t i=c*chunkSize; i<to; i++) h[(in[i] - min) >> fromBit & mask]++;
+    }
+  }
+  #pragma omp taskwait
+  R_xlen_t start[257], cumSum = 0;
+  for (int b=0; b<256; b++) {   // chunk c's first item of bucket b goes after all of bucket b's items in the chunks before
+    start[b] = cumSum;
+    for (int c=0; c<nchunk; c++) { R_xlen_t tmp = hist[c*256+b]; hist[c*256+b] = cumSum; cumSum += tmp; }
+  }
+  start[256] = cumSum;
+  for (int b=0; b<256; b++) if (start[b+1]-start[b] == n) {
+    // all in one bucket for these bits (e.g. a dominant key); nothing to move so go straight to the next bits
+    free(hist);
+    if (fromBit > 0) ktask(in, oin, working, oworking, n, fromBit<=8 ? 0 : fromBit-8, toBit-8, a);
+    return;
+  }
+  for (int c=0; c<nchunk; c++) {
+    #pragma omp task
+    {
+      R_xlen_t *h = hist + c*256, to = MIN(n, (c+1)*chunkSize);
+      for (R_xlen_t i=c*chunkSize; i<to; i++) {
+        R_xlen_t t = h[(in[i] - min) >> fromBit & mask]++;
+        working[t] = in[i];
+        if (oin) oworking[t] = oin[i];
+      }
+    }
+  }
+  #pragma omp taskwait
+  free(hist);
+  for (int c=0; c<nchunk; c++) {
+    #pragma omp task
+    {
+      R_xlen_t from = c*chunkSize, len = MIN(n, from+chunkSize) - from;
+      memcpy(in+from, working+from, len*sizeof(unsigned long long));
+      if (oin) memcpy(oin+from, oworking+from, len*sizeof(int));
+    }
+  }
+  #pragma omp taskwait
+  if (fromBit == 0) return;   // no bits left; each bucket is one key
+  for (int b=0; b<256; b++) {
+    R_xlen_t from = start[b], len = start[b+1]-start[b];
+    if (len < 2) continue;
+    #pragma omp task
+    ktask(in+from, oin ? oin+from : NULL, working+from, oin ? oworking+from : NULL, len, fromBit<=8 ? 0 : fromBit-8, toBit-8, a);
+  }
+  #pragma omp taskwait
+}
+
+int ksort_buckets(
+  unsigned long long *x,          // keys, sorted in place within each bucket
+  int *o,                         // carried along with x, or NULL
+  unsigned long long *wx,         // working memory the same length as x (and wo as o), used at the same offsets as the buckets
+  int *wo,
+  const R_xlen_t *from,           // bucket i is x[from[i]] to x[from[i]+len[i]-1]; buckets don't overlap
+  const R_xlen_t *len,
+  int nbucket,                    // in the order to start them; largest first is best
+  unsigned long long min,         // subtracted from each key before its bits are taken, as kradix_r
+  int fromBit, int toBit,         // the bits of the first pass, [fromBit,toBit], at most 8; the rest down to bit 0 follow
+  R_xlen_t grain,                 // buckets larger than this are split between threads
+  int nth
+) {
+  // Returns 0 on success or -1 if working memory couldn't be allocated. No R API.
+  struct ktaskArgs a = { min, grain < INSERT_THRESH ? INSERT_THRESH : grain, nth*2, NULL };
+  a.tcounts = calloc(nth, sizeof(R_xlen_t *));
+  int failed = a.tcounts == NULL;
+  for (int t=0; t<nth && !failed; t++) failed = (a.tcounts[t] = calloc((toBit/8 + 1)*256, sizeof(R_xlen_t))) == NULL;
+  if (!failed) {
+    #pragma omp parallel num_threads(nth)
+    #pragma omp single
+    for (int i=0; i<nbucket; i++) {
+      R_xlen_t f = from[i];
+      #pragma omp task
+      ktask(x+f, o ? o+f : NULL, wx+f, o ? wo+f : NULL, len[i], fromBit, toBit, &a);
+    }
+  }
+  if (a.tcounts) for (int t=0; t<nth; t++) free(a.tcounts[t]);
+  free(a.tcounts);
+  return failed ? -1 : 0;
+}
+
 R_xlen_t *qsort_data;
 // would have liked to define cmp inside fsort where qsort is called but wasn't sure that's portable
 int qsort_cmp(const void *a, const void *b) {
@@ -98,39 +227,36 @@ int qsort_cmp(const void *a, const void *b) {
   R_xlen_t y = qsort_data[*(int *)b];
   // return x-y;  would like this, but this is long and the cast to int return may not preserve sign
   // We have long vectors in mind (1e10(74GB), 1e11(740GB)) where extreme skew may feasibly mean the largest count
-  // is greater than 2^32. The first split is (currently) 16 bits so should be very rare but to be safe keep 64bit counts.    
+  // is greater than 2^32. The first split is (currently) 16 bits so should be very rare but to be safe keep 64bit counts.
   return (x<y)-(x>y);   // largest first in a safe branchless way casting long to int
 }
 
-SEXP fsort(SEXP x, SEXP verboseArg) {
-  if (!isLogical(verboseArg) || LENGTH(verboseArg)!=1 || LOGICAL(verboseArg)[0]==NA_LOGICAL)
-    error("verbose must be TRUE or FALSE");
-  Rboolean verbose = LOGICAL(verboseArg)[0];
-  if (!isNumeric(x)) error("x must be a vector of type 'double' currently");
-  // TODO: not only detect if already sorted, but if it is, just return x to save the duplicate
-  
-  SEXP ansVec = PROTECT(allocVector(REALSXP, xlength(x)));
-  double *ans = REAL(ansVec);
-  // allocate early in case fails if not enough RAM
-  // TODO: document this is much cheaper than a copy followed by in-place.
-  
-  int nth = getDTthreads();
+int fsort_keys(
+  unsigned long long *xk,  // n twiddled keys. Used as working memory so its contents are lost
+  unsigned long long *sk,  // n long, receives the keys in sorted order
+  int *so,                 // n long, receives the 1-based order; or NULL when only the sorted keys are needed
+  int *wo,                 // n long working memory for so; unused when so is NULL
+  R_xlen_t n, int nth, Rboolean verbose
+) {
+  // Returns 0 on success or -1 if working memory couldn't be allocated. No R API is used so that forder can call it with its
+  // sort context held and raise the error itself.
+  if (n<1) return 0;
   int nBatch=nth*2;  // at least nth; more to reduce last-man-home; but not too large to keep counts small in cache
   if (verbose) Rprintf("nth=%d, nBatch=%d\n",nth,nBatch);
-  
-  R_xlen_t batchSize = (xlength(x)-1)/nBatch + 1;
+
+  R_xlen_t batchSize = (n-1)/nBatch + 1;
   if (batchSize < 1024) batchSize = 1024; // simple attempt to work reasonably for short vector. 1024*8 = 2 4kb pages
-  nBatch = (xlength(x)-1)/batchSize + 1;
-  R_xlen_t lastBatchSize = xlength(x) - (nBatch-1)*batchSize;
-  // could be that lastBatchSize == batchSize when i) xlength(x) is multiple of nBatch
-  // and ii) for small vectors with just one batch 
-  
-  double mins[nBatch], maxs[nBatch];
+  nBatch = (n-1)/batchSize + 1;
+  R_xlen_t lastBatchSize = n - (nBatch-1)*batchSize;
+  // could be that lastBatchSize == batchSize when i) n is multiple of nBatch
+  // and ii) for small vectors with just one batch
+
+  unsigned long long mins[nBatch], maxs[nBatch];
   #pragma omp parallel for schedule(dynamic) num_threads(nth)
   for (int batch=0; batch<nBatch; batch++) {
     R_xlen_t thisLen = (batch==nBatch-1) ? lastBatchSize : batchSize;
-    double *d = &REAL(x)[batchSize * batch];
-    double myMin=*d, myMax=*d;
+    const unsigned long long *d = xk + batchSize*batch;
+    unsigned long long myMin=*d, myMax=*d;
     d++;
     for (R_xlen_t j=1; j<thisLen; j++) {
       // TODO: test for sortedness here as well.
@@ -141,48 +267,46 @@ SEXP fsort(SEXP x, SEXP verboseArg) {
     mins[batch] = myMin;
     maxs[batch] = myMax;
   }
-  double min=mins[0], max=maxs[0];
+  unsigned long long min=mins[0], max=maxs[0];
   for (int i=1; i<nBatch; i++) {
     // TODO: if boundaries are sorted then we only need sort the unsorted batches known above
     if (mins[i]<min) min=mins[i];
     if (maxs[i]>max) max=maxs[i];
   }
-  if (verbose) Rprintf("Range = [%g,%g]\n", min, max);
-  if (min < 0.0) error("Cannot yet handle negatives.");
-  // TODO: -0ULL should allow negatives
-  //       avoid twiddle function call as expensive in recent tests (0.34 vs 2.7)
-  //       possibly twiddle once to *ans, then untwiddle at the end in a fast parallel sweep
-  u.d = max;
-  unsigned long long maxULL = u.ull;
-  u.d = min;
-  minULL = u.ull;  // set static global for use by dradix_r
-  
-  int maxBit = floor(log(maxULL-minULL) / log(2));  // 0 is the least significant bit
+  if (verbose) Rprintf("Key range = [%llu,%llu]\n", min, max);
+  if (min==max) {
+    // all keys equal; e.g. all NA. Stable, so the input order is the result
+    memcpy(sk, xk, n*sizeof(unsigned long long));
+    if (so) for (R_xlen_t i=0; i<n; i++) so[i] = i+1;
+    return 0;
+  }
+
+  int maxBit = 0;  // 0 is the least significant bit. Not floor(log2()) which rounds up near 2^64
+  while ((max-min) >> maxBit >> 1) maxBit++;
   int MSBNbits = maxBit > 15 ? 16 : maxBit+1;       // how many bits make up the MSB
   int shift = maxBit + 1 - MSBNbits;                // the right shift to leave the MSB bits remaining
   int MSBsize = 1<<MSBNbits;                        // the number of possible MSB values (16 bits => 65,536)
   if (verbose) Rprintf("maxBit=%d; MSBNbits=%d; shift=%d; MSBsize=%d\n", maxBit, MSBNbits, shift, MSBsize);
-  
+
   R_xlen_t *counts = calloc(nBatch*(size_t)MSBsize, sizeof(R_xlen_t));
-  if (counts==NULL) error("Unable to allocate working memory");
+  if (counts==NULL) return -1;
   // provided MSBsize>=9, each batch is a multiple of at least one 4k page, so no page overlap
-  // TODO: change all calloc, malloc and free to Calloc and Free to be robust to error() and catch ooms. 
-  
+
   if (verbose) Rprintf("counts is %dMB (%d pages per nBatch=%d, batchSize=%lld, lastBatchSize=%lld)\n",
                        nBatch*MSBsize*sizeof(R_xlen_t)/(1024*1024), nBatch*MSBsize*sizeof(R_xlen_t)/(4*1024*nBatch),
                        nBatch, batchSize, lastBatchSize);
-  
+
   #pragma omp parallel for num_threads(nth)
   for (int batch=0; batch<nBatch; batch++) {
     R_xlen_t thisLen = (batch==nBatch-1) ? lastBatchSize : batchSize;
-    double *tmp = &REAL(x)[batchSize * (size_t)batch];
+    const unsigned long long *tmp = xk + batchSize*(size_t)batch;
     R_xlen_t *thisCounts = counts + batch*(size_t)MSBsize;
     for (R_xlen_t j=0; j<thisLen; j++) {
-      thisCounts[(*(unsigned long long *)tmp - minULL) >> shift]++;
+      thisCounts[(*tmp - min) >> shift]++;
       tmp++;
     }
   }
-  
+
   // cumulate columnwise; parallel histogram; small so no need to parallelize
   R_xlen_t rollSum=0;
   for (int msb=0; msb<MSBsize; msb++) {
@@ -194,35 +318,40 @@ SEXP fsort(SEXP x, SEXP verboseArg) {
       j += MSBsize;  // deliberately non-contiguous here
     }
   }  // leaves msb cumSum in the last batch i.e. last row of the matrix
-  
+
   #pragma omp parallel for num_threads(nth)
   for (int batch=0; batch<nBatch; batch++) {
     R_xlen_t thisLen = (batch==nBatch-1) ? lastBatchSize : batchSize;
-    double *source = &REAL(x)[batchSize * batch];
-    R_xlen_t *thisCounts = counts + batch*MSBsize;
+    R_xlen_t from = batchSize*(size_t)batch;
+    const unsigned long long *source = xk + from;
+    R_xlen_t *thisCounts = counts + batch*(size_t)MSBsize;
     for (R_xlen_t j=0; j<thisLen; j++) {
-      ans[ thisCounts[(*(unsigned long long *)source - minULL) >> shift]++ ] = *source;
-      // This assignment to ans is not random access as it may seem, but cache efficient by
+      R_xlen_t target = thisCounts[(*source - min) >> shift]++;
+      sk[target] = *source;
+      if (so) so[target] = from+j+1;
+      // This assignment to sk is not random access as it may seem, but cache efficient by
       // design since target pages are written to contiguously. MSBsize * 4k < cache.
       // TODO: therefore 16 bit MSB seems too big for this step. Time this step and reduce 16 a lot.
       //       20MB cache / nth / 4k => MSBsize=160
       source++;
     }
   }
-  // Done with batches now. Will not use batch dimension again.
-  
+  // Done with batches now. Will not use batch dimension again. xk is free to be the working memory from here.
+
   // TODO: add a timing point up to here
-  
-  if (shift > 0) { // otherwise, no more bits left to resolve ties and we're done  
+
+  int failed = 0;
+  if (shift > 0) { // otherwise, no more bits left to resolve ties and we're done
     int toBit = shift-1;
     int fromBit = toBit>7 ? toBit-7 : 0;
 
     // sort bins by size, largest first to minimise last-man-home
     R_xlen_t *msbCounts = counts + (nBatch-1)*(size_t)MSBsize;
     // msbCounts currently contains the ending position of each MSB (the starting location of the next) even across empty
-    if (msbCounts[MSBsize-1] != xlength(x)) error("Internal error: counts[nBatch-1][MSBsize-1] != length(x)");
+    if (msbCounts[MSBsize-1] != n) { free(counts); return -1; }  // internal error; can't happen
     R_xlen_t *msbFrom = malloc(MSBsize*sizeof(R_xlen_t));
     int *order = malloc(MSBsize*sizeof(int));
+    if (msbFrom==NULL || order==NULL) { free(msbFrom); free(order); free(counts); return -1; }
     R_xlen_t cumSum = 0;
     for (int i=0; i<MSBsize; i++) {
       msbFrom[i] = cumSum;
@@ -234,69 +363,167 @@ SEXP fsort(SEXP x, SEXP verboseArg) {
     qsort(order, MSBsize, sizeof(int), qsort_cmp);  // find order of the sizes, largest first
     // Would have liked to define qsort_cmp() inside this function right here, but not sure that's fully portable.
     // TODO: time this qsort but likely insignificant.
-    
+
     if (verbose) {
-      Rprintf("Top 5 MSB counts: "); for(int i=0; i<5; i++) Rprintf("%lld ", msbCounts[order[i]]); Rprintf("\n");
+      Rprintf("Top 5 MSB counts: "); for(int i=0; i<5 && i<MSBsize; i++) Rprintf("%lld ", msbCounts[order[i]]); Rprintf("\n");
       Rprintf("Reduced MSBsize from %d to ", MSBsize);
     }
     while (MSBsize>0 && msbCounts[order[MSBsize-1]] < 2) MSBsize--;
     if (verbose) {
       Rprintf("%d by excluding 0 and 1 counts\n", MSBsize);
     }
-    
-    #pragma omp parallel num_threads(getDTthreads())
-    {
-      R_xlen_t *counts = calloc((toBit/8 + 1)*256, sizeof(R_xlen_t));
-      // each thread has its own (small) stack of counts
-      // don't use VLAs here: perhaps too big for stack yes but more that VLAs apparently fail with schedule(dynamic)
-      
-      double *working=NULL;
-      // the working memory (for the largest groups) is allocated the first time the thread is assigned to
-      // an iteration.
-     
-      #pragma omp for schedule(dynamic,1)    
-      // All we assume here is that a thread can never be assigned to an earlier iteration; i.e. threads 0:(nth-1)
-      // get iterations 0:(nth-1) possibly out of order, then first-come-first-served in order after that.
-      // If a thread deals with an msb lower than the first one it dealt with, then its *working will be too small.
-      for (int msb=0; msb<MSBsize; msb++) {
-      
-        R_xlen_t from= msbFrom[order[msb]];
-        R_xlen_t thisN = msbCounts[order[msb]];
-        
-        if (working==NULL) working = malloc(thisN * sizeof(double)); // TODO: check succeeded otherwise exit gracefully 
-        // Depends on msbCounts being sorted largest first before this parallel loop
-        // Could be significant RAM saving if the largest msb is
-        // a lot larger than the 2nd largest msb, especially as nth grows to perhaps 128 on X1.
-        // However, the initial split is so large (16bits => 65,536) that the largest MSB should be
-        // relatively small anyway (n/65,536 if uniformly distributed).
-        // For msb>=nth, that thread's *working will already be big
-        // enough because the smallest *working (for thread nth-1) is big enough for all iterations following.
-        // Progressively, less and less of the working will be needed by the thread (just the first thisN will be
-        // used) and the unused pages will simply not be cached.
-        // TODO: Calloc isn't thread-safe. But this deep malloc should be ok here as no possible error() points
-        //       before free. Just need to add the check and exit thread safely somehow.
-
-        if (thisN <= INSERT_THRESH) {
-          dinsert(ans+from, thisN);
-        } else {
-          dradix_r(ans+from, working, thisN, fromBit, toBit, counts);
-        }
-      }
-      free(counts);
-      free(working);
+
+    // one task per MSB, the largest first; any larger than a thread's share are split further, see ktask
+    R_xlen_t *msbLen = malloc(MSBsize*sizeof(R_xlen_t)), *msbStart = malloc(MSBsize*sizeof(R_xlen_t));
+    if (msbLen==NULL || msbStart==NULL) failed = 1;
+    else {
+      for (int msb=0; msb<MSBsize; msb++) { msbStart[msb] = msbFrom[order[msb]]; msbLen[msb] = msbCounts[order[msb]]; }
+      failed = ksort_buckets(sk, so, xk, wo, msbStart, msbLen, MSBsize, min, fromBit, toBit, nth>1 ? (n-1)/nth+1 : n, nth) != 0;
     }
+    free(msbLen); free(msbStart);
     free(msbFrom);
     free(order);
   }
-  
+
   free(counts);
-  
+  return failed ? -1 : 0;
+}
+
+// Keys for fsort(). Non-NA keys of each type are [1,2^64-1) for double and integer64, [1,2^32) for integer. Decreasing order
+// reflects them within that range and NA (then NaN for double) go at the very start or the very end.
+#define NA_KEY_LO(nan)   ((nan) ? 1ULL : 0ULL)
+#define NA_KEY_HI(nan,b) ((b) - ((nan) ? 1ULL : 0ULL))
+
+static inline unsigned long long dkey(double x, Rboolean decreasing, int nalast) {
+  union {double d; unsigned long long ull;} u;
+  if (ISNAN(x)) {
+    Rboolean nan = !ISNA(x);
+    return nalast==1 ? NA_KEY_HI(nan, 0xffffffffffffffff) : NA_KEY_LO(nan);
+  }
+  u.d = x==0 ? 0.0 : x;  // -0 to 0
+  u.ull ^= (u.ull & 0x8000000000000000) ? 0xffffffffffffffff : 0x8000000000000000;
+  // -Inf is now 0x000fffffffffffff and +Inf 0xfff0000000000000 so reflecting with ~ for decreasing stays within
+  // them, clear of the NA/NaN keys at either end
+  return decreasing ? ~u.ull : u.ull;
+}
+
+static inline double dunkey(unsigned long long k, Rboolean decreasing) {
+  union {double d; unsigned long long ull;} u;
+  if (k < 0x000fffffffffffff || k > 0xfff0000000000000) return (k==0 || k==0xffffffffffffffff) ? NA_REAL : R_NaN;
+  if (decreasing) k = ~k;
+  u.ull = k ^ ((k & 0x8000000000000000) ? 0x8000000000000000 : 0xffffffffffffffff);
+  return u.d;
+}
+
+static inline unsigned long long i64key(long long x, Rboolean decreasing, int nalast) {
+  if (x==LLONG_MIN) return nalast==1 ? 0xffffffffffffffff : 0;      // NA_integer64_
+  unsigned long long k = (unsigned long long)x ^ 0x8000000000000000;  // [1,2^64)
+  if (decreasing) k = -k;                                             // 2^64-k, still [1,2^64)
+  return nalast==1 ? k-1 : k;                                         // make room for NA at the end
+}
+
+static inline long long i64unkey(unsigned long long k, Rboolean decreasing, int nalast) {
+  if (k == (nalast==1 ? 0xffffffffffffffff : 0)) return LLONG_MIN;
+  if (nalast==1) k++;
+  if (decreasing) k = -k;
+  return (long long)(k ^ 0x8000000000000000);
+}
+
+static inline unsigned long long ikey(int x, Rboolean decreasing, int nalast) {
+  if (x==NA_INTEGER) return nalast==1 ? 0x100000000 : 0;
+  unsigned long long k = (unsigned int)x ^ 0x80000000;                // [1,2^32)
+  return decreasing ? 0x100000000-k : k;
+}
+
+static inline int iunkey(unsigned long long k, Rboolean decreasing) {
+  if (k==0 || k==0x100000000) return NA_INTEGER;
+  if (decreasing) k = 0x100000000-k;
+  return (int)(unsigned int)(k ^ 0x80000000);
+}
+
+SEXP fsort(SEXP x, SEXP decreasingArg, SEXP naArg, SEXP retOrderArg, SEXP verboseArg) {
+  if (!isLogical(decreasingArg) || LENGTH(decreasingArg)!=1 || LOGICAL(decreasingArg)[0]==NA_LOGICAL)
+    error("decreasing must be TRUE or FALSE");
+  if (!isLogical(naArg) || LENGTH(naArg)!=1)
+    error("na.last must be logical TRUE, FALSE or NA of length 1");
+  if (!isLogical(retOrderArg) || LENGTH(retOrderArg)!=1 || LOGICAL(retOrderArg)[0]==NA_LOGICAL)
+    error("retOrder must be TRUE or FALSE");
+  if (!isLogical(verboseArg) || LENGTH(verboseArg)!=1 || LOGICAL(verboseArg)[0]==NA_LOGICAL)
+    error("verbose must be TRUE or FALSE");
+  Rboolean verbose = LOGICAL(verboseArg)[0], decreasing = LOGICAL(decreasingArg)[0], retOrder = LOGICAL(retOrderArg)[0];
+  int nalast = (LOGICAL(naArg)[0] == NA_LOGICAL) ? 0 : (LOGICAL(naArg)[0] == TRUE) ? 1 : -1; // 1=TRUE, -1=FALSE, 0=NA (removed)
+  Rboolean isInt64 = FALSE;
+  switch(TYPEOF(x)) {
+  case REALSXP : {
+    SEXP class = getAttrib(x, R_ClassSymbol);
+    isInt64 = isString(class) && STRING_ELT(class, 0) == char_integer64;
+  } break;
+  case INTSXP : break;
+  default :
+    error("x must be a vector of type 'double', 'integer' or 'integer64'");
+  }
+  R_xlen_t n = xlength(x);
+  if (retOrder && n > INT_MAX) error("retOrder=TRUE isn't yet supported for long vectors");
+  int nth = getDTthreads();
+  // TODO: not only detect if already sorted, but if it is, just return x to save the duplicate
+
+  // allocate early in case fails if not enough RAM. The sorted keys of a double go straight into the result which is then
+  // untwiddled in place; that's much cheaper than a copy followed by in-place.
+  SEXP ansVec = PROTECT(allocVector(retOrder ? INTSXP : TYPEOF(x), n));
+  Rboolean inPlace = !retOrder && TYPEOF(x)==REALSXP;
+  size_t nalloc = n ? n : 1;  // so malloc doesn't return NULL for 0 length
+  unsigned long long *xk = malloc(nalloc*sizeof(unsigned long long));
+  unsigned long long *sk = inPlace ? (unsigned long long *)REAL(ansVec) : malloc(nalloc*sizeof(unsigned long long));
+  int *wo = retOrder ? malloc(nalloc*sizeof(int)) : NULL;
+  if (xk==NULL || (sk==NULL && n) || (retOrder && wo==NULL)) {
+    free(xk); if (!inPlace) free(sk); free(wo);
+    error("Unable to allocate working memory");
+  }
+
+  // twiddle to keys. With na.last=NA the NA go first and are dropped from the result afterwards
+  int keyNA = nalast==0 ? -1 : nalast;
+  R_xlen_t nna = 0;
+  const double *xd = TYPEOF(x)==REALSXP ? REAL(x) : NULL;
+  const int *xi = TYPEOF(x)==INTSXP ? INTEGER(x) : NULL;
+  #pragma omp parallel for num_threads(nth) reduction(+:nna)
+  for (R_xlen_t i=0; i<n; i++) {
+    if (xi) { nna += xi[i]==NA_INTEGER; xk[i] = ikey(xi[i], decreasing, keyNA); }
+    else if (isInt64) { long long v = ((const long long *)xd)[i]; nna += v==LLONG_MIN; xk[i] = i64key(v, decreasing, keyNA); }
+    else { nna += ISNAN(xd[i]); xk[i] = dkey(xd[i], decreasing, keyNA); }
+  }
+
+  int failed = fsort_keys(xk, sk, retOrder ? INTEGER(ansVec) : NULL, wo, n, nth, verbose);
+  free(xk);
+  free(wo);
+  if (failed) { if (!inPlace) free(sk); error("Unable to allocate working memory"); }
+
+  if (!retOrder) {
+    // untwiddle back to values. In place for double: each thread reads and writes the same element.
+    double *ad = TYPEOF(ansVec)==REALSXP ? REAL(ansVec) : NULL;
+    int *ai = TYPEOF(ansVec)==INTSXP ? INTEGER(ansVec) : NULL;
+    #pragma omp parallel for num_threads(nth)
+    for (R_xlen_t i=0; i<n; i++) {
+      if (ai) ai[i] = iunkey(sk[i], decreasing);
+      else if (isInt64) ((long long *)ad)[i] = i64unkey(sk[i], decreasing, keyNA);
+      else ad[i] = dunkey(sk[i], decreasing);
+    }
+    if (!inPlace) free(sk);
+  } else free(sk);
+
+  if (nalast==0 && nna) {
+    // NA were sorted first; drop them
+    SEXP tmp = PROTECT(allocVector(TYPEOF(ansVec), n-nna));
+    size_t size = TYPEOF(ansVec)==INTSXP ? sizeof(int) : sizeof(double);
+    memcpy((char *)DATAPTR(tmp), (char *)DATAPTR(ansVec) + nna*size, (n-nna)*size);
+    UNPROTECT(2);
+    ansVec = PROTECT(tmp);
+  }
+  if (!retOrder && OBJECT(x)) copyMostAttrib(x, ansVec);  // class of integer64, Date, POSIXct (and its tzone), difftime (units)
+
   // TODO: parallel sweep to check sorted using <= on original input. Feasible that twiddling messed up.
   //       After a few years of heavy use remove this check for speed, and move into unit tests.
   //       It's a perfectly contiguous and cache efficient parallel scan so should be relatively negligible.
-  
+
   UNPROTECT(1);
   return(ansVec);
 }
-
-
@@ -4,6 +4,7 @@
 #include <unistd.h>  // for access()
 #include <fcntl.h>
 #include <time.h>
+#include <stdint.h>
 #ifdef WIN32
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -24,7 +25,7 @@ static char sep;                       // comma in .csv files
 static char sep2;                      // ; in list column vectors
 static char dec;                       // the '.' in the number 3.1416. In Europe often: 3,1416
 static Rboolean verbose=FALSE;         // be chatty?
-static Rboolean quote=FALSE;           // whether to surround fields with double quote ". NA means 'auto' (default)
+static int quote=FALSE;                // whether to surround fields with double quote ". NA means 'auto' (default)
 static Rboolean qmethod_escape=TRUE;   // when quoting fields, how to manage double quote in the field contents
 static Rboolean logicalAsInt=FALSE;    // logical as 0/1 or "TRUE"/"FALSE"
 static Rboolean squash=FALSE;          // 0=ISO(yyyy-mm-dd) 1=squash(yyyymmdd)
@@ -67,7 +68,7 @@ static inline void writeChars(const char *x, char **thisCh)
   *thisCh = ch;
 }
 
-static inline void writeLogical(Rboolean x, char **thisCh)
+static inline void writeLogical(int x, char **thisCh)
 {
   char *ch = *thisCh;
   if (x == NA_LOGICAL) {
@@ -249,6 +250,26 @@ static inline void writeNumeric(double x, char **thisCh)
   *thisCh = ch;
 }
 
+static inline void writeQuoted(const char *tt, char **thisCh)
+{
+  char *ch = *thisCh;
+  *ch++ = '"';
+  if (qmethod_escape) {
+    while (*tt!='\0') {
+      if (*tt=='"' || *tt=='\\') *ch++ = '\\';
+      *ch++ = *tt++;
+    }
+  } else {
+    // qmethod='double'
+    while (*tt!='\0') {
+      if (*tt=='"') *ch++ = '"';
+      *ch++ = *tt++;
+    }
+  }
+  *ch++ = '"';
+  *thisCh = ch;
+}
+
 static inline void writeString(SEXP x, char **thisCh)
 {
   char *ch = *thisCh;
@@ -256,7 +277,7 @@ static inline void writeString(SEXP x, char **thisCh)
     // NA is not quoted by write.csv even when quote=TRUE to distinguish from "NA"
     writeChars(na, &ch);
   } else {
-    Rboolean q = quote;
+    int q = quote;
     if (q==NA_LOGICAL) { // quote="auto"
       const char *tt = CHAR(x);
       while (*tt!='\0' && *tt!=sep && *tt!=sep2 && *tt!='\n' && *tt!='"') *ch++ = *tt++;
@@ -273,26 +294,86 @@ static inline void writeString(SEXP x, char **thisCh)
     if (q==FALSE) {
       writeChars(CHAR(x), &ch);
     } else {
-      *ch++ = '"';
-      const char *tt = CHAR(x);
-      if (qmethod_escape) {
-        while (*tt!='\0') {
-          if (*tt=='"' || *tt=='\\') *ch++ = '\\';
-          *ch++ = *tt++;
-        }
-      } else {
-        // qmethod='double'
-        while (*tt!='\0') {
-          if (*tt=='"') *ch++ = '"';
-          *ch++ = *tt++;
-        }
+      writeQuoted(CHAR(x), &ch);
+    }
+  }
+  *thisCh = ch;
+}
+
+// Character columns with few distinct values (status codes, symbols, etc) repeat the same CHARSXP
+// many times. Rather than writeString() scanning each one every time it's written, each thread keeps
+// a small direct mapped cache keyed by CHARSXP pointer of whether the string needs quoting and/or
+// escaping. Most strings need neither and are then memcpy'd since LENGTH() is known.
+#define STRCACHE_SIZE 1024   // power of 2
+#define SC_QUOTE  1          // contains sep, sep2, \n or " so quote="auto" quotes it
+#define SC_ESCAPE 2          // contains " (or \\ when qmethod="escape") so can't be memcpy'd when quoted
+struct strCacheEntry {
+  SEXP s;
+  int flags;
+};
+
+static inline void writeStringCached(SEXP x, struct strCacheEntry *cache, char **thisCh)
+{
+  char *ch = *thisCh;
+  if (x == NA_STRING) {
+    writeChars(na, &ch);
+  } else if (quote==FALSE) {
+    memcpy(ch, CHAR(x), LENGTH(x));
+    ch += LENGTH(x);
+  } else {
+    struct strCacheEntry *e = cache + ((((uintptr_t)x)>>4 ^ ((uintptr_t)x)>>14) & (STRCACHE_SIZE-1));
+    if (e->s != x) {
+      int flags = 0;
+      for (const char *tt=CHAR(x); *tt!='\0'; tt++) {
+        if (*tt==sep || *tt==sep2 || *tt=='\n') flags |= SC_QUOTE;
+        else if (*tt=='"') flags |= SC_QUOTE | SC_ESCAPE;
+        else if (*tt=='\\' && qmethod_escape) flags |= SC_ESCAPE;
       }
+      e->s = x;
+      e->flags = flags;
+    }
+    if (quote==NA_LOGICAL && !(e->flags & SC_QUOTE)) {
+      memcpy(ch, CHAR(x), LENGTH(x));
+      ch += LENGTH(x);
+    } else if (!(e->flags & SC_ESCAPE)) {
       *ch++ = '"';
+      memcpy(ch, CHAR(x), LENGTH(x));
+      ch += LENGTH(x);
+      *ch++ = '"';
+    } else {
+      writeQuoted(CHAR(x), &ch);
     }
   }
   *thisCh = ch;
 }
 
+// Factor levels are written as writeString() would write them once per column up front, so the
+// batch loop just memcpy's the level's bytes.
+struct renderedLevels {
+  char *buf;  // the levels back to back
+  int *off;   // level k (1-based) is buf[off[k-1]] up to buf[off[k]]
+};
+static struct renderedLevels **factorLevels;  // per column; NULL unless a factor
+
+static struct renderedLevels *renderLevels(SEXP levels)
+{
+  // single threaded before the parallel region (R_alloc)
+  int n = LENGTH(levels);
+  size_t size = 0;
+  for (int k=0; k<n; k++) size += 2*LENGTH(STRING_ELT(levels,k)) + 2/*""*/ + strlen(na);  // worst case all escaped
+  struct renderedLevels *r = (struct renderedLevels *)R_alloc(1, sizeof(struct renderedLevels));
+  r->buf = (char *)R_alloc(size+1, 1);
+  r->off = (int *)R_alloc(n+1, sizeof(int));
+  if (size > INT_MAX) error("Factor levels occupy more than 2GB when written");
+  char *ch = r->buf;
+  r->off[0] = 0;
+  for (int k=0; k<n; k++) {
+    writeString(STRING_ELT(levels,k), &ch);
+    r->off[k+1] = (int)(ch - r->buf);
+  }
+  return r;
+}
+
 // DATE/TIME
 static inline void writeITime(int x, char **thisCh)
 {
@@ -427,8 +508,322 @@ static inline void writePOSIXct(double x, char **thisCh)
 }
 
 
+// dateTimeAs="write.csv" writes POSIXct in local time (or the column's "tzone") as format.POSIXct does,
+// but in C in the batch loop rather than creating a character column by calling format.POSIXct from C.
+// Each column's time zone is read once from the system zoneinfo (TZif format, RFC 8536) into a table of
+// UTC offset transitions. Past the last transition in the file, the POSIX TZ rule in the file's footer
+// (e.g. "EST5EDT,M3.2.0,M11.1.0") is expanded into further transitions up to the column's maximum year.
+// If the zone can't be found or read, writefile falls back to format.POSIXct for that column.
+
+struct tzTable {
+  char name[256];  // as passed in; e.g. "America/New_York" or "" for local time
+  int n;           // number of transitions
+  double *at;      // UTC seconds since epoch from which off[i] applies, ascending
+  int *off;        // UTC offset in seconds, east positive
+  int off0;        // UTC offset before at[0]
+};
+
+struct tzCol {
+  struct tzTable *tz;
+  Rboolean dateOnly;  // all times are midnight so just the date is written, as format.POSIXct
+  int digits;         // digits of fractional seconds; getOption("digits.secs") reduced as format.POSIXct
+};
+
+static struct tzCol **tzCols;  // per column; NULL unless POSIXct and dateTimeAs=="write.csv"
+
+static long long daysFromCivil(long long y, int m, int d)
+{
+  // Howard Hinnant's days_from_civil; see writeDate() below for the inverse
+  y -= m<=2;
+  long long era = (y>=0 ? y : y-399) / 400;
+  long long yoe = y - era*400;
+  long long doy = (153*(m + (m>2 ? -3 : 9)) + 2)/5 + d-1;
+  long long doe = yoe*365 + yoe/4 - yoe/100 + doy;
+  return era*146097 + doe - 719468;
+}
+
+static int tzHMS(const char **p, int *secs)
+{
+  // [+-]hh[:mm[:ss]] as in POSIX TZ offsets and rule times. Returns 0 if no digits.
+  const char *ch = *p;
+  int sign = 1;
+  if (*ch=='+' || *ch=='-') sign = (*ch++=='-') ? -1 : 1;
+  if (*ch<'0' || *ch>'9') return 0;
+  int part[3] = {0,0,0};
+  for (int k=0; k<3; k++) {
+    while (*ch>='0' && *ch<='9') part[k] = part[k]*10 + (*ch++ - '0');
+    if (k<2 && *ch==':' && ch[1]>='0' && ch[1]<='9') ch++; else break;
+  }
+  *secs = sign*(part[0]*3600 + part[1]*60 + part[2]);
+  *p = ch;
+  return 1;
+}
+
+static int tzName(const char **p)
+{
+  const char *ch = *p;
+  if (*ch=='<') { while (*ch && *ch!='>') ch++; if (*ch!='>') return 0; ch++; }
+  else while ((*ch>='A' && *ch<='Z') || (*ch>='a' && *ch<='z')) ch++;
+  if (ch-*p < 3) return 0;
+  *p = ch;
+  return 1;
+}
+
+struct tzRule {
+  int stdoff, dstoff;   // UTC offsets, east positive (the opposite sign to POSIX TZ strings)
+  Rboolean dst;         // FALSE when no daylight saving; i.e. just stdoff
+  char type[2];         // 'M' (Mm.w.d), 'J' (Jn, 1-based ignoring Feb 29) or 'D' (n, 0-based) for start and end
+  int m[2], w[2], d[2];
+  int time[2];          // local seconds after midnight; default 02:00:00
+};
+
+static int tzParseRule(const char *p, struct tzRule *r)
+{
+  int secs;
+  if (!tzName(&p) || !tzHMS(&p, &secs)) return 0;
+  r->stdoff = -secs;
+  r->dst = FALSE;
+  if (*p=='\0' || *p=='\n') return 1;
+  if (!tzName(&p)) return 0;
+  r->dst = TRUE;
+  r->dstoff = tzHMS(&p, &secs) ? -secs : r->stdoff+3600;
+  if (*p!=',') return 0;  // POSIX allows an implementation defined default rule; treat as unknown and fall back
+  for (int k=0; k<2; k++) {
+    if (*p++!=',') return 0;
+    r->m[k] = r->w[k] = r->d[k] = 0;
+    if (*p=='M') {
+      r->type[k] = 'M';
+      p++;
+      while (*p>='0' && *p<='9') r->m[k] = r->m[k]*10 + (*p++ - '0');
+      if (*p++!='.') return 0;
+      while (*p>='0' && *p<='9') r->w[k] = r->w[k]*10 + (*p++ - '0');
+      if (*p++!='.') return 0;
+      while (*p>='0' && *p<='9') r->d[k] = r->d[k]*10 + (*p++ - '0');
+      if (r->m[k]<1 || r->m[k]>12 || r->w[k]<1 || r->w[k]>5 || r->d[k]>6) return 0;
+    } else {
+      r->type[k] = 'D';
+      if (*p=='J') { r->type[k] = 'J'; p++; }
+      if (*p<'0' || *p>'9') return 0;
+      while (*p>='0' && *p<='9') r->d[k] = r->d[k]*10 + (*p++ - '0');
+    }
+    r->time[k] = 7200;
+    if (*p=='/' && (p++, !tzHMS(&p, &r->time[k]))) return 0;
+  }
+  return 1;
+}
+
+static double tzRuleTransition(const struct tzRule *r, int k, long long y)
+{
+  // UTC time of the start (k==0) or end (k==1) of daylight saving in year y
+  long long day;
+  Rboolean leap = (y%4==0 && y%100!=0) || y%400==0;
+  if (r->type[k]=='M') {
+    long long first = daysFromCivil(y, r->m[k], 1);
+    long long next = r->m[k]==12 ? daysFromCivil(y+1, 1, 1) : daysFromCivil(y, r->m[k]+1, 1);
+    int wday1 = (int)(((first+4)%7+7)%7);  // 1970-01-01 was a Thursday (4)
+    day = first + (r->d[k]-wday1+7)%7 + (r->w[k]-1)*7;
+    while (day>=next) day -= 7;  // w==5 means the last such weekday in the month
+  } else if (r->type[k]=='J') {
+    day = daysFromCivil(y, 1, 1) + r->d[k]-1 + (leap && r->d[k]>=60);
+  } else {
+    day = daysFromCivil(y, 1, 1) + r->d[k];
+  }
+  return (double)(day*86400 + r->time[k] - (k==0 ? r->stdoff : r->dstoff));
+}
+
+static uint32_t tzInt32(const unsigned char *p) { return (uint32_t)p[0]<<24 | (uint32_t)p[1]<<16 | (uint32_t)p[2]<<8 | p[3]; }
+
+static struct tzTable *tzLoad(const char *name, const char *tzdir, double minx, double maxx)
+{
+  // Returns NULL if the zone isn't available so that the caller can fall back to format.POSIXct.
+  // Allocates with R_alloc so single threaded before the parallel region only.
+  struct tzTable *tz = (struct tzTable *)R_alloc(1, sizeof(struct tzTable));
+  if (strlen(name) >= sizeof(tz->name)) return NULL;
+  strcpy(tz->name, name);
+  const char *z = name;
+  if (*z=='\0') { z = getenv("TZ"); if (z==NULL) z = ""; }  // tzone "" means local time as R does
+  if (*z==':') z++;
+  char path[4096];
+  if (*z=='\0') snprintf(path, sizeof(path), "/etc/localtime");
+  else if (*z=='/') snprintf(path, sizeof(path), "%s", z);
+  else if (strstr(z, "..")) return NULL;
+  else snprintf(path, sizeof(path), "%s/%s", tzdir, z);
+  
+  FILE *fp = fopen(path, "rb");
+  if (fp==NULL) {
+    if (strcmp(z,"UTC")==0 || strcmp(z,"GMT")==0 || strcmp(z,"Etc/UTC")==0 || strcmp(z,"Etc/GMT")==0) {
+      tz->n = 0; tz->off0 = 0;
+      return tz;
+    }
+    return NULL;
+  }
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  if (size<44 || size>4*1024*1024) { fclose(fp); return NULL; }
+  unsigned char *buf = (unsigned char *)R_alloc(size+1, 1);
+  if (fread(buf, 1, size, fp) != (size_t)size) { fclose(fp); return NULL; }
+  fclose(fp);
+  buf[size] = '\0';
+  if (memcmp(buf, "TZif", 4)) return NULL;
+  
+  // The version 1 block has 32bit times. Version 2+ files follow it with a 64bit block and a footer.
+  int version = buf[4] ? buf[4]-'0' : 1;
+  const unsigned char *h = buf, *end = buf+size;
+  int timeSize = 4;
+  for (int pass=0; ; pass++) {
+    uint32_t isutcnt=tzInt32(h+20), isstdcnt=tzInt32(h+24), leapcnt=tzInt32(h+28), timecnt=tzInt32(h+32), typecnt=tzInt32(h+36), charcnt=tzInt32(h+40);
+    size_t blockSize = timecnt*timeSize + timecnt + typecnt*6 + charcnt + leapcnt*(timeSize+4) + isstdcnt + isutcnt;
+    if (typecnt==0 || h+44+blockSize > end) return NULL;
+    if (pass==0 && version>=2) {
+      h += 44+blockSize;  // skip to the 64bit header
+      if (h+44 > end || memcmp(h, "TZif", 4)) return NULL;
+      timeSize = 8;
+      continue;
+    }
+    const unsigned char *times = h+44, *idx = times + timecnt*timeSize, *types = idx + timecnt;
+    tz->n = timecnt;
+    tz->at = (double *)R_alloc(timecnt+1, sizeof(double));
+    tz->off = (int *)R_alloc(timecnt+1, sizeof(int));
+    for (uint32_t i=0; i<timecnt; i++) {
+      const unsigned char *t = times + i*timeSize;
+      long long v = timeSize==8 ? (long long)((uint64_t)tzInt32(t)<<32 | tzInt32(t+4)) : (long long)(int32_t)tzInt32(t);
+      if (idx[i]>=typecnt) return NULL;
+      tz->at[i] = (double)v;
+      tz->off[i] = (int32_t)tzInt32(types + idx[i]*6);
+    }
+    tz->off0 = (int32_t)tzInt32(types);  // RFC 8536 3.2: time type 0 applies before the first transition
+    if (version<2) return tz;
+    
+    // Footer: "\n<POSIX TZ string>\n" for times after the last transition.
+    const unsigned char *footer = h+44+blockSize;
+    if (footer>=end || *footer!='\n') return tz;
+    struct tzRule r;
+    if (!tzParseRule((const char *)footer+1, &r)) {
+      // an empty footer means no rule; otherwise we don't understand it so let format.POSIXct handle the zone
+      return footer[1]=='\n' ? tz : NULL;
+    }
+    if (!r.dst) {
+      if (timecnt==0) tz->off0 = r.stdoff;
+      return tz;
+    }
+    // Expand the rule into transitions from the year of the last transition (or the data's min) to the data's max
+    double from = timecnt ? tz->at[timecnt-1] : minx;
+    if (!R_FINITE(from) || !R_FINITE(maxx) || maxx<=from) return tz;
+    long long y0 = 1970 + (long long)floor(from/31556952.0) - 1, y1 = 1970 + (long long)floor(maxx/31556952.0) + 1;
+    if (y0<-1) y0=-1;
+    if (y1>10000) y1=10000;  // writeDate() is limited to [0000-03-01, 9999-12-31]
+    if (y1<y0) return tz;
+    int max = tz->n + 2*(int)(y1-y0+1);
+    double *at = (double *)R_alloc(max, sizeof(double));
+    int *off = (int *)R_alloc(max, sizeof(int));
+    memcpy(at, tz->at, tz->n*sizeof(double));
+    memcpy(off, tz->off, tz->n*sizeof(int));
+    int n = tz->n;
+    for (long long y=y0; y<=y1; y++) {
+      double s = tzRuleTransition(&r, 0, y), e = tzRuleTransition(&r, 1, y);
+      double t1 = s<e ? s : e, t2 = s<e ? e : s;    // southern hemisphere daylight saving ends earlier in the year than it starts
+      int o1 = s<e ? r.dstoff : r.stdoff, o2 = s<e ? r.stdoff : r.dstoff;
+      if (n==0 || t1>at[n-1]) { at[n]=t1; off[n++]=o1; }
+      if (n==0 || t2>at[n-1]) { at[n]=t2; off[n++]=o2; }
+    }
+    if (tz->n==0 && n) tz->off0 = off[0]==r.stdoff ? r.dstoff : r.stdoff;
+    tz->at = at;
+    tz->off = off;
+    tz->n = n;
+    return tz;
+  }
+}
+
+static inline int tzOffset(const struct tzTable *tz, double t)
+{
+  // binary search for the last transition at or before t
+  if (tz->n==0 || t<tz->at[0]) return tz->off0;
+  int lo=0, hi=tz->n;  // at[lo]<=t<at[hi]
+  while (hi-lo>1) {
+    int mid = lo + (hi-lo)/2;
+    if (tz->at[mid]<=t) lo=mid; else hi=mid;
+  }
+  return tz->off[lo];
+}
+
+static inline void writePOSIXctLocal(double x, const struct tzCol *tc, char **thisCh)
+{
+  // "yyyy-mm-dd hh:mm:ss[.ffffff]" in the column's time zone, or "yyyy-mm-dd" when all are midnight
+  char *ch = *thisCh;
+  if (!R_FINITE(x)) { writeChars(na, &ch); *thisCh = ch; return; }
+  double xf = floor(x);
+  double local = xf + tzOffset(tc->tz, xf);
+  double d = floor(local/86400);
+  if (quote==TRUE) *ch++ = '"';  // as when this column was coerced to character by format.POSIXct
+  writeDate(d<INT_MIN+1 || d>INT_MAX ? NA_INTEGER : (int)d, &ch);
+  if (!tc->dateOnly) {
+    *ch++ = ' ';
+    int t = (int)(local - d*86400);
+    writeITime(t, &ch);
+    if (tc->digits) {
+      // fractional seconds truncated to digits as format.POSIXct does; e.g. "05.123", and 59.999 to 2 digits is "59.99"
+      int p10 = 1;
+      for (int k=0; k<tc->digits; k++) p10 *= 10;
+      int frac = (int)floor((x-xf)*p10);
+      if (frac>=p10) frac = p10-1;  // x-xf<1 but the product can round up to p10
+      ch += snprintf(ch, 16, ".%0*d", tc->digits, frac);
+    }
+  }
+  if (quote==TRUE) *ch++ = '"';
+  *thisCh = ch;
+}
+
+static struct tzCol *tzColumn(SEXP column, const char *tzdir, int digitsSecs)
+{
+  // Called once per POSIXct column before the parallel region. NULL if the zone is unavailable.
+  SEXP tzone = getAttrib(column, install("tzone"));
+  const char *name = isString(tzone) && LENGTH(tzone) ? CHAR(STRING_ELT(tzone, 0)) : "";
+  const double *x = REAL(column);
+  RLEN n = LENGTH(column);
+  double minx = R_PosInf, maxx = R_NegInf;
+  for (RLEN i=0; i<n; i++) {
+    if (!R_FINITE(x[i])) continue;
+    if (x[i]<minx) minx=x[i];
+    if (x[i]>maxx) maxx=x[i];
+  }
+  struct tzTable *tz = tzLoad(name, tzdir, minx, maxx);
+  if (tz==NULL) return NULL;
+  struct tzCol *tc = (struct tzCol *)R_alloc(1, sizeof(struct tzCol));
+  tc->tz = tz;
+  // Column wide decisions as format.POSIXlt makes them: the date only when every time is midnight, and
+  // the fewest digits (up to digits.secs) that represent every fractional second to within 1e-6.
+  // bit k of ok is set while all seconds round ok to k digits; bit 7 while all are midnight.
+  int ok = 0xFF;
+  if (digitsSecs>6) digitsSecs=6;
+  #pragma omp parallel for num_threads(getDTthreads()) reduction(&:ok)
+  for (RLEN i=0; i<n; i++) {
+    if (!R_FINITE(x[i])) continue;
+    double xf = floor(x[i]);
+    double local = xf + tzOffset(tz, xf);
+    double sod = local - floor(local/86400)*86400;
+    double secs = fmod(sod, 60) + (x[i]-xf);
+    if (sod!=0 || x[i]!=xf) ok &= 0x7F;
+    for (int k=0, p10=1; k<digitsSecs; k++, p10*=10) {
+      if (fabs(secs - nearbyint(secs*p10)/p10) >= 1e-6) ok &= ~(1<<k);
+    }
+  }
+  tc->dateOnly = (ok & 0x80) != 0;
+  tc->digits = digitsSecs;
+  for (int k=0; k<digitsSecs; k++) if (ok & (1<<k)) { tc->digits = k; break; }
+  return tc;
+}
+
+
 static int failed = 0;
 static int rowsPerBatch;
+static const char *eol;                // any length string; e.g. "\n" or "\r\n"
+static const char *sep2start;          // e.g. "" or "{" before each list column cell
+static const char *sep2end;
+static char *extraType;                // ET_* of each column (0 for none), R_alloc'd by writefile
+static SEXPTYPE sameType;              // INTSXP or REALSXP when all columns are plain integer or plain double, else 0
+static Rboolean doRowNames;
+static SEXP rowNames;                  // NULL for implied row numbers
 
 static inline void checkBuffer(
   char **buffer,       // this thread's buffer
@@ -458,6 +853,343 @@ static inline void checkBuffer(
   }
 }
 
+static void writeLines(
+  SEXP DF,               // list of columns to write
+  const int *rowOrder,   // NULL, or 1-based row numbers to write in that order; e.g. from forder
+  RLEN start,            // write rows [start,end) of rowOrder, or of DF when rowOrder is NULL
+  RLEN end,
+  char **buffer,         // this thread's buffer, may be realloc'd by checkBuffer
+  size_t *myAlloc,
+  char **thisCh,         // where to write in buffer; updated to the end of the last line written
+  size_t *myMaxLineLen,
+  struct strCacheEntry *strCache  // this thread's, see writeStringCached
+) {
+  // Called from within parallel regions so no R API allocation here.
+  // Gathering through rowOrder means a table can be written in any order (or a group at a time)
+  // without reordering or subsetting its columns first.
+  int ncol = LENGTH(DF);
+  char *ch = *thisCh;
+  if (sameType==REALSXP && !doRowNames) {
+    // avoid deep switch() on type.
+    for (RLEN i=start; i<end; i++) {
+      RLEN row = rowOrder ? rowOrder[i]-1 : i;
+      char *lineStart = ch;
+      for (int j=0; j<ncol; j++) {
+        SEXP column = VECTOR_ELT(DF, j);
+        writeNumeric(REAL(column)[row], &ch);
+        *ch++ = sep;
+      }
+      ch--;  // backup onto the last sep after the last column
+      writeChars(eol, &ch);  // replace it with the newline.
+      
+      size_t thisLineLen = ch-lineStart;
+      if (thisLineLen > *myMaxLineLen) *myMaxLineLen=thisLineLen;
+      checkBuffer(buffer, myAlloc, &ch, *myMaxLineLen);
+      if (failed) break;
+    }
+  } else if (sameType==INTSXP && !doRowNames) {
+    for (RLEN i=start; i<end; i++) {
+      RLEN row = rowOrder ? rowOrder[i]-1 : i;
+      char *lineStart = ch;
+      for (int j=0; j<ncol; j++) {
+        SEXP column = VECTOR_ELT(DF, j);
+        if (INTEGER(column)[row] == NA_INTEGER) {
+          writeChars(na, &ch);
+        } else {
+          writeInteger(INTEGER(column)[row], &ch);
+        }
+        *ch++ = sep;
+      }
+      ch--;
+      writeChars(eol, &ch);
+      
+      size_t thisLineLen = ch-lineStart;
+      if (thisLineLen > *myMaxLineLen) *myMaxLineLen=thisLineLen;
+      checkBuffer(buffer, myAlloc, &ch, *myMaxLineLen);
+      if (failed) break;
+    }
+  } else {
+    // mixed types. switch() on every cell value since must write row-by-row
+    for (RLEN i=start; i<end; i++) {
+      RLEN row = rowOrder ? rowOrder[i]-1 : i;
+      char *lineStart = ch;
+      if (doRowNames) {
+        if (rowNames==NULL) {
+          if (quote!=FALSE) *ch++='"';  // default 'auto' will quote the row.name numbers
+          writeInteger(row+1, &ch);
+          if (quote!=FALSE) *ch++='"';
+        } else {
+          writeString(STRING_ELT(rowNames, row), &ch);
+        }
+        *ch++=sep;
+      }
+      for (int j=0; j<ncol; j++) {
+        SEXP column = VECTOR_ELT(DF, j);
+        switch(TYPEOF(column)) {
+        case LGLSXP:
+          writeLogical(LOGICAL(column)[row], &ch);
+          break;
+        case INTSXP:
+          if (INTEGER(column)[row] == NA_INTEGER) {
+            writeChars(na, &ch);
+          } else if (extraType[j] == ET_FACTOR) {
+            const struct renderedLevels *r = factorLevels[j];
+            int k = INTEGER(column)[row];
+            memcpy(ch, r->buf+r->off[k-1], r->off[k]-r->off[k-1]);
+            ch += r->off[k]-r->off[k-1];
+          } else if (extraType[j] == ET_ITIME) {
+            writeITime(INTEGER(column)[row], &ch);
+          } else if (extraType[j] == ET_DATE) {
+            writeDate(INTEGER(column)[row], &ch);
+          } else {
+            writeInteger(INTEGER(column)[row], &ch);
+          }
+          break;
+        case REALSXP:
+          if (extraType[j] == ET_INT64) {
+            long long i64 = *(long long *)&REAL(column)[row];
+            if (i64 == NAINT64) {
+              writeChars(na, &ch);
+            } else {
+              writeInteger(i64, &ch);
+            }
+          } else {
+            if (extraType[j] == ET_DATE) {
+              writeDate( R_FINITE(REAL(column)[row]) ? (int)REAL(column)[row] : NA_INTEGER, &ch);
+            } else if (extraType[j] == ET_POSIXCT) {
+              if (dateTimeAs==DATETIMEAS_WRITECSV) writePOSIXctLocal(REAL(column)[row], tzCols[j], &ch);
+              else writePOSIXct(REAL(column)[row], &ch);
+            } else {
+              writeNumeric(REAL(column)[row], &ch); // handles NA, Inf etc within it
+            }
+          }
+          break;
+        case STRSXP:
+          writeStringCached(STRING_ELT(column, row), strCache, &ch);
+          break;
+          
+        case VECSXP: {
+          // a list column containing atomic vectors in each cell
+          SEXP v = VECTOR_ELT(column,row);
+          writeChars(sep2start, &ch);
+          switch(TYPEOF(v)) {
+          case LGLSXP :
+            for (int k=0; k<LENGTH(v); k++) {
+              writeLogical(LOGICAL(v)[k], &ch);
+              *ch++ = sep2;
+            }
+            break;
+          case INTSXP:
+            if (isFactor(v)) {
+              SEXP l = getAttrib(v, R_LevelsSymbol);
+              for (int k=0; k<LENGTH(v); k++) {
+                if (INTEGER(v)[k]==NA_INTEGER) writeChars(na, &ch);
+                else writeString(STRING_ELT(l, INTEGER(v)[k]-1), &ch);
+                *ch++ = sep2;
+              }
+            } else if (INHERITS(v, char_ITime)) {
+              for (int k=0; k<LENGTH(v); k++) {
+                writeITime(INTEGER(v)[k], &ch);
+                *ch++ = sep2;
+              }
+            } else if (INHERITS(v, char_Date)) {
+              for (int k=0; k<LENGTH(v); k++) {
+                writeDate(INTEGER(v)[k], &ch);
+                *ch++ = sep2;
+              }
+            } else {
+              for (int k=0; k<LENGTH(v); k++) {
+                if (INTEGER(v)[k]==NA_INTEGER ) writeChars(na, &ch);
+                else writeInteger(INTEGER(v)[k], &ch);
+                *ch++ = sep2;
+              }
+            }
+            break;
+          case REALSXP:
+            if (INHERITS(v, char_integer64)) {
+              for (int k=0; k<LENGTH(v); k++) {
+                long long i64 = *(long long *)&REAL(v)[k];
+                if (i64==NAINT64) writeChars(na, &ch);
+                else writeInteger(i64, &ch);
+                *ch++ = sep2;
+              }
+            } else if (INHERITS(v, char_Date)) {
+              for (int k=0; k<LENGTH(v); k++) {
+                writeDate(R_FINITE(REAL(v)[k]) ? (int)REAL(v)[k] : NA_INTEGER, &ch);
+                *ch++ = sep2;
+              }
+            } else if (INHERITS(v, char_POSIXct)) {
+              for (int k=0; k<LENGTH(v); k++) {
+                writePOSIXct(REAL(v)[k], &ch);
+                *ch++ = sep2;
+              }
+            } else {
+              for (int k=0; k<LENGTH(v); k++) {
+                writeNumeric(REAL(v)[k], &ch);
+                *ch++ = sep2;
+              }
+            }
+            break;
+          case STRSXP:
+            for (int k=0; k<LENGTH(v); k++) {
+              writeString(STRING_ELT(v, k), &ch);
+              *ch++ = sep2;
+            }
+            break;
+          default:
+            error("Column %d is a list column but on row %d is type '%s' - not yet implemented. fwrite() can write list columns containing atomic vectors of type logical, integer, integer64, double, character and factor, currently.", j+1, type2char(TYPEOF(v)));
+          }  // end switch on atomic vector type in a list column
+          if (LENGTH(v)) ch--; // backup over the last sep2 after the last item
+          writeChars(sep2end, &ch); }
+          break;  // from case VECSXP for list column
+          
+        default:
+          error("Internal error: unsupported column type should have been thrown above when calculating maxLineLen");
+        }
+        *ch++ = sep; // next column
+      }
+      ch--;  // backup onto the last sep after the last column. 0-columns was caught and returned earlier, so >=1 cols.
+      writeChars(eol, &ch);  // replace it with the newline.
+      
+      // Track longest line seen so far. If we start to see longer lines than we saw in the
+      // sample, we'll realloc the buffer. The rowsPerBatch chosen based on the (very good) sample,
+      // must fit in the buffer. Can't early write and reset buffer because the
+      // file output would be out-of-order. Can't change rowsPerBatch after the 'parallel for' started.
+      size_t thisLineLen = ch-lineStart;
+      if (thisLineLen > *myMaxLineLen) *myMaxLineLen=thisLineLen;
+      checkBuffer(buffer, myAlloc, &ch, *myMaxLineLen);
+      if (failed) break; // don't write any more rows, fall through to clear up and error() below
+    }
+  }
+  *thisCh = ch;
+}
+
+static char *colNamesLine(SEXP DFin, int *len)
+{
+  // The column names line, malloc'd and '\0' terminated. NULL if DFin has no names.
+  // Built once so it can be written to the top of every file when partitioning.
+  SEXP names = getAttrib(DFin, R_NamesSymbol);
+  if (names==R_NilValue) return NULL;
+  int ncol = LENGTH(DFin);
+  if (LENGTH(names) != ncol) error("Internal error: length of column names is not equal to the number of columns. Please report.");
+  // allow for quoting even when not.
+  int buffSize = 2/*""*/ +1/*,*/;
+  for (int j=0; j<ncol; j++) buffSize += 1/*"*/ +2*LENGTH(STRING_ELT(names, j)) +1/*"*/ +1/*,*/;
+  //     in case every name full of quotes(!) to be escaped ^^
+  buffSize += strlen(eol) +1/*\0*/;
+  char *buffer = malloc(buffSize);
+  if (buffer == NULL) error("Unable to allocate %d buffer for column names", buffSize);
+  char *ch = buffer;
+  if (doRowNames) {
+    if (quote!=FALSE) { *ch++='"'; *ch++='"'; } // to match write.csv
+    *ch++ = sep;
+  }
+  for (int j=0; j<ncol; j++) {
+    writeString(STRING_ELT(names, j), &ch);
+    *ch++ = sep;
+  }
+  ch--;  // backup onto the last sep after the last column
+  writeChars(eol, &ch);  // replace it with the newline 
+  *ch = '\0';
+  *len = (int)(ch-buffer);
+  return buffer;
+}
+
+static void writePartitions(
+  SEXP DF,
+  const int *rowOrder,   // NULL when the table is already grouped by the partition columns
+  RLEN nrow,
+  SEXP partStarts,       // 1-based start of each group in rowOrder; i.e. attr(forderv(...,retGrp=TRUE),"starts")
+  SEXP partFiles,        // the file to write each group to
+  const char *header,    // column names line or NULL
+  int headerLen,
+  size_t buffSize,
+  size_t maxLineLen,
+  int nth,
+  Rboolean append,
+  Rboolean showProgress)
+{
+  // Groups are written to separate files so, unlike the single file case, there is no need for the
+  // threads to take turns in an ordered section. Each thread takes the next group, opens its file,
+  // and writes the group a batch at a time through its own buffer. rowOrder is used directly so that
+  // no group is ever materialised as a subset.
+  int nPart = LENGTH(partStarts);
+  if (LENGTH(partFiles) != nPart) error("Internal error: length(partFiles) [%d] != length(partStarts) [%d]", LENGTH(partFiles), nPart);
+  const int *starts = INTEGER(partStarts);
+  const char **files = (const char **)R_alloc(nPart, sizeof(char *));
+  for (int g=0; g<nPart; g++) files[g] = CHAR(STRING_ELT(partFiles, g));  // R API before the parallel region
+  if (nPart < nth) nth = nPart;
+  int failedPart = -1;
+  RLEN rowsDone = 0;
+  time_t start_time = time(NULL);
+  time_t next_time = start_time+2;
+  Rboolean hasPrinted=FALSE;
+  
+  #pragma omp parallel num_threads(nth)
+  {
+    char *ch, *buffer;
+    ch = buffer = malloc(buffSize);  // each thread has its own buffer, reused for all the groups it writes
+    struct strCacheEntry *strCache = calloc(STRCACHE_SIZE, sizeof(struct strCacheEntry));
+    if (buffer==NULL || strCache==NULL) {failed=-errno;}
+    size_t myAlloc = buffSize;
+    size_t myMaxLineLen = maxLineLen;
+    int me = omp_get_thread_num();
+    
+    #pragma omp for schedule(dynamic)
+    for (int g=0; g<nPart; g++) {
+      if (failed) continue;
+      RLEN from = starts[g]-1, to = (g==nPart-1) ? nrow : starts[g+1]-1;
+#ifdef WIN32
+      int f = _open(files[g], _O_WRONLY | _O_BINARY | _O_CREAT | (append ? _O_APPEND : _O_TRUNC), _S_IWRITE);
+#else
+      int f = open(files[g], O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0644);
+#endif
+      int err = 0;
+      if (f==-1) err = errno;
+      else if (header && WRITE(f, header, headerLen)==-1) err = errno;
+      for (RLEN start=from; start<to && !err && !failed; start+=rowsPerBatch) {
+        RLEN end = ((to-start)<rowsPerBatch) ? to : start+rowsPerBatch;
+        writeLines(DF, rowOrder, start, end, &buffer, &myAlloc, &ch, &myMaxLineLen, strCache);
+        if (failed) break;
+        if (WRITE(f, buffer, (int)(ch-buffer)) == -1) err = errno;
+        ch = buffer;
+      }
+      if (f!=-1 && CLOSE(f) && !err) err = errno;
+      if (err) {
+        #pragma omp critical
+        {
+          if (!failed) { failed = err; failedPart = g; }
+        }
+      }
+      #pragma omp atomic
+      rowsDone += to-from;
+      time_t now;
+      if (me==0 && showProgress && !failed && (now=time(NULL))>=next_time) {
+        int ETA = (int)((nrow-rowsDone)*(((double)(now-start_time))/rowsDone));
+        if (hasPrinted || ETA >= 2) {
+          Rprintf("\rWritten %.1f%% of %d rows (%d files) in %d secs using %d thread%s. Finished in %d secs.      ",
+                   (100.0*rowsDone)/nrow, nrow, nPart, (int)(now-start_time), nth, nth==1?"":"s", ETA);
+          R_FlushConsole();
+          next_time = now+1;
+          hasPrinted = TRUE;
+        }
+      }
+    }
+    free(buffer);
+    free(strCache);
+  }
+  if (hasPrinted) {
+    Rprintf("\r                                                                       "
+            "                                                              \r");
+    R_FlushConsole();
+  }
+  if (failed<0) {
+    error("%s. One or more threads failed to malloc or realloc their private buffer. nThread=%d and initial buffer size per thread was %d bytes.\n", strerror(-failed), nth, (int)buffSize);
+  } else if (failed>0) {
+    error("%s: '%s'", strerror(failed), failedPart>=0 ? files[failedPart] : "");
+  }
+}
+
 SEXP writefile(SEXP DFin,               // any list of same length vectors; e.g. data.frame, data.table
                SEXP filename_Arg,
                SEXP sep_Arg,
@@ -475,7 +1207,12 @@ SEXP writefile(SEXP DFin,               // any list of same length vectors; e.g.
                SEXP buffMB_Arg,         // [1-1024] default 8MB
                SEXP nThread,
                SEXP showProgress_Arg,
-               SEXP verbose_Arg)
+               SEXP verbose_Arg,
+               SEXP rowOrder_Arg,       // integer() or 1-based row numbers to write in that order; e.g. from forderv, or a subset
+               SEXP partStarts_Arg,     // NULL or the group starts (1-based positions in rowOrder) when partitionBy
+               SEXP partFiles_Arg,      // NULL or one file name per group
+               SEXP tzdir_Arg,          // zoneinfo directory for dateTimeAs="write.csv"
+               SEXP digitsSecs_Arg)     // getOption("digits.secs") for dateTimeAs="write.csv"
 {
   if (!isNewList(DFin)) error("fwrite must be passed an object of type list; e.g. data.frame, data.table");
   RLEN ncol = length(DFin);
@@ -492,11 +1229,11 @@ SEXP writefile(SEXP DFin,               // any list of same length vectors; e.g.
   verbose = LOGICAL(verbose_Arg)[0];
   
   sep = *CHAR(STRING_ELT(sep_Arg, 0));  // DO NOT DO: allow multichar separator (bad idea)
-  const char *sep2start = CHAR(STRING_ELT(sep2_Arg, 0));
+  sep2start = CHAR(STRING_ELT(sep2_Arg, 0));
   sep2 = *CHAR(STRING_ELT(sep2_Arg, 1));
-  const char *sep2end = CHAR(STRING_ELT(sep2_Arg, 2));
+  sep2end = CHAR(STRING_ELT(sep2_Arg, 2));
   
-  const char *eol = CHAR(STRING_ELT(eol_Arg, 0));
+  eol = CHAR(STRING_ELT(eol_Arg, 0));
   // someone might want a trailer on every line so allow any length string as eol
   
   na = CHAR(STRING_ELT(na_Arg, 0));
@@ -510,43 +1247,65 @@ SEXP writefile(SEXP DFin,               // any list of same length vectors; e.g.
   int nth = INTEGER(nThread)[0];
   int firstListColumn = 0;
   clock_t t0=clock();
+  
+  if (!isInteger(rowOrder_Arg)) error("Internal error: rowOrder is type '%s' not integer", type2char(TYPEOF(rowOrder_Arg)));
+  const int *rowOrder = NULL;  // NULL means write the rows in the order they are
+  if (LENGTH(rowOrder_Arg)) {
+    // rows are gathered through rowOrder by writeLines() in the parallel region so check them all here up front
+    rowOrder = INTEGER(rowOrder_Arg);
+    for (int i=0; i<LENGTH(rowOrder_Arg); i++) {
+      if (rowOrder[i]==NA_INTEGER) error("order[%d] is NA", i+1);
+      if (rowOrder[i]<1 || rowOrder[i]>nrow) error("order[%d] is %d which is outside the range [1,nrow=%d]", i+1, rowOrder[i], nrow);
+    }
+  }
 
   SEXP DF = DFin;
   int protecti = 0;
+  tzCols = NULL;
   if (dateTimeAs == DATETIMEAS_WRITECSV) {
     int j=0; while(j<ncol && !INHERITS(VECTOR_ELT(DFin,j), char_POSIXct)) j++;
     if (j<ncol) {
-      // dateTimeAs=="write.csv" && there exist some POSIXct columns; coerce them
-      DF = PROTECT(allocVector(VECSXP, ncol));
-      protecti++;
-      // potentially large if ncol=1e6 as reported in #1903 where using large VLA caused stack overflow
-      SEXP s = PROTECT(allocList(2));
-      SET_TYPEOF(s, LANGSXP);
-      SETCAR(s, install("format.POSIXct"));
+      // dateTimeAs=="write.csv" && there exist some POSIXct columns. They are written in their time zone
+      // by writePOSIXctLocal() in the batch loop. Only a column whose zone isn't available (see tzLoad) is
+      // coerced using format.POSIXct, as all were before.
+      const char *tzdir = CHAR(STRING_ELT(tzdir_Arg, 0));
+      int digitsSecs = INTEGER(digitsSecs_Arg)[0];
+      tzCols = (struct tzCol **)R_alloc(ncol, sizeof(struct tzCol *));  // not a VLA; see #1903 below
+      SEXP s = R_NilValue;
       for (int j=0; j<ncol; j++) {
         SEXP column = VECTOR_ELT(DFin, j);
-        if (INHERITS(column, char_POSIXct)) {
-          SETCAR(CDR(s), column);
-          SET_VECTOR_ELT(DF, j, eval(s, R_GlobalEnv));
-        } else {
-          SET_VECTOR_ELT(DF, j, column);
+        tzCols[j] = NULL;
+        if (!INHERITS(column, char_POSIXct)) continue;
+        if (TYPEOF(column)==REALSXP && (tzCols[j] = tzColumn(column, tzdir, digitsSecs))) continue;
+        if (DF == DFin) {
+          // potentially large if ncol=1e6 as reported in #1903 where using large VLA caused stack overflow
+          DF = PROTECT(allocVector(VECSXP, ncol));
+          for (int k=0; k<ncol; k++) SET_VECTOR_ELT(DF, k, VECTOR_ELT(DFin, k));
+          s = PROTECT(allocList(2));
+          protecti += 2;
+          SET_TYPEOF(s, LANGSXP);
+          SETCAR(s, install("format.POSIXct"));
         }
+        if (verbose) Rprintf("Time zone of column %d is not available to C; using format.POSIXct\n", j+1);
+        SETCAR(CDR(s), column);
+        SET_VECTOR_ELT(DF, j, eval(s, R_GlobalEnv));
       }
-      UNPROTECT(1);  // s, not DF
     }
   }
   
-  int sameType = TYPEOF(VECTOR_ELT(DFin, 0)); // to avoid deep switch later
+  sameType = TYPEOF(VECTOR_ELT(DFin, 0)); // to avoid deep switch later
 
   // Store column type tests in lookup for efficiency
   // ET_INT64, ET_ITIME, ET_DATE, ET_POSIXCT, ET_FACTOR
-  char *extraType = (char *)R_alloc(ncol, sizeof(char)); // not a VLA as ncol could be > 1e6 columns
+  extraType = (char *)R_alloc(ncol, sizeof(char)); // not a VLA as ncol could be > 1e6 columns
+  factorLevels = (struct renderedLevels **)R_alloc(ncol, sizeof(struct renderedLevels *));
   
   for (int j=0; j<ncol; j++) {
     SEXP column = VECTOR_ELT(DF, j);
     if (nrow != length(column))
       error("Column %d's length (%d) is not the same as column 1's length (%d)", j+1, length(column), nrow);
     extraType[j] = 0;
+    factorLevels[j] = NULL;
     if (isFactor(column)) {
       extraType[j] = ET_FACTOR;
     } else if (INHERITS(column, char_integer64)) {
@@ -557,7 +1316,7 @@ SEXP writefile(SEXP DFin,               // any list of same length vectors; e.g.
     } else if (INHERITS(column, char_Date)) {  // including IDate which inherits from Date
       extraType[j] = ET_DATE;
     } else if (INHERITS(column, char_POSIXct)) {
-      if (dateTimeAs==DATETIMEAS_WRITECSV) error("Internal error: column should have already been coerced to character");
+      if (dateTimeAs==DATETIMEAS_WRITECSV && tzCols[j]==NULL) error("Internal error: column should have already been coerced to character");
       extraType[j] = ET_POSIXCT;
     }
     if (TYPEOF(column)!=sameType || getAttrib(column,R_ClassSymbol)!=R_NilValue) {
@@ -575,10 +1334,14 @@ SEXP writefile(SEXP DFin,               // any list of same length vectors; e.g.
     if (dec==sep2 || sep==sep2)
       error("sep ('%c'), sep2[2L] ('%c') and dec ('%c') must all be different when list columns are present. Column %d is a list column.", sep, sep2, dec, firstListColumn); 
   }
+  // now that sep2 is known, so whether quote='auto' would quote each level is too
+  for (int j=0; j<ncol; j++) {
+    if (extraType[j]==ET_FACTOR) factorLevels[j] = renderLevels(getAttrib(VECTOR_ELT(DF, j), R_LevelsSymbol));
+  }
   
   // user may want row names even when they don't exist (implied row numbers as row names)
-  Rboolean doRowNames = LOGICAL(row_names)[0];
-  SEXP rowNames = NULL;
+  doRowNames = LOGICAL(row_names)[0];
+  rowNames = NULL;
   if (doRowNames) {
     rowNames = getAttrib(DFin, R_RowNamesSymbol);
     if (!isString(rowNames)) rowNames=NULL;
@@ -693,10 +1456,14 @@ SEXP writefile(SEXP DFin,               // any list of same length vectors; e.g.
     }
   }
   maxLineLen += strlen(eol);
+  if (rowOrder) nrow = LENGTH(rowOrder_Arg);  // the sample above was of the table's rows; from now on nrow is the number of rows to write
   if (verbose) Rprintf("maxLineLen=%d from sample. Found in %.3fs\n", maxLineLen, 1.0*(clock()-t0)/CLOCKS_PER_SEC);
   
-  int f;
-  if (*filename=='\0') {
+  const Rboolean partitioned = !isNull(partFiles_Arg);
+  int f=-1;
+  if (partitioned) {
+    // one file per group, each opened by the thread that writes it; see writePartitions()
+  } else if (*filename=='\0') {
     f=-1;  // file="" means write to standard output
     eol = "\n";  // We'll use Rprintf(); it knows itself about \r\n on Windows
   } else { 
@@ -716,46 +1483,28 @@ SEXP writefile(SEXP DFin,               // any list of same length vectors; e.g.
     }
   }
   t0=clock();
-    
-  if (verbose) {
+  
+  int headerLen = 0;
+  char *header = LOGICAL(col_names)[0] ? colNamesLine(DFin, &headerLen) : NULL;  // NULL when no names too
+  if (verbose && !partitioned) {
     Rprintf("Writing column names ... ");
     if (f==-1) Rprintf("\n");
   }
-  if (LOGICAL(col_names)[0]) {
-    SEXP names = getAttrib(DFin, R_NamesSymbol);  
-    if (names!=R_NilValue) {
-      if (LENGTH(names) != ncol) error("Internal error: length of column names is not equal to the number of columns. Please report.");
-      // allow for quoting even when not.
-      int buffSize = 2/*""*/ +1/*,*/;
-      for (int j=0; j<ncol; j++) buffSize += 1/*"*/ +2*LENGTH(STRING_ELT(names, j)) +1/*"*/ +1/*,*/;
-      //     in case every name full of quotes(!) to be escaped ^^
-      buffSize += strlen(eol) +1/*\0*/;
-      char *buffer = malloc(buffSize);
-      if (buffer == NULL) error("Unable to allocate %d buffer for column names", buffSize);
-      char *ch = buffer;
-      if (doRowNames) {
-        if (quote!=FALSE) { *ch++='"'; *ch++='"'; } // to match write.csv
-        *ch++ = sep;
-      }
-      for (int j=0; j<ncol; j++) {
-        writeString(STRING_ELT(names, j), &ch);
-        *ch++ = sep;
-      }
-      ch--;  // backup onto the last sep after the last column
-      writeChars(eol, &ch);  // replace it with the newline 
-      if (f==-1) { *ch='\0'; Rprintf(buffer); }
-      else if (WRITE(f, buffer, (int)(ch-buffer))==-1) {
-        int errwrite=errno;
-        close(f); // the close might fail too but we want to report the write error
-        free(buffer);
-        error("%s: '%s'", strerror(errwrite), filename);
-      }
-      free(buffer);
+  if (header && !partitioned) {
+    if (f==-1) { Rprintf(header); }
+    else if (WRITE(f, header, headerLen)==-1) {
+      int errwrite=errno;
+      close(f); // the close might fail too but we want to report the write error
+      free(header);
+      error("%s: '%s'", strerror(errwrite), filename);
     }
+    free(header);
+    header = NULL;
   }
-  if (verbose) Rprintf("done in %.3fs\n", 1.0*(clock()-t0)/CLOCKS_PER_SEC);
+  if (verbose && !partitioned) Rprintf("done in %.3fs\n", 1.0*(clock()-t0)/CLOCKS_PER_SEC);
   if (nrow == 0) {
     if (verbose) Rprintf("No data rows present (nrow==0)\n");
+    free(header);
     if (f!=-1 && CLOSE(f)) error("%s: '%s'", strerror(errno), filename);
     UNPROTECT(protecti);
     return(R_NilValue);
@@ -771,22 +1520,35 @@ SEXP writefile(SEXP DFin,               // any list of same length vectors; e.g.
   //   smaller than that though, to achieve some load balancing across threads since schedule(dynamic).
   int buffMB = INTEGER(buffMB_Arg)[0]; // checked at R level between 1 and 1024
   if (buffMB<1 || buffMB>1024) error("buffMB=%d outside [1,1024]", buffMB); // check it again even so
-  size_t buffSize = 1024*1024*buffMB;
-  if (maxLineLen > buffSize) buffSize=2*maxLineLen;  // A very long line; at least 1,048,576 characters
+  size_t buffSize = 1024*1024*(size_t)buffMB;
+  if ((size_t)maxLineLen > buffSize) buffSize=2*(size_t)maxLineLen;  // A very long line; at least 1,048,576 characters
   rowsPerBatch =
-    (10*maxLineLen > buffSize) ? 1 :  // very long lines (100,000 characters+) we'll just do one row at a time.
+    (10*(size_t)maxLineLen > buffSize) ? 1 :  // very long lines (100,000 characters+) we'll just do one row at a time.
     0.5 * buffSize/maxLineLen;        // Aim for 50% buffer usage. See checkBuffer for comments.
   if (rowsPerBatch > nrow) rowsPerBatch=nrow;
   int numBatches = (nrow-1)/rowsPerBatch + 1;
   if (numBatches < nth) nth = numBatches;
   if (verbose) {
-    Rprintf("Writing %d rows in %d batches of %d rows (each buffer size %dMB, showProgress=%d, nth=%d) ... ",
-    nrow, numBatches, rowsPerBatch, buffMB, showProgress, nth);
+    if (partitioned) {
+      Rprintf("Writing %d rows to %d files in batches of %d rows (each buffer size %dMB, showProgress=%d, nth=%d) ... ",
+      nrow, LENGTH(partFiles_Arg), rowsPerBatch, buffMB, showProgress, nth);
+    } else {
+      Rprintf("Writing %d rows in %d batches of %d rows (each buffer size %dMB, showProgress=%d, nth=%d) ... ",
+      nrow, numBatches, rowsPerBatch, buffMB, showProgress, nth);
+    }
     if (f==-1) Rprintf("\n");
   }
   t0 = clock();
   
   failed=0;  // static global so checkBuffer can set it. -errno for malloc or realloc fails, +errno for write fail
+  if (partitioned) {
+    writePartitions(DF, rowOrder, nrow, partStarts_Arg, partFiles_Arg, header, headerLen,
+                    buffSize, maxLineLen, nth, LOGICAL(append)[0], showProgress);
+    free(header);
+    if (verbose) Rprintf("done in %.3fs\n", 1.0*(clock()-t0)/CLOCKS_PER_SEC);
+    UNPROTECT(protecti);
+    return(R_NilValue);
+  }
   Rboolean hasPrinted=FALSE;
   Rboolean anyBufferGrown=FALSE;
   int maxBuffUsedPC=0;
@@ -795,10 +1557,11 @@ SEXP writefile(SEXP DFin,               // any list of same length vectors; e.g.
   {
     char *ch, *buffer;               // local to each thread
     ch = buffer = malloc(buffSize);  // each thread has its own buffer
+    struct strCacheEntry *strCache = calloc(STRCACHE_SIZE, sizeof(struct strCacheEntry));
     // Don't use any R API alloc here (e.g. R_alloc); they are
     // not thread-safe as per last sentence of R-exts 6.1.1.
     
-    if (buffer==NULL) {failed=-errno;}
+    if (buffer==NULL || strCache==NULL) {failed=-errno;}
     // Do not rely on availability of '#omp cancel' new in OpenMP v4.0 (July 2013).
     // OpenMP v4.0 is in gcc 4.9+ (https://gcc.gnu.org/wiki/openmp) but
     // not yet in clang as of v3.8 (http://openmp.llvm.org/)
@@ -824,191 +1587,7 @@ SEXP writefile(SEXP DFin,               // any list of same length vectors; e.g.
       
       // all-integer and all-double deep switch() avoidance. We could code up all-integer64
       // as well but that seems even less likely in practice than all-integer or all-double
-      if (sameType==REALSXP && !doRowNames) {
-        // avoid deep switch() on type.
-        for (RLEN i=start; i<end; i++) {
-          char *lineStart = ch;
-          for (int j=0; j<ncol; j++) {
-            SEXP column = VECTOR_ELT(DF, j);
-            writeNumeric(REAL(column)[i], &ch);
-            *ch++ = sep;
-          }
-          ch--;  // backup onto the last sep after the last column
-          writeChars(eol, &ch);  // replace it with the newline.
-          
-          size_t thisLineLen = ch-lineStart;
-          if (thisLineLen > myMaxLineLen) myMaxLineLen=thisLineLen;
-          checkBuffer(&buffer, &myAlloc, &ch, myMaxLineLen);
-          if (failed) break;
-        }
-      } else if (sameType==INTSXP && !doRowNames) {
-        for (RLEN i=start; i<end; i++) {
-          char *lineStart = ch;
-          for (int j=0; j<ncol; j++) {
-            SEXP column = VECTOR_ELT(DF, j);
-            if (INTEGER(column)[i] == NA_INTEGER) {
-              writeChars(na, &ch);
-            } else {
-              writeInteger(INTEGER(column)[i], &ch);
-            }
-            *ch++ = sep;
-          }
-          ch--;
-          writeChars(eol, &ch);
-          
-          size_t thisLineLen = ch-lineStart;
-          if (thisLineLen > myMaxLineLen) myMaxLineLen=thisLineLen;
-          checkBuffer(&buffer, &myAlloc, &ch, myMaxLineLen);
-          if (failed) break;
-        }
-      } else {
-        // mixed types. switch() on every cell value since must write row-by-row
-        for (RLEN i=start; i<end; i++) {
-          char *lineStart = ch;
-          if (doRowNames) {
-            if (rowNames==NULL) {
-              if (quote!=FALSE) *ch++='"';  // default 'auto' will quote the row.name numbers
-              writeInteger(i+1, &ch);
-              if (quote!=FALSE) *ch++='"';
-            } else {
-              writeString(STRING_ELT(rowNames, i), &ch);
-            }
-            *ch++=sep;
-          }
-          for (int j=0; j<ncol; j++) {
-            SEXP column = VECTOR_ELT(DF, j);
-            switch(TYPEOF(column)) {
-            case LGLSXP:
-              writeLogical(LOGICAL(column)[i], &ch);
-              break;
-            case INTSXP:
-              if (INTEGER(column)[i] == NA_INTEGER) {
-                writeChars(na, &ch);
-              } else if (extraType[j] == ET_FACTOR) {
-                writeString(STRING_ELT(getAttrib(column,R_LevelsSymbol), INTEGER(column)[i]-1), &ch);
-              } else if (extraType[j] == ET_ITIME) {
-                writeITime(INTEGER(column)[i], &ch);
-              } else if (extraType[j] == ET_DATE) {
-                writeDate(INTEGER(column)[i], &ch);
-              } else {
-                writeInteger(INTEGER(column)[i], &ch);
-              }
-              break;
-            case REALSXP:
-              if (extraType[j] == ET_INT64) {
-                long long i64 = *(long long *)&REAL(column)[i];
-                if (i64 == NAINT64) {
-                  writeChars(na, &ch);
-                } else {
-                  writeInteger(i64, &ch);
-                }
-              } else {
-                if (extraType[j] == ET_DATE) {
-                  writeDate( R_FINITE(REAL(column)[i]) ? (int)REAL(column)[i] : NA_INTEGER, &ch);
-                } else if (extraType[j] == ET_POSIXCT) {
-                  writePOSIXct(REAL(column)[i], &ch);
-                } else {
-                  writeNumeric(REAL(column)[i], &ch); // handles NA, Inf etc within it
-                }
-              }
-              break;
-            case STRSXP:
-              writeString(STRING_ELT(column, i), &ch);
-              break;
-              
-            case VECSXP: {
-              // a list column containing atomic vectors in each cell
-              SEXP v = VECTOR_ELT(column,i);
-              writeChars(sep2start, &ch);
-              switch(TYPEOF(v)) {
-              case LGLSXP :
-                for (int k=0; k<LENGTH(v); k++) {
-                  writeLogical(LOGICAL(v)[k], &ch);
-                  *ch++ = sep2;
-                }
-                break;
-              case INTSXP:
-                if (isFactor(v)) {
-                  SEXP l = getAttrib(v, R_LevelsSymbol);
-                  for (int k=0; k<LENGTH(v); k++) {
-                    if (INTEGER(v)[k]==NA_INTEGER) writeChars(na, &ch);
-                    else writeString(STRING_ELT(l, INTEGER(v)[k]-1), &ch);
-                    *ch++ = sep2;
-                  }
-                } else if (INHERITS(v, char_ITime)) {
-                  for (int k=0; k<LENGTH(v); k++) {
-                    writeITime(INTEGER(v)[k], &ch);
-                    *ch++ = sep2;
-                  }
-                } else if (INHERITS(v, char_Date)) {
-                  for (int k=0; k<LENGTH(v); k++) {
-                    writeDate(INTEGER(v)[k], &ch);
-                    *ch++ = sep2;
-                  }
-                } else {
-                  for (int k=0; k<LENGTH(v); k++) {
-                    if (INTEGER(v)[k]==NA_INTEGER ) writeChars(na, &ch);
-                    else writeInteger(INTEGER(v)[k], &ch);
-                    *ch++ = sep2;
-                  }
-                }
-                break;
-              case REALSXP:
-                if (INHERITS(v, char_integer64)) {
-                  for (int k=0; k<LENGTH(v); k++) {
-                    long long i64 = *(long long *)&REAL(v)[k];
-                    if (i64==NAINT64) writeChars(na, &ch);
-                    else writeInteger(i64, &ch);
-                    *ch++ = sep2;
-                  }
-                } else if (INHERITS(v, char_Date)) {
-                  for (int k=0; k<LENGTH(v); k++) {
-                    writeDate(R_FINITE(REAL(v)[k]) ? (int)REAL(v)[k] : NA_INTEGER, &ch);
-                    *ch++ = sep2;
-                  }
-                } else if (INHERITS(v, char_POSIXct)) {
-                  for (int k=0; k<LENGTH(v); k++) {
-                    writePOSIXct(REAL(v)[k], &ch);
-                    *ch++ = sep2;
-                  }
-                } else {
-                  for (int k=0; k<LENGTH(v); k++) {
-                    writeNumeric(REAL(v)[k], &ch);
-                    *ch++ = sep2;
-                  }
-                }
-                break;
-              case STRSXP:
-                for (int k=0; k<LENGTH(v); k++) {
-                  writeString(STRING_ELT(v, k), &ch);
-                  *ch++ = sep2;
-                }
-                break;
-              default:
-                error("Column %d is a list column but on row %d is type '%s' - not yet implemented. fwrite() can write list columns containing atomic vectors of type logical, integer, integer64, double, character and factor, currently.", j+1, type2char(TYPEOF(v)));
-              }  // end switch on atomic vector type in a list column
-              if (LENGTH(v)) ch--; // backup over the last sep2 after the last item
-              writeChars(sep2end, &ch); }
-              break;  // from case VECSXP for list column
-              
-            default:
-              error("Internal error: unsupported column type should have been thrown above when calculating maxLineLen");
-            }
-            *ch++ = sep; // next column
-          }
-          ch--;  // backup onto the last sep after the last column. 0-columns was caught and returned earlier, so >=1 cols.
-          writeChars(eol, &ch);  // replace it with the newline.
-          
-          // Track longest line seen so far. If we start to see longer lines than we saw in the
-          // sample, we'll realloc the buffer. The rowsPerBatch chosen based on the (very good) sample,
-          // must fit in the buffer. Can't early write and reset buffer because the
-          // file output would be out-of-order. Can't change rowsPerBatch after the 'parallel for' started.
-          size_t thisLineLen = ch-lineStart;
-          if (thisLineLen > myMaxLineLen) myMaxLineLen=thisLineLen;
-          checkBuffer(&buffer, &myAlloc, &ch, myMaxLineLen);
-          if (failed) break; // don't write any more rows, fall through to clear up and error() below
-        }
-      }
+      writeLines(DF, rowOrder, start, end, &buffer, &myAlloc, &ch, &myMaxLineLen, strCache);
       #pragma omp ordered
       {
         if (!failed) { // a thread ahead of me could have failed below while I was working or waiting above
@@ -1066,6 +1645,7 @@ SEXP writefile(SEXP DFin,               // any list of same length vectors; e.g.
       }
     }
     free(buffer);
+    free(strCache);
     // all threads will call this free on their buffer, even if one or more threads had malloc
     // or realloc fail. If the initial malloc failed, free(NULL) is ok and does nothing.
   }
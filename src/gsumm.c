@@ -5,7 +5,7 @@ static int *grp = NULL;      // the group of each x item, like a factor
 static int ngrp = 0;         // number of groups
 static int *grpsize = NULL;  // size of each group, used by gmean (and gmedian) not gsum
 static int grpn = 0;         // length of underlying x == length(grp)
-static int *irows;           // GForce support for subsets in 'i' (TODO: joins in 'i')
+static int *irows;           // GForce support for subsets in 'i', and for joins in 'i' with by=.EACHI (each group's matched rows together)
 static int irowslen = -1;    // -1 is for irows = NULL
 
 // for gmedian
@@ -13,6 +13,7 @@ static int maxgrpn = 0;
 static int *oo = NULL;
 static int *ff = NULL;
 static int isunsorted = 0;
+static Rboolean gcomp = FALSE;  // compensated double sums, see dcompsum
 static union {double d;
               long long ll;} u;
 
@@ -23,7 +24,289 @@ static union {double d;
 # define SQRTL sqrt
 #endif
 
-SEXP gstart(SEXP o, SEXP f, SEXP l, SEXP irowsArg) {
+/* Parallel GForce. A group's result must be exactly what the single threaded scatter over the rows gives, including the
+   rounding of a long double sum, so a group's rows are always combined in row order. The groups are shared between the
+   threads and each thread visits its groups' rows through o and f (growi); o is stable (forderv) so a group's rows are
+   increasing in it just as the scatter meets them. Integer sums, counts and integer min/max combine exactly whatever the
+   order, so when there are few groups for the rows (the groups then would be too few to share) each thread does a batch of
+   rows into its own accumulators instead and those are merged afterwards. */
+#define N_PAR 100000     // fewer rows than this stay single threaded, as in forder.c
+
+static int gthreads(int n) { return (n < N_PAR) ? 1 : getDTthreads(); }
+static Rboolean fewgrps(int n, int nth) { return (double)ngrp*nth <= n/8; }  // merging each thread's accumulators is then cheap
+static int grpchunk(int nth) { return ngrp/(nth*8) + 1; }                   // groups per dynamic chunk
+
+static inline int growi(int g, int j) {
+    // the j-th row of group g
+    int k = ff[g]+j-1;
+    if (isunsorted) k = oo[k]-1;
+    return (irowslen == -1) ? k : irows[k]-1;
+}
+
+static int *growoff(void)
+// where each group's values start in a result with a value per row of the group, one group after another (gcum, gshift)
+{
+    int *off = (int *)R_alloc(ngrp+1, sizeof(int));
+    off[0] = 0;
+    for (int g=0; g<ngrp; g++) off[g+1] = off[g] + grpsize[g];
+    return off;
+}
+
+/* Segmented reductions. When o is empty the rows are already grouped (x is keyed by the by= columns, or a join's matched
+   rows gathered by by=.EACHI) so each group is one run of rows from ff[g]. A run is streamed into an accumulator held in
+   a register, rather than each row scattered through grp[i] into the accumulators, and the integer kernels are branch free
+   so that they vectorise. A group's rows are still met in row order so the results are exactly the scatter's. Whether to
+   is decided from the layout: not for tiny groups, where starting each run costs more than it saves, nor when there are
+   too few groups to share between the threads and the batches of rows do better. */
+#define GSEG_MIN 4       // rows per group on average for the segmented kernels
+
+static Rboolean gsegmented(int nth) {
+    return !isunsorted && ngrp > 0 && grpn >= (double)ngrp*GSEG_MIN && (nth == 1 || !fewgrps(grpn, nth));
+}
+
+static void isegsum(const int *x, Rboolean narm, long double *s, int *c, int nth)
+// As isum. The run is added up in long long, which is exact as the long double sum of the scatter is.
+{
+    #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+    for (int g=0; g<ngrp; g++) {
+        const int m = grpsize[g];
+        long long t = 0;
+        int cnt = 0;
+        if (irowslen == -1) {
+            const int *xg = x + ff[g]-1;
+            for (int j=0; j<m; j++) { int v = xg[j], ok = v != NA_INTEGER; t += ok ? v : 0; cnt += ok; }
+        } else {
+            const int *rg = irows + ff[g]-1;
+            for (int j=0; j<m; j++) { int v = x[rg[j]-1], ok = v != NA_INTEGER; t += ok ? v : 0; cnt += ok; }
+        }
+        s[g] = (!narm && cnt < m) ? NA_REAL : (long double)t;
+        if (c) c[g] = cnt;
+    }
+}
+
+static void dsegsum(const double *x, Rboolean narm, long double *s, int *c, int nth)
+// As dsum
+{
+    #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+    for (int g=0; g<ngrp; g++) {
+        const int m = grpsize[g];
+        long double t = 0;
+        int cnt = 0;
+        if (irowslen == -1) {
+            const double *xg = x + ff[g]-1;
+            for (int j=0; j<m; j++) { double v = xg[j]; if (ISNAN(v) && narm) continue; t += v; cnt++; }
+        } else {
+            const int *rg = irows + ff[g]-1;
+            for (int j=0; j<m; j++) { double v = x[rg[j]-1]; if (ISNAN(v) && narm) continue; t += v; cnt++; }
+        }
+        s[g] = t;
+        if (c) c[g] = cnt;
+    }
+}
+
+static void isegminmax(const int *x, Rboolean narm, Rboolean ismax, int *ans, char *update, int nth)
+// As iminmax. NA_INTEGER is INT_MIN (checked in init.c) so it never wins a max, and is taken as INT_MAX for a min.
+{
+    #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+    for (int g=0; g<ngrp; g++) {
+        const int m = grpsize[g];
+        int best = ismax ? INT_MIN : INT_MAX, nna = 0;
+        if (irowslen == -1) {
+            const int *xg = x + ff[g]-1;
+            if (ismax) for (int j=0; j<m; j++) { int v = xg[j]; nna += v == NA_INTEGER; best = v > best ? v : best; }
+            else for (int j=0; j<m; j++) { int v = xg[j]; nna += v == NA_INTEGER; v = v == NA_INTEGER ? INT_MAX : v; best = v < best ? v : best; }
+        } else {
+            const int *rg = irows + ff[g]-1;
+            if (ismax) for (int j=0; j<m; j++) { int v = x[rg[j]-1]; nna += v == NA_INTEGER; best = v > best ? v : best; }
+            else for (int j=0; j<m; j++) { int v = x[rg[j]-1]; nna += v == NA_INTEGER; v = v == NA_INTEGER ? INT_MAX : v; best = v < best ? v : best; }
+        }
+        ans[g] = (nna == m || (nna && !narm)) ? NA_INTEGER : best;
+        if (update) update[g] = nna < m;
+    }
+}
+
+/* Compensated summation, options(datatable.gforce.compensated=TRUE). By default sums are long double as base's are, which
+   on x86 is the x87 unit: it can't be vectorised, and on some platforms (ARM, valgrind) long double is just double so results
+   differ between them. In this mode a double column is added up in double with Neumaier's compensation, in GLANES lanes
+   taking a group's rows in turn so that the lanes are independent and vectorise. Which lane a row goes to depends only on
+   its place in the group, so the result is the same on every platform and for any number of threads. Integers are added up
+   exactly in long long. The long double sums stay the default until this has been validated more widely. */
+#define GLANES 4
+
+static inline void neumaier(double *s, double *c, double v) {
+    double t = *s + v;
+    *c += (fabs(*s) >= fabs(v)) ? (*s - t) + v : (v - t) + *s;
+    *s = t;
+}
+
+static void dcompsum(const double *x, Rboolean narm, long double *s, int *c, int nth)
+// As dsum, in compensated double
+{
+    #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+    for (int g=0; g<ngrp; g++) {
+        double ls[GLANES] = {0}, lc[GLANES] = {0};
+        int m = grpsize[g], cnt = 0, j = 0;
+        const double *xg = (!isunsorted && irowslen == -1) ? x + ff[g]-1 : NULL;  // a run, read directly
+        for (; j+GLANES<=m; j+=GLANES) {
+            for (int l=0; l<GLANES; l++) {
+                double v = xg ? xg[j+l] : x[growi(g, j+l)];
+                int isna = ISNAN(v);
+                cnt += !isna;
+                neumaier(ls+l, lc+l, (narm && isna) ? 0.0 : v);
+            }
+        }
+        for (int l=0; j<m; j++, l++) {
+            double v = xg ? xg[j] : x[growi(g, j)];
+            int isna = ISNAN(v);
+            cnt += !isna;
+            neumaier(ls+l, lc+l, (narm && isna) ? 0.0 : v);
+        }
+        double t = 0, tc = 0;
+        for (int l=0; l<GLANES; l++) { neumaier(&t, &tc, ls[l]); tc += lc[l]; }
+        s[g] = R_FINITE(t) ? t + tc : t;   // Inf, NA and NaN would make the compensation NaN
+        if (c) c[g] = cnt;
+    }
+}
+
+static void icompsum(const int *x, Rboolean narm, long double *s, int *c, int nth)
+// As isum, added up exactly in long long (|sum| < 2^31 rows * 2^31) whatever the platform's long double
+{
+    if (gsegmented(nth)) { isegsum(x, narm, s, c, nth); return; }
+    #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+    for (int g=0; g<ngrp; g++) {
+        long long t = 0;
+        int m = grpsize[g], cnt = 0;
+        for (int j=0; j<m; j++) { int v = x[growi(g, j)], ok = v != NA_INTEGER; t += ok ? v : 0; cnt += ok; }
+        s[g] = (!narm && cnt < m) ? NA_REAL : (long double)t;
+        if (c) c[g] = cnt;
+    }
+}
+
+static Rboolean isum(const int *x, Rboolean narm, long double *s, int *c, int nth)
+// Sum of each group into s (NA_REAL for a group with NA unless narm) and, if c isn't NULL, the count of non-NA into c.
+// Returns FALSE if the threads' accumulators couldn't be allocated.
+{
+    int n = grpn;
+    if (gsegmented(nth)) { isegsum(x, narm, s, c, nth); return TRUE; }
+    if (!fewgrps(n, nth)) {
+        #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+        for (int g=0; g<ngrp; g++) {
+            long double t = 0;
+            int cnt = 0;
+            for (int j=0; j<grpsize[g]; j++) {
+                int v = x[growi(g, j)];
+                if (v == NA_INTEGER) { if (!narm) t = NA_REAL; continue; }
+                t += v;
+                cnt++;
+            }
+            s[g] = t;
+            if (c) c[g] = cnt;
+        }
+        return TRUE;
+    }
+    long long *ts = calloc((size_t)nth*ngrp, sizeof(long long));  // exact; |sum| < 2^31 rows * 2^31
+    int *tc = calloc((size_t)nth*ngrp, sizeof(int));
+    if (!ts || !tc) { free(ts); free(tc); return FALSE; }
+    int batchSize = (n-1)/nth + 1;
+    int nBatch = (n-1)/batchSize + 1;
+    #pragma omp parallel for num_threads(nth)
+    for (int batch=0; batch<nBatch; batch++) {
+        long long *thiss = ts + (size_t)batch*ngrp;
+        int *thisc = tc + (size_t)batch*ngrp;
+        int to = (batch==nBatch-1) ? n : (batch+1)*batchSize;
+        for (int i=batch*batchSize; i<to; i++) {
+            int v = x[(irowslen == -1) ? i : irows[i]-1];
+            if (v == NA_INTEGER) continue;
+            thiss[grp[i]] += v;
+            thisc[grp[i]]++;
+        }
+    }
+    for (int g=0; g<ngrp; g++) {
+        long long t = 0;
+        int cnt = 0;
+        for (int batch=0; batch<nBatch; batch++) { t += ts[(size_t)batch*ngrp + g]; cnt += tc[(size_t)batch*ngrp + g]; }
+        s[g] = (!narm && cnt < grpsize[g]) ? NA_REAL : (long double)t;
+        if (c) c[g] = cnt;
+    }
+    free(ts); free(tc);
+    return TRUE;
+}
+
+static void dsum(const double *x, Rboolean narm, long double *s, int *c, int nth)
+// As isum for double. The groups are always shared; a batch of rows' partial sums would round differently.
+{
+    if (gsegmented(nth)) { dsegsum(x, narm, s, c, nth); return; }
+    #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+    for (int g=0; g<ngrp; g++) {
+        long double t = 0;
+        int cnt = 0;
+        for (int j=0; j<grpsize[g]; j++) {
+            double v = x[growi(g, j)];
+            if (ISNAN(v) && narm) continue;  // else let NA_REAL propogate from here
+            t += v;
+            cnt++;
+        }
+        s[g] = t;
+        if (c) c[g] = cnt;
+    }
+}
+
+static Rboolean iminmax(const int *x, Rboolean narm, Rboolean ismax, int *ans, char *update, int nth)
+// Min or max of each group into ans. NA_INTEGER for a group with NA unless narm, and for a group with no non-NA; update[g]
+// (if not NULL) is set to whether group g has any non-NA. Returns FALSE if the threads' accumulators couldn't be allocated.
+{
+    int n = grpn;
+    if (gsegmented(nth)) { isegminmax(x, narm, ismax, ans, update, nth); return TRUE; }
+    if (!fewgrps(n, nth)) {
+        #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+        for (int g=0; g<ngrp; g++) {
+            int best = 0, hasval = 0, hasna = 0;
+            for (int j=0; j<grpsize[g]; j++) {
+                int v = x[growi(g, j)];
+                if (v == NA_INTEGER) { hasna = 1; continue; }
+                if (!hasval || (ismax ? v > best : v < best)) best = v;
+                hasval = 1;
+            }
+            ans[g] = (!hasval || (hasna && !narm)) ? NA_INTEGER : best;
+            if (update) update[g] = hasval;
+        }
+        return TRUE;
+    }
+    int *tbest = malloc((size_t)nth*ngrp * sizeof(int));
+    char *tflag = calloc((size_t)nth*ngrp, sizeof(char));  // 1 if this batch has a non-NA of the group, |2 if it has an NA
+    if (!tbest || !tflag) { free(tbest); free(tflag); return FALSE; }
+    int batchSize = (n-1)/nth + 1;
+    int nBatch = (n-1)/batchSize + 1;
+    #pragma omp parallel for num_threads(nth)
+    for (int batch=0; batch<nBatch; batch++) {
+        int *thisbest = tbest + (size_t)batch*ngrp;
+        char *thisflag = tflag + (size_t)batch*ngrp;
+        int to = (batch==nBatch-1) ? n : (batch+1)*batchSize;
+        for (int i=batch*batchSize; i<to; i++) {
+            int v = x[(irowslen == -1) ? i : irows[i]-1], g = grp[i];
+            if (v == NA_INTEGER) { thisflag[g] |= 2; continue; }
+            if (!(thisflag[g] & 1) || (ismax ? v > thisbest[g] : v < thisbest[g])) thisbest[g] = v;
+            thisflag[g] |= 1;
+        }
+    }
+    for (int g=0; g<ngrp; g++) {
+        int best = 0, hasval = 0, hasna = 0;
+        for (int batch=0; batch<nBatch; batch++) {
+            int v = tbest[(size_t)batch*ngrp + g];
+            char f = tflag[(size_t)batch*ngrp + g];
+            hasna |= f & 2;
+            if (!(f & 1)) continue;
+            if (!hasval || (ismax ? v > best : v < best)) best = v;
+            hasval = 1;
+        }
+        ans[g] = (!hasval || (hasna && !narm)) ? NA_INTEGER : best;
+        if (update) update[g] = hasval;
+    }
+    free(tbest); free(tflag);
+    return TRUE;
+}
+
+SEXP gstart(SEXP o, SEXP f, SEXP l, SEXP irowsArg, SEXP compArg) {
     int i, j, g, *this;
     // clock_t start = clock();
     if (!isInteger(o)) error("o is not integer vector");
@@ -49,23 +332,273 @@ SEXP gstart(SEXP o, SEXP f, SEXP l, SEXP irowsArg) {
         }
     }
     // for gmedian
-    // initialise maxgrpn
-    maxgrpn = INTEGER(getAttrib(o, install("maxgrpn")))[0];
+    // initialise maxgrpn; from forderv or the groups kept with an index, else from the group sizes (uniqlist's groups)
+    SEXP mg = getAttrib(o, install("maxgrpn"));
+    if (isInteger(mg) && LENGTH(mg) == 1) maxgrpn = INTEGER(mg)[0];
+    else for (maxgrpn=0, g=0; g<ngrp; g++) if (grpsize[g] > maxgrpn) maxgrpn = grpsize[g];
     oo = INTEGER(o);
     ff = INTEGER(f);
 
     irows = INTEGER(irowsArg);
     if (!isNull(irowsArg)) irowslen = length(irowsArg);
+    gcomp = isLogical(compArg) && LENGTH(compArg)==1 && LOGICAL(compArg)[0]==TRUE;
 
     // Rprintf("gstart took %8.3f\n", 1.0*(clock()-start)/CLOCKS_PER_SEC);
     return(R_NilValue);
 }
 
 SEXP gend() {
-    ngrp = 0; maxgrpn = 0; irowslen = -1; isunsorted = 0;
+    ngrp = 0; maxgrpn = 0; irowslen = -1; isunsorted = 0; gcomp = FALSE;
     return(R_NilValue);
 }
 
+SEXP gassign(SEXP dt, SEXP cols, SEXP newnames, SEXP vals)
+// := with by= and GForce: each group's value (one per group in each item of vals, from the GForce functions) goes to
+// the rows of that group in one pass over grp, rather than dogroups' memrecycle of each group. Between gstart and gend.
+// An item with a value per row instead (cumsum, shift and so on, one group after another) has each go to its row.
+// New columns are added and types are checked as dogroups does.
+{
+    int i, j;
+    if (!isInteger(cols)) error("Internal error: cols to gassign is type '%s' not integer", type2char(TYPEOF(cols)));
+    if (!isNewList(vals) || !LENGTH(vals)) error("Internal error: vals to gassign isn't a non-empty list");
+    SEXP dtnames = getAttrib(dt, R_NamesSymbol);
+    R_len_t origncol = LENGTH(dt), nrow = origncol ? length(VECTOR_ELT(dt, 0)) : 0;
+    if (grpn != ((irowslen == -1) ? nrow : irowslen)) error("Internal error: grpn [%d] != number of rows [%d] in gassign", grpn, (irowslen == -1) ? nrow : irowslen);
+    int nth = gthreads(grpn), *off = NULL;
+    for (j=0; j<LENGTH(cols); j++) {
+        int col = INTEGER(cols)[j];
+        SEXP RHS = VECTOR_ELT(vals, j%LENGTH(vals));
+        if (!isVectorAtomic(RHS) || (LENGTH(RHS)!=ngrp && LENGTH(RHS)!=grpn)) error("Internal error: item %d of vals to gassign isn't an atomic vector with one item for each of the %d groups or %d rows", j%LENGTH(vals)+1, ngrp, grpn);
+        Rboolean perrow = LENGTH(RHS)!=ngrp;   // when the groups are all 1 row, both are the same
+        if (perrow && !off) off = growoff();
+        SEXP target = VECTOR_ELT(dt, col-1);
+        if (isNull(target)) {
+            // first time adding to new column; over-allocated by alloc.col at R level, as for dogroups
+            if (TRUELENGTH(dt) < col) error("Internal error: Trying to add new column by reference but tl is full; alloc.col should have run first at R level before getting to this point in gassign");
+            target = PROTECT(allocNAVector(TYPEOF(RHS), nrow));
+            SETLENGTH(dtnames, LENGTH(dtnames)+1);
+            SETLENGTH(dt, LENGTH(dt)+1);
+            SET_VECTOR_ELT(dt, col-1, target);
+            UNPROTECT(1);
+            SET_STRING_ELT(dtnames, col-1, STRING_ELT(newnames, col-origncol-1));
+        }
+        if (TYPEOF(target)!=TYPEOF(RHS)) error("Type of RHS ('%s') must match LHS ('%s'). To check and coerce would impact performance too much for the fastest cases. Either change the type of the target column, or coerce the RHS of := yourself (e.g. by using 1L instead of 1)", type2char(TYPEOF(RHS)), type2char(TYPEOF(target)));
+        switch(TYPEOF(target)) {
+        case LGLSXP: case INTSXP: {
+            int *t = INTEGER(target);
+            const int *v = INTEGER(RHS);
+            if (perrow) {
+                #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+                for (int g=0; g<ngrp; g++) for (int k=0; k<grpsize[g]; k++) t[growi(g, k)] = v[off[g]+k];
+            } else {
+                #pragma omp parallel for num_threads(nth)
+                for (i=0; i<grpn; i++) t[(irowslen == -1) ? i : irows[i]-1] = v[grp[i]];
+            }
+        } break;
+        case REALSXP: {
+            double *t = REAL(target);   // integer64 too, bit for bit
+            const double *v = REAL(RHS);
+            if (perrow) {
+                #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+                for (int g=0; g<ngrp; g++) for (int k=0; k<grpsize[g]; k++) t[growi(g, k)] = v[off[g]+k];
+            } else {
+                #pragma omp parallel for num_threads(nth)
+                for (i=0; i<grpn; i++) t[(irowslen == -1) ? i : irows[i]-1] = v[grp[i]];
+            }
+        } break;
+        case CPLXSXP: {
+            Rcomplex *t = COMPLEX(target);
+            const Rcomplex *v = COMPLEX(RHS);
+            if (perrow) {
+                #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+                for (int g=0; g<ngrp; g++) for (int k=0; k<grpsize[g]; k++) t[growi(g, k)] = v[off[g]+k];
+            } else {
+                #pragma omp parallel for num_threads(nth)
+                for (i=0; i<grpn; i++) t[(irowslen == -1) ? i : irows[i]-1] = v[grp[i]];
+            }
+        } break;
+        case STRSXP:
+            // SET_STRING_ELT isn't thread safe (write barrier)
+            if (perrow) for (int g=0; g<ngrp; g++) for (int k=0; k<grpsize[g]; k++) SET_STRING_ELT(target, growi(g, k), STRING_ELT(RHS, off[g]+k));
+            else for (i=0; i<grpn; i++) SET_STRING_ELT(target, (irowslen == -1) ? i : irows[i]-1, STRING_ELT(RHS, grp[i]));
+            break;
+        default:
+            error("Type '%s' not supported by GForce :=. Either add the prefix base:: to the function or turn off GForce optimization using options(datatable.optimize=1)", type2char(TYPEOF(target)));
+        }
+        copyMostAttrib(RHS, target);  // not names, as dogroups
+    }
+    return(dt);
+}
+
+static SEXP gsum_ans(SEXP x, const long double *s)
+// gsum's answer from the sums of the groups: integer for an integer or logical x unless a sum doesn't fit
+{
+    int i;
+    SEXP ans;
+    if (TYPEOF(x) == REALSXP) {
+        ans = PROTECT(allocVector(REALSXP, ngrp));
+        for (i=0; i<ngrp; i++) {
+            if (s[i] > DBL_MAX) REAL(ans)[i] = R_PosInf;
+            else if (s[i] < -DBL_MAX) REAL(ans)[i] = R_NegInf;
+            else REAL(ans)[i] = (double)s[i];
+        }
+    } else {
+        ans = PROTECT(allocVector(INTSXP, ngrp));
+        for (i=0; i<ngrp; i++) {
+            if (s[i] > INT_MAX || s[i] < INT_MIN) {
+                warning("Group %d summed to more than type 'integer' can hold so the result has been coerced to 'numeric' automatically, for convenience.", i+1);
+                UNPROTECT(1);
+                ans = PROTECT(allocVector(REALSXP, ngrp));
+                for (i=0; i<ngrp; i++) REAL(ans)[i] = (double)s[i];
+                break;
+            } else if (ISNA(s[i])) {
+                INTEGER(ans)[i] = NA_INTEGER;
+            } else {
+                INTEGER(ans)[i] = (int)s[i]; 
+            }
+        }
+    }
+    copyMostAttrib(x, ans);
+    UNPROTECT(1);
+    return(ans);
+}
+
+static SEXP gmean_sum(SEXP x, SEXP ans)
+// gmean's answer for na.rm=FALSE from gsum's answer
+{
+    int i, protecti=0;
+    switch(TYPEOF(ans)) {
+    case LGLSXP: case INTSXP:
+        ans = PROTECT(coerceVector(ans, REALSXP)); protecti++;
+        // fall through
+    case REALSXP:
+        for (i=0; i<ngrp; i++) REAL(ans)[i] /= grpsize[i];  // let NA propogate
+        break;
+    default :
+        error("Internal error: gsum returned type '%s'. typeof(x) is '%s'", type2char(TYPEOF(ans)), type2char(TYPEOF(x)));
+    }
+    UNPROTECT(protecti);
+    return(ans);
+}
+
+static SEXP gmean_ans(SEXP x, long double *s, const int *c)
+// gmean's answer for na.rm=TRUE from the sums and counts of the non-NA in each group
+{
+    SEXP ans = PROTECT(allocVector(REALSXP, ngrp));
+    for (int i=0; i<ngrp; i++) {
+        if (c[i]==0) { REAL(ans)[i] = R_NaN; continue; }  // NaN to follow base::mean
+        if (gcomp) { REAL(ans)[i] = (double)s[i] / c[i]; continue; }  // in double, the same on every platform
+        s[i] /= c[i]; 
+        if (s[i] > DBL_MAX) REAL(ans)[i] = R_PosInf;
+        else if (s[i] < -DBL_MAX) REAL(ans)[i] = R_NegInf;
+        else REAL(ans)[i] = (double)s[i];
+    }
+    copyMostAttrib(x, ans);
+    UNPROTECT(1);
+    return(ans);
+}
+
+/* integer64 (bit64) is a REALSXP of long long with NA as NAINT64, so the double kernels would add up its bits. Its sum
+   and prod are exact in long long with a group that overflows NA and a warning, as bit64's; its mean is the long double
+   sum over the count, as bit64's, rounded toward zero back to integer64; min and max compare as long long, and a group
+   with no value left by na.rm=TRUE is bit64's +/-9223372036854775807 with its warning. Each is an integer64 and so is
+   what bit64 gives without GForce. */
+static Rboolean isint64(SEXP x) { return TYPEOF(x) == REALSXP && inherits(x, "integer64"); }
+
+// *t += v and *t *= v, TRUE when the result overflows. NAINT64 (LLONG_MIN) isn't a value, so the range is +/-LLONG_MAX.
+// The compilers without the overflow builtins (gcc before 5) check the operands instead.
+static inline Rboolean i64add(long long *t, long long v)
+{
+#if defined(__clang__) || __GNUC__ >= 5
+    return __builtin_add_overflow(*t, v, t) || *t == NAINT64;
+#else
+    if (v > 0 ? *t > LLONG_MAX-v : *t < -LLONG_MAX-v) return TRUE;
+    *t += v;
+    return FALSE;
+#endif
+}
+
+static inline Rboolean i64mul(long long *t, long long v)
+{
+#if defined(__clang__) || __GNUC__ >= 5
+    return __builtin_mul_overflow(*t, v, t) || *t == NAINT64;
+#else
+    if (*t == 0 || v == 0) { *t = 0; return FALSE; }
+    unsigned long long a = *t < 0 ? -(unsigned long long)*t : (unsigned long long)*t, b = v < 0 ? -(unsigned long long)v : (unsigned long long)v;
+    if (a > LLONG_MAX / b) return TRUE;
+    *t *= v;
+    return FALSE;
+#endif
+}
+
+static SEXP gi64sum(SEXP x, Rboolean narm, char op)
+// op 's' sum, 'm' mean, 'p' prod
+{
+    const long long *xp = (const long long *)REAL(x);
+    SEXP ans = PROTECT(allocVector(REALSXP, ngrp));
+    long long *ansp = (long long *)REAL(ans);
+    int nth = gthreads(grpn), overflow = 0;
+    #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth)) reduction(|:overflow)
+    for (int g=0; g<ngrp; g++) {
+        long long t = (op == 'p') ? 1 : 0;
+        long double m = 0;
+        int cnt = 0, isna = 0, ovf = 0;
+        for (int j=0; j<grpsize[g]; j++) {
+            long long v = xp[growi(g, j)];
+            if (v == NAINT64) { if (narm) continue; isna = 1; break; }
+            cnt++;
+            if (op == 'm') { m += v; continue; }
+            if (!ovf) ovf = (op == 's') ? i64add(&t, v) : i64mul(&t, v);
+        }
+        if (isna) ansp[g] = NAINT64;
+        else if (op == 'm') ansp[g] = cnt ? (long long)(m / cnt) : NAINT64;
+        else if (ovf) { ansp[g] = NAINT64; overflow = 1; }
+        else ansp[g] = t;
+    }
+    if (overflow) warning("NAs produced by integer64 overflow");
+    copyMostAttrib(x, ans);
+    UNPROTECT(1);
+    return(ans);
+}
+
+static SEXP gi64minmax(SEXP x, Rboolean narm, Rboolean ismax)
+{
+    const long long *xp = (const long long *)REAL(x);
+    SEXP ans = PROTECT(allocVector(REALSXP, ngrp));
+    long long *ansp = (long long *)REAL(ans);
+    int nth = gthreads(grpn), empty = 0;
+    #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth)) reduction(|:empty)
+    for (int g=0; g<ngrp; g++) {
+        long long best = 0;
+        int hasval = 0, hasna = 0;
+        for (int j=0; j<grpsize[g]; j++) {
+            long long v = xp[growi(g, j)];
+            if (v == NAINT64) { hasna = 1; continue; }
+            if (!hasval || (ismax ? v > best : v < best)) best = v;
+            hasval = 1;
+        }
+        if (!hasval && narm) { ansp[g] = ismax ? -LLONG_MAX : LLONG_MAX; empty = 1; }  // as bit64's min and max
+        else ansp[g] = (!hasval || (hasna && !narm)) ? NAINT64 : best;
+    }
+    if (empty) warning(ismax ? "no non-NA value, returning the lowest possible integer64 value -9223372036854775807"
+                             : "no non-NA value, returning the highest possible integer64 value +9223372036854775807");
+    copyMostAttrib(x, ans);
+    UNPROTECT(1);
+    return(ans);
+}
+
+static SEXP gi64double(SEXP x)
+// integer64 as double, for the kernels which compute in double anyway (var, sd)
+{
+    R_len_t n = length(x);
+    const long long *xp = (const long long *)REAL(x);
+    SEXP ans = PROTECT(allocVector(REALSXP, n));
+    double *ansp = REAL(ans);
+    for (R_len_t i=0; i<n; i++) ansp[i] = (xp[i] == NAINT64) ? NA_REAL : (double)xp[i];
+    UNPROTECT(1);
+    return(ans);
+}
+
 // long double usage here results in test 648 being failed when running with valgrind
 // http://valgrind.org/docs/manual/manual-core.html#manual-core.limits
 SEXP gsum(SEXP x, SEXP narm)
@@ -73,6 +606,11 @@ SEXP gsum(SEXP x, SEXP narm)
     if (!isLogical(narm) || LENGTH(narm)!=1 || LOGICAL(narm)[0]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
     if (!isVectorAtomic(x)) error("GForce sum can only be applied to columns, not .SD or similar. To sum all items in a list such as .SD, either add the prefix base::sum(.SD) or turn off GForce optimization using options(datatable.optimize=1). More likely, you may be looking for 'DT[,lapply(.SD,sum),by=,.SDcols=]'");
     if (inherits(x, "factor")) error("sum is not meaningful for factors.");
+    if (isint64(x)) {
+        int n = (irowslen == -1) ? length(x) : irowslen;
+        if (grpn != n) error("grpn [%d] != length(x) [%d] in gsum", grpn, n);
+        return (gi64sum(x, LOGICAL(narm)[0], 's'));
+    }
     int i, ix, thisgrp;
     int n = (irowslen == -1) ? length(x) : irowslen;
     //clock_t start = clock();
@@ -81,9 +619,13 @@ SEXP gsum(SEXP x, SEXP narm)
     long double *s = malloc(ngrp * sizeof(long double));
     if (!s) error("Unable to allocate %d * %d bytes for gsum", ngrp, sizeof(long double));
     memset(s, 0, ngrp * sizeof(long double)); // all-0 bits == (long double)0, checked in init.c
+    int nth = gthreads(n);
     switch(TYPEOF(x)) {
     case LGLSXP: case INTSXP:
-        for (i=0; i<n; i++) {
+        if (gcomp) icompsum(INTEGER(x), LOGICAL(narm)[0], s, NULL, nth);
+        else if (nth > 1 || gsegmented(nth)) {
+            if (!isum(INTEGER(x), LOGICAL(narm)[0], s, NULL, nth)) { free(s); error("Unable to allocate working memory for %d threads in gsum", nth); }
+        } else for (i=0; i<n; i++) {
             thisgrp = grp[i];
             ix = (irowslen == -1) ? i : irows[i]-1;
             if(INTEGER(x)[ix] == NA_INTEGER) { 
@@ -92,41 +634,23 @@ SEXP gsum(SEXP x, SEXP narm)
             }
             s[thisgrp] += INTEGER(x)[ix];  // no under/overflow here, s is long double (like base)
         }
-        ans = PROTECT(allocVector(INTSXP, ngrp));
-        for (i=0; i<ngrp; i++) {
-            if (s[i] > INT_MAX || s[i] < INT_MIN) {
-                warning("Group %d summed to more than type 'integer' can hold so the result has been coerced to 'numeric' automatically, for convenience.", i+1);
-                UNPROTECT(1);
-                ans = PROTECT(allocVector(REALSXP, ngrp));
-                for (i=0; i<ngrp; i++) REAL(ans)[i] = (double)s[i];
-                break;
-            } else if (ISNA(s[i])) {
-                INTEGER(ans)[i] = NA_INTEGER;
-            } else {
-                INTEGER(ans)[i] = (int)s[i]; 
-            }
-        }
         break;
     case REALSXP:
-        ans = PROTECT(allocVector(REALSXP, ngrp));
-        for (i=0; i<n; i++) {
+        if (gcomp) dcompsum(REAL(x), LOGICAL(narm)[0], s, NULL, nth);
+        else if (nth > 1 || gsegmented(nth)) dsum(REAL(x), LOGICAL(narm)[0], s, NULL, nth);
+        else for (i=0; i<n; i++) {
             thisgrp = grp[i];
             ix = (irowslen == -1) ? i : irows[i]-1;
             if(ISNAN(REAL(x)[ix]) && LOGICAL(narm)[0]) continue;  // else let NA_REAL propogate from here
             s[thisgrp] += REAL(x)[ix];  // done in long double, like base
         }
-        for (i=0; i<ngrp; i++) {
-            if (s[i] > DBL_MAX) REAL(ans)[i] = R_PosInf;
-            else if (s[i] < -DBL_MAX) REAL(ans)[i] = R_NegInf;
-            else REAL(ans)[i] = (double)s[i];
-        }
         break;
     default:
         free(s);
         error("Type '%s' not supported by GForce sum (gsum). Either add the prefix base::sum(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(TYPEOF(x)));
     }
+    ans = PROTECT(gsum_ans(x, s));
     free(s);
-    copyMostAttrib(x, ans);
     UNPROTECT(1);
     // Rprintf("this gsum took %8.3f\n", 1.0*(clock()-start)/CLOCKS_PER_SEC);
     return(ans);
@@ -140,17 +664,14 @@ SEXP gmean(SEXP x, SEXP narm)
     if (!isLogical(narm) || LENGTH(narm)!=1 || LOGICAL(narm)[0]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
     if (!isVectorAtomic(x)) error("GForce mean can only be applied to columns, not .SD or similar. Likely you're looking for 'DT[,lapply(.SD,mean),by=,.SDcols=]'. See ?data.table.");
     if (inherits(x, "factor")) error("mean is not meaningful for factors.");
+    if (isint64(x)) {
+        n = (irowslen == -1) ? length(x) : irowslen;
+        if (grpn != n) error("grpn [%d] != length(x) [%d] in gmean", grpn, n);
+        return (gi64sum(x, LOGICAL(narm)[0], 'm'));
+    }
     if (!LOGICAL(narm)[0]) {
         ans = PROTECT(gsum(x,narm)); protecti++;
-        switch(TYPEOF(ans)) {
-        case LGLSXP: case INTSXP:
-            ans = PROTECT(coerceVector(ans, REALSXP)); protecti++;
-        case REALSXP:
-            for (i=0; i<ngrp; i++) REAL(ans)[i] /= grpsize[i];  // let NA propogate
-            break;
-        default :
-            error("Internal error: gsum returned type '%s'. typeof(x) is '%s'", type2char(TYPEOF(ans)), type2char(TYPEOF(x)));
-        }
+        ans = gmean_sum(x, ans);
         UNPROTECT(protecti);
         return(ans);
     }
@@ -165,10 +686,14 @@ SEXP gmean(SEXP x, SEXP narm)
     int *c = malloc(ngrp * sizeof(int));
     if (!c) error("Unable to allocate %d * %d bytes for counts in gmean na.rm=TRUE", ngrp, sizeof(int));
     memset(c, 0, ngrp * sizeof(int)); // all-0 bits == (int)0, checked in init.c
-        
+    int nth = gthreads(n);
+
     switch(TYPEOF(x)) {
     case LGLSXP: case INTSXP:
-        for (i=0; i<n; i++) {
+        if (gcomp) icompsum(INTEGER(x), TRUE, s, c, nth);
+        else if (nth > 1 || gsegmented(nth)) {
+            if (!isum(INTEGER(x), TRUE, s, c, nth)) { free(s); free(c); error("Unable to allocate working memory for %d threads in gmean", nth); }
+        } else for (i=0; i<n; i++) {
             thisgrp = grp[i];
             ix = (irowslen == -1) ? i : irows[i]-1;
             if(INTEGER(x)[ix] == NA_INTEGER) continue;
@@ -177,7 +702,9 @@ SEXP gmean(SEXP x, SEXP narm)
         }
         break;
     case REALSXP:
-        for (i=0; i<n; i++) {
+        if (gcomp) dcompsum(REAL(x), TRUE, s, c, nth);
+        else if (nth > 1 || gsegmented(nth)) dsum(REAL(x), TRUE, s, c, nth);
+        else for (i=0; i<n; i++) {
             thisgrp = grp[i];
             ix = (irowslen == -1) ? i : irows[i]-1;
             if (ISNAN(REAL(x)[ix])) continue;
@@ -189,36 +716,175 @@ SEXP gmean(SEXP x, SEXP narm)
         free(s); free(c);
         error("Type '%s' not supported by GForce mean (gmean) na.rm=TRUE. Either add the prefix base::mean(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(TYPEOF(x)));
     }
-    ans = PROTECT(allocVector(REALSXP, ngrp));
-    for (i=0; i<ngrp; i++) {
-        if (c[i]==0) { REAL(ans)[i] = R_NaN; continue; }  // NaN to follow base::mean
-        s[i] /= c[i]; 
-        if (s[i] > DBL_MAX) REAL(ans)[i] = R_PosInf;
-        else if (s[i] < -DBL_MAX) REAL(ans)[i] = R_NegInf;
-        else REAL(ans)[i] = (double)s[i];
-    }
+    ans = PROTECT(gmean_ans(x, s, c));
     free(s); free(c);
-    copyMostAttrib(x, ans);
     UNPROTECT(1);
     // Rprintf("this gmean na.rm=TRUE took %8.3f\n", 1.0*(clock()-start)/CLOCKS_PER_SEC);
     return(ans);
 }
 
+/* Fused sum and mean. lapply(.SD, sum) over many columns would otherwise be a gsum per column, each reading grp and irows
+   and walking all the rows again. gforce() takes the columns with the function and na.rm of each and streams the rows in
+   blocks, reading each block's groups and rows once for all the columns. Each column is still added up in row order, so
+   its answer is exactly gsum's or gmean's. The columns are taken a wave at a time to bound the accumulators' memory and
+   the threads take a share of each wave's columns each. */
+#define GBLOCK 2048                   // rows per block; their group ids and rows stay in L1 while each column is done
+#define GTILE_BYTES (1024*1024)       // accumulators of the columns fused together stay in L2 while their groups are hit at random
+#define GWAVE_BYTES (64*1024*1024)    // accumulators of the columns done together
+
+static int gfit(size_t bytes, int ncol)
+// How many columns' accumulators fit in bytes; at least 1, at most ncol
+{
+    size_t fit = bytes / ((size_t)(ngrp ? ngrp : 1) * (sizeof(long double)+sizeof(int)));
+    return fit < 1 ? 1 : (fit < (size_t)ncol ? (int)fit : ncol);
+}
+
+static void gfused(const void **xp, const char *isint, const char *narm, const char *cnt, int ncol, long double *s, int *c)
+// Adds up ncol columns into s and, where cnt, counts their non-NA into c (each ngrp long, one column after another). Single threaded.
+// Columns are taken a tile at a time so that with many groups this is no worse than one column at a time.
+{
+    int gi[GBLOCK], ri[GBLOCK];
+    int tile = gfit(GTILE_BYTES, ncol);
+    for (int t0=0; t0<ncol; t0+=tile) {
+        int nt = MIN(tile, ncol-t0);
+        for (int b0=0; b0<grpn; b0+=GBLOCK) {
+            int nb = MIN(GBLOCK, grpn-b0);
+            for (int i=0; i<nb; i++) { gi[i] = grp[b0+i]; ri[i] = (irowslen == -1) ? b0+i : irows[b0+i]-1; }
+            for (int j=t0; j<t0+nt; j++) {
+                long double *thiss = s + (size_t)j*ngrp;
+                int *thisc = c + (size_t)j*ngrp;
+                const Rboolean thisnarm = narm[j];  // a local, else it's reloaded after each store through thiss
+                if (cnt[j]) {
+                    // only mean(na.rm=TRUE) needs the count; its NA are always skipped
+                    if (isint[j]) {
+                        const int *x = xp[j];
+                        for (int i=0; i<nb; i++) { int v = x[ri[i]]; if (v == NA_INTEGER) continue; thiss[gi[i]] += v; thisc[gi[i]]++; }
+                    } else {
+                        const double *x = xp[j];
+                        for (int i=0; i<nb; i++) { double v = x[ri[i]]; if (ISNAN(v)) continue; thiss[gi[i]] += v; thisc[gi[i]]++; }
+                    }
+                } else if (isint[j]) {
+                    const int *x = xp[j];
+                    for (int i=0; i<nb; i++) {
+                        int v = x[ri[i]];
+                        if (v == NA_INTEGER) { if (!thisnarm) thiss[gi[i]] = NA_REAL; continue; }  // as gsum
+                        thiss[gi[i]] += v;
+                    }
+                } else {
+                    const double *x = xp[j];
+                    for (int i=0; i<nb; i++) {
+                        double v = x[ri[i]];
+                        if (ISNAN(v) && thisnarm) continue;  // else NA_REAL propogates, with the same payload as gsum
+                        thiss[gi[i]] += v;
+                    }
+                }
+            }
+        }
+    }
+}
+
+SEXP gforce(SEXP x, SEXP funArg, SEXP narmArg)
+{
+    if (!isNewList(x)) error("Internal error: x to gforce is type '%s' not list", type2char(TYPEOF(x)));
+    int ncol = LENGTH(x);
+    if (!isString(funArg) || LENGTH(funArg)!=ncol) error("Internal error: fun to gforce must be a character vector the length of x");
+    if (!isLogical(narmArg) || LENGTH(narmArg)!=ncol) error("Internal error: na.rm to gforce must be a logical vector the length of x");
+    int n = (irowslen == -1) ? (ncol ? length(VECTOR_ELT(x, 0)) : 0) : irowslen;
+    if (grpn != n) error("grpn [%d] != length(x) [%d] in gforce", grpn, n);
+    const void **xp = (const void **)R_alloc(ncol, sizeof(void *));
+    char *isint = R_alloc(ncol, sizeof(char)), *narm = R_alloc(ncol, sizeof(char)), *ismean = R_alloc(ncol, sizeof(char)), *cnt = R_alloc(ncol, sizeof(char));
+    for (int j=0; j<ncol; j++) {
+        SEXP thisx = VECTOR_ELT(x, j);
+        const char *fun = CHAR(STRING_ELT(funArg, j));
+        if (strcmp(fun, "sum") && strcmp(fun, "mean")) error("Internal error: gforce does sum and mean only, not '%s'", fun);
+        if (LOGICAL(narmArg)[j]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
+        if ((TYPEOF(thisx)!=LGLSXP && TYPEOF(thisx)!=INTSXP && TYPEOF(thisx)!=REALSXP) || inherits(thisx, "factor") || isint64(thisx))
+            error("Internal error: gforce was passed column %d of type '%s'; only integer, logical and double (not integer64) are fused", j+1, isint64(thisx) ? "integer64" : type2char(TYPEOF(thisx)));
+        if ((irowslen == -1 ? length(thisx) : irowslen) != n) error("Internal error: column %d of gforce is length %d not %d", j+1, length(thisx), n);
+        isint[j] = TYPEOF(thisx) != REALSXP;
+        xp[j] = isint[j] ? (const void *)INTEGER(thisx) : (const void *)REAL(thisx);
+        narm[j] = LOGICAL(narmArg)[j];
+        ismean[j] = fun[0]=='m';
+        cnt[j] = ismean[j] && narm[j];
+    }
+    SEXP ans = PROTECT(allocVector(VECSXP, ncol));
+    int nth = gthreads(n);
+    if ((nth == 1 && gfit(GTILE_BYTES, ncol) == 1) || gsegmented(nth) || gcomp) {
+        // so many groups that no two columns share the cache, or the groups are runs that gsum and gmean stream through
+        // without grp, or compensated sums which go group by group: nothing to gain over a column at a time
+        for (int j=0; j<ncol; j++) {
+            SEXP thisnarm = PROTECT(ScalarLogical(narm[j]));
+            SET_VECTOR_ELT(ans, j, ismean[j] ? gmean(VECTOR_ELT(x, j), thisnarm) : gsum(VECTOR_ELT(x, j), thisnarm));
+            UNPROTECT(1);
+        }
+        UNPROTECT(1);
+        return(ans);
+    }
+    // a tile of columns per thread is all a wave needs; more would only leave the accumulators cold by the time they're finished
+    int wave = MIN(gfit(GWAVE_BYTES, ncol), nth*gfit(GTILE_BYTES, ncol));
+    if (wave < 1) wave = 1;
+    long double *s = malloc((size_t)wave*ngrp * sizeof(long double));
+    int *c = malloc((size_t)wave*ngrp * sizeof(int));
+    if ((!s || !c) && ngrp) { free(s); free(c); error("Unable to allocate %d * %d bytes for gforce", wave*ngrp, sizeof(long double)+sizeof(int)); }
+    for (int w0=0; w0<ncol; w0+=wave) {
+        int nw = MIN(wave, ncol-w0);
+        memset(s, 0, (size_t)nw*ngrp * sizeof(long double)); // all-0 bits == (long double)0, checked in init.c
+        memset(c, 0, (size_t)nw*ngrp * sizeof(int));
+        if (nth > 1 && nw < nth) {
+            // fewer columns than threads: the columns one by one, each with all the threads (isum and dsum)
+            for (int j=0; j<nw; j++) {
+                long double *thiss = s + (size_t)j*ngrp;
+                int *thisc = c + (size_t)j*ngrp;
+                if (!isint[w0+j]) dsum(xp[w0+j], narm[w0+j], thiss, cnt[w0+j] ? thisc : NULL, nth);
+                else if (!isum(xp[w0+j], narm[w0+j], thiss, cnt[w0+j] ? thisc : NULL, nth)) { free(s); free(c); error("Unable to allocate working memory for %d threads in gforce", nth); }
+            }
+        } else {
+            int per = (nw-1)/nth + 1;            // columns per thread
+            int nchunk = (nw-1)/per + 1;
+            #pragma omp parallel for num_threads(nth) schedule(dynamic)
+            for (int ch=0; ch<nchunk; ch++) {
+                int from = w0 + ch*per, thisn = MIN(per, w0+nw-from);
+                gfused(xp+from, isint+from, narm+from, cnt+from, thisn, s + (size_t)(from-w0)*ngrp, c + (size_t)(from-w0)*ngrp);
+            }
+        }
+        for (int j=0; j<nw; j++) {
+            SEXP thisx = VECTOR_ELT(x, w0+j);
+            long double *thiss = s + (size_t)j*ngrp;
+            if (ismean[w0+j] && narm[w0+j]) SET_VECTOR_ELT(ans, w0+j, gmean_ans(thisx, thiss, c + (size_t)j*ngrp));
+            else {
+                SET_VECTOR_ELT(ans, w0+j, gsum_ans(thisx, thiss));
+                if (ismean[w0+j]) SET_VECTOR_ELT(ans, w0+j, gmean_sum(thisx, VECTOR_ELT(ans, w0+j)));
+            }
+        }
+    }
+    free(s); free(c);
+    UNPROTECT(1);
+    return(ans);
+}
+
 // gmin
 SEXP gmin(SEXP x, SEXP narm)
 {
     if (!isLogical(narm) || LENGTH(narm)!=1 || LOGICAL(narm)[0]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
     if (!isVectorAtomic(x)) error("GForce min can only be applied to columns, not .SD or similar. To find min of all items in a list such as .SD, either add the prefix base::min(.SD) or turn off GForce optimization using options(datatable.optimize=1). More likely, you may be looking for 'DT[,lapply(.SD,min),by=,.SDcols=]'");
     if (inherits(x, "factor")) error("min is not meaningful for factors.");
+    if (isint64(x)) {
+        int n = (irowslen == -1) ? length(x) : irowslen;
+        if (grpn != n) error("grpn [%d] != length(x) [%d] in gmin", grpn, n);
+        return (gi64minmax(x, LOGICAL(narm)[0], FALSE));
+    }
     R_len_t i, ix, thisgrp=0;
     int n = (irowslen == -1) ? length(x) : irowslen;
     //clock_t start = clock();
     SEXP ans;
     if (grpn != n) error("grpn [%d] != length(x) [%d] in gmin", grpn, n);
+    int nth = gthreads(n);
     switch(TYPEOF(x)) {
     case LGLSXP: case INTSXP:
         ans = PROTECT(allocVector(INTSXP, ngrp));
-        if (!LOGICAL(narm)[0]) {
+        if (nth > 1 || gsegmented(nth)) {
+            if (!iminmax(INTEGER(x), LOGICAL(narm)[0], FALSE, INTEGER(ans), NULL, nth)) error("Unable to allocate working memory for %d threads in gmin", nth);
+        } else if (!LOGICAL(narm)[0]) {
             for (i=0; i<ngrp; i++) INTEGER(ans)[i] = INT_MAX;
             for (i=0; i<n; i++) {
                 thisgrp = grp[i];
@@ -235,6 +901,8 @@ SEXP gmin(SEXP x, SEXP narm)
                 if (INTEGER(ans)[thisgrp] == NA_INTEGER || INTEGER(x)[ix] < INTEGER(ans)[thisgrp])
                     INTEGER(ans)[thisgrp] = INTEGER(x)[ix];
             }
+        }
+        if (LOGICAL(narm)[0]) {
             for (i=0; i<ngrp; i++) {
                 if (INTEGER(ans)[i] == NA_INTEGER) {
                     warning("No non-missing values found in at least one group. Coercing to numeric type and returning 'Inf' for such groups to be consistent with base");
@@ -285,7 +953,20 @@ SEXP gmin(SEXP x, SEXP narm)
         break;
     case REALSXP:
         ans = PROTECT(allocVector(REALSXP, ngrp));
-        if (!LOGICAL(narm)[0]) {    
+        if (nth > 1 || gsegmented(nth)) {
+            const double *xd = REAL(x);
+            double *ad = REAL(ans);
+            Rboolean narm0 = LOGICAL(narm)[0];
+            #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+            for (int g=0; g<ngrp; g++) {                                 // as the single threaded rules below, group by group
+                double a = narm0 ? NA_REAL : R_PosInf;
+                for (int j=0; j<grpsize[g]; j++) {
+                    double v = xd[growi(g, j)];
+                    if (narm0 ? (!ISNAN(v) && (ISNAN(a) || v < a)) : (ISNAN(v) || v < a)) a = v;
+                }
+                ad[g] = a;
+            }
+        } else if (!LOGICAL(narm)[0]) {    
             for (i=0; i<ngrp; i++) REAL(ans)[i] = R_PosInf;
             for (i=0; i<n; i++) {
                 thisgrp = grp[i];
@@ -302,6 +983,8 @@ SEXP gmin(SEXP x, SEXP narm)
                 if (ISNAN(REAL(ans)[thisgrp]) || REAL(x)[ix] < REAL(ans)[thisgrp])
                     REAL(ans)[thisgrp] = REAL(x)[ix];
             }
+        }
+        if (LOGICAL(narm)[0]) {
             for (i=0; i<ngrp; i++) {
                 if (ISNAN(REAL(ans)[i])) {
                     warning("No non-missing values found in at least one group. Returning 'Inf' for such groups to be consistent with base");
@@ -326,11 +1009,17 @@ SEXP gmax(SEXP x, SEXP narm)
     if (!isLogical(narm) || LENGTH(narm)!=1 || LOGICAL(narm)[0]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
     if (!isVectorAtomic(x)) error("GForce max can only be applied to columns, not .SD or similar. To find max of all items in a list such as .SD, either add the prefix base::max(.SD) or turn off GForce optimization using options(datatable.optimize=1). More likely, you may be looking for 'DT[,lapply(.SD,max),by=,.SDcols=]'");
     if (inherits(x, "factor")) error("max is not meaningful for factors.");
+    if (isint64(x)) {
+        int n = (irowslen == -1) ? length(x) : irowslen;
+        if (grpn != n) error("grpn [%d] != length(x) [%d] in gmax", grpn, n);
+        return (gi64minmax(x, LOGICAL(narm)[0], TRUE));
+    }
     R_len_t i, ix, thisgrp=0;
     int n = (irowslen == -1) ? length(x) : irowslen;
     //clock_t start = clock();
     SEXP ans;
     if (grpn != n) error("grpn [%d] != length(x) [%d] in gmax", grpn, n);
+    int nth = gthreads(n);
     
     // TODO rework gmax in the same way as gmin and remove this *update
     char *update = (char *)R_alloc(ngrp, sizeof(char));
@@ -340,7 +1029,9 @@ SEXP gmax(SEXP x, SEXP narm)
     case LGLSXP: case INTSXP:
         ans = PROTECT(allocVector(INTSXP, ngrp));
         for (i=0; i<ngrp; i++) INTEGER(ans)[i] = 0;
-        if (!LOGICAL(narm)[0]) { // simple case - deal in a straightforward manner first
+        if (nth > 1 || gsegmented(nth)) {
+            if (!iminmax(INTEGER(x), LOGICAL(narm)[0], TRUE, INTEGER(ans), update, nth)) error("Unable to allocate working memory for %d threads in gmax", nth);
+        } else if (!LOGICAL(narm)[0]) { // simple case - deal in a straightforward manner first
             for (i=0; i<n; i++) {
                 thisgrp = grp[i];
                 ix = (irowslen == -1) ? i : irows[i]-1;
@@ -366,6 +1057,8 @@ SEXP gmax(SEXP x, SEXP narm)
                     }
                 }
             }
+        }
+        if (LOGICAL(narm)[0]) {
             for (i=0; i<ngrp; i++) {
                 if (update[i] != 1)  {// equivalent of INTEGER(ans)[thisgrp] == NA_INTEGER
                     warning("No non-missing values found in at least one group. Coercing to numeric type and returning 'Inf' for such groups to be consistent with base");
@@ -419,7 +1112,30 @@ SEXP gmax(SEXP x, SEXP narm)
     case REALSXP:
         ans = PROTECT(allocVector(REALSXP, ngrp));
         for (i=0; i<ngrp; i++) REAL(ans)[i] = 0;
-        if (!LOGICAL(narm)[0]) {
+        if (nth > 1 || gsegmented(nth)) {
+            const double *xd = REAL(x);
+            double *ad = REAL(ans);
+            Rboolean narm0 = LOGICAL(narm)[0];
+            #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+            for (int g=0; g<ngrp; g++) {                                 // as the single threaded rules below, group by group
+                double a = 0;
+                char up = 0;
+                for (int j=0; j<grpsize[g]; j++) {
+                    double v = xd[growi(g, j)];
+                    if (!narm0) {
+                        if (!ISNA(v) && !ISNA(a)) {
+                            if (up != 1 || a < v || (ISNAN(v) && !ISNAN(a))) { a = v; up = 1; }
+                        } else a = NA_REAL;
+                    } else {
+                        if (!ISNAN(v)) {
+                            if (up != 1 || a < v) { a = v; up = 1; }
+                        } else if (up != 1) a = -R_PosInf;
+                    }
+                }
+                ad[g] = a;
+                update[g] = up;
+            }
+        } else if (!LOGICAL(narm)[0]) {
             for (i=0; i<n; i++) {
                 thisgrp = grp[i];
                 ix = (irowslen == -1) ? i : irows[i]-1;
@@ -446,6 +1162,8 @@ SEXP gmax(SEXP x, SEXP narm)
                     }
                 }
             }
+        }
+        if (LOGICAL(narm)[0]) {
             // everything taken care of already. Just warn if all NA groups have occurred at least once
             for (i=0; i<ngrp; i++) {
                 if (update[i] != 1)  { // equivalent of REAL(ans)[thisgrp] == -R_PosInf
@@ -638,6 +1356,81 @@ SEXP gmedian(SEXP x, SEXP narm) {
     return(ans);
 }
 
+static void gmultiselect(double *x, int from, int to, const int *k, int nk)
+// Puts x[k[i]] in its sorted place for each of the nk increasing k in [from, to). A quickselect of the middle k leaves
+// the smaller to its left and the larger to its right, so the ks below and above it are found in those parts alone.
+{
+    if (nk == 0 || to-from <= 1) return;
+    int mid = nk/2;
+    dquickselect(x+from, to-from, k[mid]-from);
+    gmultiselect(x, from, k[mid], k, mid);
+    gmultiselect(x, k[mid]+1, to, k+mid+1, nk-mid-1);
+}
+
+SEXP gquantile(SEXP x, SEXP probsArg, SEXP narmArg)
+// stats::quantile(x, probs, type=7) of each group, the length(probs) values of each group one group after another.
+// All the order statistics the probs need are found in one multi-select over a copy of the group's values.
+{
+    if (!isLogical(narmArg) || LENGTH(narmArg)!=1 || LOGICAL(narmArg)[0]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
+    if (!isReal(probsArg) || !LENGTH(probsArg)) error("Internal error: probs to gquantile must be a non-empty double vector");
+    if (!isVectorAtomic(x)) error("GForce quantile can only be applied to columns, not .SD or similar. Either add the prefix stats::quantile(.) or turn off GForce optimization using options(datatable.optimize=1)");
+    if (inherits(x, "factor")) error("factors are not allowed");
+    if ((TYPEOF(x)!=LGLSXP && TYPEOF(x)!=INTSXP && TYPEOF(x)!=REALSXP) || isint64(x))
+        error("Type '%s' not supported by GForce quantile (gquantile). Either add the prefix stats::quantile(.) or turn off GForce optimization using options(datatable.optimize=1)", isint64(x) ? "integer64" : type2char(TYPEOF(x)));
+    Rboolean narm = LOGICAL(narmArg)[0];
+    int k = LENGTH(probsArg), n = (irowslen == -1) ? length(x) : irowslen;
+    if (grpn != n) error("grpn [%d] != length(x) [%d] in gquantile", grpn, n);
+    double *probs = (double *)R_alloc(k, sizeof(double)), eps = 100*DBL_EPSILON;
+    for (int p=0; p<k; p++) {
+        double v = REAL(probsArg)[p];
+        if (ISNAN(v) || v < -eps || v > 1+eps) error("'probs' outside [0,1]");
+        probs[p] = v < 0 ? 0 : (v > 1 ? 1 : v);
+    }
+    SEXP ans = PROTECT(allocVector(REALSXP, (R_xlen_t)ngrp*k));
+    double *ansp = REAL(ans);
+    const int *xi = TYPEOF(x)==REALSXP ? NULL : INTEGER(x);
+    const double *xd = xi ? NULL : REAL(x);
+    int nth = gthreads(n), hasna = 0;
+    // each thread's copy of a group and the order statistics (0-based) that group needs, lo and hi of each prob
+    double *buf = malloc((size_t)nth*maxgrpn * sizeof(double) + 1);
+    int *kbuf = malloc((size_t)nth*2*k * sizeof(int));
+    if (!buf || !kbuf) { free(buf); free(kbuf); error("Unable to allocate %d * %d bytes for gquantile", nth, maxgrpn*(int)sizeof(double) + 2*k*(int)sizeof(int)); }
+    #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth)) reduction(|:hasna)
+    for (int g=0; g<ngrp; g++) {
+        double *b = buf + (size_t)omp_get_thread_num()*maxgrpn, *a = ansp + (size_t)g*k;
+        int *ks = kbuf + (size_t)omp_get_thread_num()*2*k, m = 0, nk = 0;
+        for (int j=0; j<grpsize[g]; j++) {
+            int r = growi(g, j);
+            double v = xi ? (xi[r]==NA_INTEGER ? NA_REAL : xi[r]) : xd[r];
+            if (ISNAN(v)) { if (!narm) { hasna = 1; break; } continue; }
+            b[m++] = v;
+        }
+        if (hasna && !narm) continue;   // error below
+        if (m == 0) { for (int p=0; p<k; p++) a[p] = NA_REAL; continue; }
+        for (int p=0; p<k; p++) {
+            double index = 1 + (m-1)*probs[p];
+            ks[nk++] = (int)floor(index)-1;
+            ks[nk++] = (int)ceil(index)-1;
+        }
+        // sort and uniq the few ks (insertion sort)
+        for (int i=1; i<nk; i++) { int t = ks[i], j = i; while (j>0 && ks[j-1] > t) { ks[j] = ks[j-1]; j--; } ks[j] = t; }
+        int nu = 0;
+        for (int i=0; i<nk; i++) if (!nu || ks[i] != ks[nu-1]) ks[nu++] = ks[i];
+        gmultiselect(b, 0, m, ks, nu);
+        for (int p=0; p<k; p++) {
+            // as quantile.default type 7, to the bit
+            double index = 1 + (m-1)*probs[p], lo = floor(index), qs = b[(int)lo-1], hi = b[(int)ceil(index)-1];
+            if (index > lo && hi != qs) { double h = index - lo; qs = (1-h)*qs + h*hi; }
+            a[p] = qs;
+        }
+    }
+    free(buf); free(kbuf);
+    if (hasna) error("missing values and NaN's not allowed if 'na.rm' is FALSE");
+    if (TYPEOF(x) == REALSXP) copyMostAttrib(x, ans);   // Date and POSIXct, as quantile gives
+    UNPROTECT(1);
+    return(ans);
+}
+
 SEXP glast(SEXP x) {
 
     if (!isVectorAtomic(x)) error("GForce tail can only be applied to columns, not .SD or similar. To get tail of all items in a list such as .SD, either add the prefix utils::tail(.SD) or turn off GForce optimization using options(datatable.optimize=1).");
@@ -645,10 +1438,12 @@ SEXP glast(SEXP x) {
     R_len_t i,k;
     int n = (irowslen == -1) ? length(x) : irowslen;
     SEXP ans;
+    int nth = (ngrp < N_PAR) ? 1 : getDTthreads();  // just a gather; strings and lists stay single threaded (SET_STRING_ELT)
     if (grpn != n) error("grpn [%d] != length(x) [%d] in gtail", grpn, n);
     switch(TYPEOF(x)) {
     case LGLSXP: 
         ans = PROTECT(allocVector(LGLSXP, ngrp));
+        #pragma omp parallel for num_threads(nth) private(k)
         for (i=0; i<ngrp; i++) {
             k = ff[i]+grpsize[i]-2;
             if (isunsorted) k = oo[k]-1;
@@ -658,6 +1453,7 @@ SEXP glast(SEXP x) {
     break;
     case INTSXP:
         ans = PROTECT(allocVector(INTSXP, ngrp));
+        #pragma omp parallel for num_threads(nth) private(k)
         for (i=0; i<ngrp; i++) {
             k = ff[i]+grpsize[i]-2;
             if (isunsorted) k = oo[k]-1;            
@@ -667,6 +1463,7 @@ SEXP glast(SEXP x) {
     break;
     case REALSXP:
         ans = PROTECT(allocVector(REALSXP, ngrp));
+        #pragma omp parallel for num_threads(nth) private(k)
         for (i=0; i<ngrp; i++) {
             k = ff[i]+grpsize[i]-2;
             if (isunsorted) k = oo[k]-1;            
@@ -707,10 +1504,12 @@ SEXP gfirst(SEXP x) {
     R_len_t i,k;
     int n = (irowslen == -1) ? length(x) : irowslen;
     SEXP ans;
+    int nth = (ngrp < N_PAR) ? 1 : getDTthreads();  // just a gather; strings and lists stay single threaded (SET_STRING_ELT)
     if (grpn != n) error("grpn [%d] != length(x) [%d] in ghead", grpn, n);
     switch(TYPEOF(x)) {
     case LGLSXP: 
         ans = PROTECT(allocVector(LGLSXP, ngrp));
+        #pragma omp parallel for num_threads(nth) private(k)
         for (i=0; i<ngrp; i++) {
             k = ff[i]-1;
             if (isunsorted) k = oo[k]-1;
@@ -720,6 +1519,7 @@ SEXP gfirst(SEXP x) {
     break;
     case INTSXP:
         ans = PROTECT(allocVector(INTSXP, ngrp));
+        #pragma omp parallel for num_threads(nth) private(k)
         for (i=0; i<ngrp; i++) {
             k = ff[i]-1;
             if (isunsorted) k = oo[k]-1;
@@ -729,6 +1529,7 @@ SEXP gfirst(SEXP x) {
     break;
     case REALSXP:
         ans = PROTECT(allocVector(REALSXP, ngrp));
+        #pragma omp parallel for num_threads(nth) private(k)
         for (i=0; i<ngrp; i++) {
             k = ff[i]-1;
             if (isunsorted) k = oo[k]-1;
@@ -762,14 +1563,72 @@ SEXP gfirst(SEXP x) {
     return(ans);
 }
 
+static SEXP gheadtail(SEXP x, int val, Rboolean head)
+// The first (head) or last val items of each group, min(val, group size) of them, one group after another
+{
+    int g, n = (irowslen == -1) ? length(x) : irowslen;
+    if (grpn != n) error("grpn [%d] != length(x) [%d] in %s", grpn, n, head ? "ghead" : "gtail");
+    int *off = (int *)R_alloc(ngrp+1, sizeof(int));   // where each group's items start in ans
+    off[0] = 0;
+    for (g=0; g<ngrp; g++) off[g+1] = off[g] + MIN(val, grpsize[g]);
+    SEXP ans = PROTECT(allocVector(TYPEOF(x), off[ngrp]));
+    int nth = gthreads(off[ngrp]);
+    switch(TYPEOF(x)) {
+    case LGLSXP: case INTSXP: {
+        const int *xp = INTEGER(x);
+        int *ap = INTEGER(ans);
+        #pragma omp parallel for num_threads(nth)
+        for (g=0; g<ngrp; g++) {
+            int m = off[g+1]-off[g], from = head ? 0 : grpsize[g]-m;
+            for (int j=0; j<m; j++) ap[off[g]+j] = xp[growi(g, from+j)];
+        }
+    } break;
+    case REALSXP: {
+        const double *xp = REAL(x);
+        double *ap = REAL(ans);
+        #pragma omp parallel for num_threads(nth)
+        for (g=0; g<ngrp; g++) {
+            int m = off[g+1]-off[g], from = head ? 0 : grpsize[g]-m;
+            for (int j=0; j<m; j++) ap[off[g]+j] = xp[growi(g, from+j)];
+        }
+    } break;
+    case CPLXSXP: {
+        const Rcomplex *xp = COMPLEX(x);
+        Rcomplex *ap = COMPLEX(ans);
+        #pragma omp parallel for num_threads(nth)
+        for (g=0; g<ngrp; g++) {
+            int m = off[g+1]-off[g], from = head ? 0 : grpsize[g]-m;
+            for (int j=0; j<m; j++) ap[off[g]+j] = xp[growi(g, from+j)];
+        }
+    } break;
+    case STRSXP:
+        for (g=0; g<ngrp; g++) {
+            int m = off[g+1]-off[g], from = head ? 0 : grpsize[g]-m;
+            for (int j=0; j<m; j++) SET_STRING_ELT(ans, off[g]+j, STRING_ELT(x, growi(g, from+j)));
+        }
+        break;
+    case VECSXP:
+        for (g=0; g<ngrp; g++) {
+            int m = off[g+1]-off[g], from = head ? 0 : grpsize[g]-m;
+            for (int j=0; j<m; j++) SET_VECTOR_ELT(ans, off[g]+j, VECTOR_ELT(x, growi(g, from+j)));
+        }
+        break;
+    default:
+        error("Type '%s' not supported by GForce %s. Either add the prefix utils::%s(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(TYPEOF(x)), head ? "head (ghead)" : "tail (gtail)", head ? "head" : "tail");
+    }
+    copyMostAttrib(x, ans);
+    UNPROTECT(1);
+    return(ans);
+}
+
 SEXP gtail(SEXP x, SEXP valArg) {
-    if (!isInteger(valArg) || LENGTH(valArg)!=1 || INTEGER(valArg)[0]!=1) error("Internal error, gtail is only implemented for n=1. This should have been caught before. Please report to datatable-help.");
-    return (glast(x));
+    if (!isInteger(valArg) || LENGTH(valArg)!=1 || INTEGER(valArg)[0]<1) error("Internal error, gtail is only implemented for n>=1. This should have been caught before. Please report to datatable-help.");
+    return (INTEGER(valArg)[0]==1 ? glast(x) : gheadtail(x, INTEGER(valArg)[0], FALSE));
 }
 
 SEXP ghead(SEXP x, SEXP valArg) {
-    if (!isInteger(valArg) || LENGTH(valArg)!=1 || INTEGER(valArg)[0]!=1) error("Internal error, ghead is only implemented for n=1. This should have been caught before. Please report to datatable-help.");
-    return (gfirst(x));
+    if (!isInteger(valArg) || LENGTH(valArg)!=1 || INTEGER(valArg)[0]<1) error("Internal error, ghead is only implemented for n>=1. This should have been caught before. Please report to datatable-help.");
+    return (INTEGER(valArg)[0]==1 ? gfirst(x) : gheadtail(x, INTEGER(valArg)[0], TRUE));
 }
 
 SEXP gnthvalue(SEXP x, SEXP valArg) {
@@ -778,10 +1637,12 @@ SEXP gnthvalue(SEXP x, SEXP valArg) {
     R_len_t i,k, val=INTEGER(valArg)[0];
     int n = (irowslen == -1) ? length(x) : irowslen;
     SEXP ans;
+    int nth = (ngrp < N_PAR) ? 1 : getDTthreads();  // just a gather; strings and lists stay single threaded (SET_STRING_ELT)
     if (grpn != n) error("grpn [%d] != length(x) [%d] in ghead", grpn, n);
     switch(TYPEOF(x)) {
     case LGLSXP: 
         ans = PROTECT(allocVector(LGLSXP, ngrp));
+        #pragma omp parallel for num_threads(nth) private(k)
         for (i=0; i<ngrp; i++) {
             if (val > grpsize[i]) { LOGICAL(ans)[i] = NA_LOGICAL; continue; }
             k = ff[i]+val-2;
@@ -792,6 +1653,7 @@ SEXP gnthvalue(SEXP x, SEXP valArg) {
     break;
     case INTSXP:
         ans = PROTECT(allocVector(INTSXP, ngrp));
+        #pragma omp parallel for num_threads(nth) private(k)
         for (i=0; i<ngrp; i++) {
             if (val > grpsize[i]) { INTEGER(ans)[i] = NA_INTEGER; continue; }
             k = ff[i]+val-2;
@@ -802,6 +1664,7 @@ SEXP gnthvalue(SEXP x, SEXP valArg) {
     break;
     case REALSXP:
         ans = PROTECT(allocVector(REALSXP, ngrp));
+        #pragma omp parallel for num_threads(nth) private(k)
         for (i=0; i<ngrp; i++) {
             if (val > grpsize[i]) { REAL(ans)[i] = NA_REAL; continue; }
             k = ff[i]+val-2;
@@ -838,6 +1701,228 @@ SEXP gnthvalue(SEXP x, SEXP valArg) {
     return(ans);    
 }
 
+static int ullcmp(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+    return (x > y) - (x < y);
+}
+
+SEXP guniqueN(SEXP x, SEXP narmArg)
+// The number of distinct values in each group, as uniqueN() finds them with forderv: doubles by their twiddled key so -0
+// is 0, NA and NaN differ and setNumericRounding applies; integer64 by its bits; strings by their CHARSXP
+{
+    if (!isLogical(narmArg) || LENGTH(narmArg)!=1 || LOGICAL(narmArg)[0]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
+    if (!isVectorAtomic(x)) error("GForce uniqueN can only be applied to columns, not .SD or similar. To find the number of unique rows of .SD use uniqueN(.SD) and turn off GForce optimization using options(datatable.optimize=1)");
+    Rboolean narm = LOGICAL(narmArg)[0];
+    int n = (irowslen == -1) ? length(x) : irowslen;
+    if (grpn != n) error("grpn [%d] != length(x) [%d] in guniqueN", grpn, n);
+    SEXPTYPE type = TYPEOF(x);
+    if (type!=LGLSXP && type!=INTSXP && type!=REALSXP && type!=STRSXP)
+        error("Type '%s' not supported by GForce uniqueN (guniqueN). Either add the prefix data.table::uniqueN(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(type));
+    Rboolean isi64 = type==REALSXP && inherits(x, "integer64");
+    int protecti = 0;
+    const int *xi = (type==LGLSXP || type==INTSXP) ? INTEGER(x) : NULL;
+    const double *xd = (type==REALSXP) ? REAL(x) : NULL;
+    const SEXP *xs = (type==STRSXP) ? STRING_PTR(x) : NULL;
+    if (xs) {
+        // CHARSXP are compared by address, so when any string is marked neither ASCII nor UTF-8 (e.g. latin1) they're all
+        // compared as their UTF-8 CHARSXP, as uniqueN's forderv does through ENC2UTF8. Done here since that allocates.
+        R_len_t len = length(x);
+        for (R_len_t i=0; i<len; i++) {
+            if (xs[i]==NA_STRING || IS_ASCII(xs[i]) || IS_UTF8(xs[i])) continue;
+            SEXP xu = PROTECT(allocVector(STRSXP, len)); protecti++;
+            for (R_len_t j=0; j<len; j++) SET_STRING_ELT(xu, j, ENC2UTF8(xs[j]));
+            xs = STRING_PTR(xu);
+            break;
+        }
+    }
+    SEXP ans = PROTECT(allocVector(INTSXP, ngrp)); protecti++;
+    int *ansp = INTEGER(ans);
+    int nth = gthreads(n);
+    unsigned long long *buf = malloc(((size_t)nth*maxgrpn + 1) * sizeof(unsigned long long));  // each thread sorts one group's keys at a time
+    if (!buf) error("Unable to allocate %d * %d bytes for guniqueN", nth*maxgrpn, (int)sizeof(unsigned long long));
+    #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+    for (int g=0; g<ngrp; g++) {
+        unsigned long long *b = buf + (size_t)omp_get_thread_num()*maxgrpn;
+        int m = 0;
+        for (int j=0; j<grpsize[g]; j++) {
+            int k = growi(g, j);
+            switch(type) {
+            case LGLSXP: case INTSXP:
+                if (narm && xi[k]==NA_INTEGER) continue;
+                b[m++] = (unsigned int)xi[k];
+                break;
+            case REALSXP:
+                if (isi64) {
+                    if (narm && ((const long long *)xd)[k]==NAINT64) continue;
+                    b[m++] = ((const unsigned long long *)xd)[k];
+                } else {
+                    if (narm && ISNAN(xd[k])) continue;
+                    b[m++] = dtwiddle((void *)xd, k, 1);
+                }
+                break;
+            default:
+                if (narm && xs[k]==NA_STRING) continue;
+                b[m++] = (size_t)xs[k];
+            }
+        }
+        qsort(b, m, sizeof(unsigned long long), ullcmp);
+        int u = m>0;
+        for (int j=1; j<m; j++) u += b[j]!=b[j-1];
+        ansp[g] = u;
+    }
+    free(buf);
+    UNPROTECT(protecti);
+    return(ans);
+}
+
+static SEXP ganyall(SEXP x, SEXP narmArg, Rboolean isany)
+// any() or all() of each group. A value of TRUE settles any() and FALSE settles all(); otherwise a group is NA if it has
+// an NA (unless na.rm) else FALSE for any() and TRUE for all(), as base
+{
+    const char *fun = isany ? "any" : "all";
+    if (!isLogical(narmArg) || LENGTH(narmArg)!=1 || LOGICAL(narmArg)[0]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
+    if (!isVectorAtomic(x)) error("GForce %s can only be applied to columns or logical expressions of them, not .SD or similar. Either add the prefix base::%s(.) or turn off GForce optimization using options(datatable.optimize=1)", fun, fun);
+    if (inherits(x, "factor")) error("%s is not meaningful for factors.", fun);
+    Rboolean narm = LOGICAL(narmArg)[0];
+    int protecti = 0, n = (irowslen == -1) ? length(x) : irowslen;
+    if (grpn != n) error("grpn [%d] != length(x) [%d] in g%s", grpn, n, fun);
+    if (isint64(x)) {
+        // as.logical of integer64 is whether it's not 0; as a double it'd be whether its bits are
+        const long long *xp = (const long long *)REAL(x);
+        SEXP xl = PROTECT(allocVector(LGLSXP, length(x))); protecti++;
+        for (R_len_t i=0; i<length(x); i++) LOGICAL(xl)[i] = (xp[i] == NAINT64) ? NA_LOGICAL : xp[i] != 0;
+        x = xl;
+    } else if (TYPEOF(x) != LGLSXP) {
+        if (TYPEOF(x) != INTSXP && TYPEOF(x) != REALSXP) error("Type '%s' not supported by GForce %s (g%s). Either add the prefix base::%s(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(TYPEOF(x)), fun, fun, fun);
+        if (TYPEOF(x) == REALSXP) warning("coercing argument of type 'double' to logical");  // as base, which doesn't warn for integer
+        x = PROTECT(coerceVector(x, LGLSXP)); protecti++;
+    }
+    const int *xp = LOGICAL(x), settle = isany ? TRUE : FALSE;
+    SEXP ans = PROTECT(allocVector(LGLSXP, ngrp)); protecti++;
+    int *ansp = LOGICAL(ans);
+    int nth = gthreads(n);
+    #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+    for (int g=0; g<ngrp; g++) {
+        int res = !settle;
+        Rboolean anyna = FALSE;
+        for (int j=0; j<grpsize[g]; j++) {
+            int v = xp[growi(g, j)];
+            if (v == settle) { res = settle; break; }
+            if (v == NA_LOGICAL) anyna = TRUE;
+        }
+        ansp[g] = (res != settle && anyna && !narm) ? NA_LOGICAL : res;
+    }
+    UNPROTECT(protecti);
+    return(ans);
+}
+
+SEXP gany(SEXP x, SEXP narm) { return ganyall(x, narm, TRUE); }
+SEXP gall(SEXP x, SEXP narm) { return ganyall(x, narm, FALSE); }
+
+SEXP gnotna(SEXP x)
+// The number of non-NA in each group; sum(!is.na(x)) without the logical vector
+{
+    if (!isVectorAtomic(x)) error("GForce sum(!is.na(.)) can only be applied to columns, not .SD or similar. Either add the prefix base::sum(.) or turn off GForce optimization using options(datatable.optimize=1)");
+    int n = (irowslen == -1) ? length(x) : irowslen;
+    if (grpn != n) error("grpn [%d] != length(x) [%d] in gnotna", grpn, n);
+    SEXPTYPE type = TYPEOF(x);
+    if (type!=LGLSXP && type!=INTSXP && type!=REALSXP && type!=CPLXSXP && type!=STRSXP)
+        error("Type '%s' not supported by GForce sum(!is.na(.)) (gnotna). Either add the prefix base::sum(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(type));
+    Rboolean isi64 = type==REALSXP && inherits(x, "integer64");
+    const int *xi = (type==LGLSXP || type==INTSXP) ? INTEGER(x) : NULL;
+    const double *xd = (type==REALSXP) ? REAL(x) : NULL;
+    const Rcomplex *xc = (type==CPLXSXP) ? COMPLEX(x) : NULL;
+    const SEXP *xs = (type==STRSXP) ? STRING_PTR(x) : NULL;
+    SEXP ans = PROTECT(allocVector(INTSXP, ngrp));
+    int *ansp = INTEGER(ans);
+    int nth = gthreads(n);
+    #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+    for (int g=0; g<ngrp; g++) {
+        int c = 0;
+        for (int j=0; j<grpsize[g]; j++) {
+            int k = growi(g, j);
+            switch(type) {
+            case LGLSXP: case INTSXP: c += xi[k] != NA_INTEGER; break;
+            case REALSXP: c += isi64 ? ((const long long *)xd)[k] != NAINT64 : !ISNAN(xd[k]); break;
+            case CPLXSXP: c += !ISNAN(xc[k].r) && !ISNAN(xc[k].i); break;
+            default: c += xs[k] != NA_STRING;
+            }
+        }
+        ansp[g] = c;
+    }
+    UNPROTECT(1);
+    return(ans);
+}
+
+SEXP gwmean(SEXP x, SEXP w, SEXP narmArg)
+// weighted.mean(x, w) of each group as base: sum((x*w)[w != 0])/sum(w), each sum in long double then double, and na.rm
+// removing the rows where x is NA (not w)
+{
+    if (!isLogical(narmArg) || LENGTH(narmArg)!=1 || LOGICAL(narmArg)[0]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
+    if (!isVectorAtomic(x) || !isVectorAtomic(w)) error("GForce weighted.mean can only be applied to columns, not .SD or similar. Either add the prefix stats::weighted.mean(.) or turn off GForce optimization using options(datatable.optimize=1)");
+    if (inherits(x, "factor") || inherits(w, "factor")) error("weighted.mean is not meaningful for factors.");
+    if ((TYPEOF(x)!=LGLSXP && TYPEOF(x)!=INTSXP && TYPEOF(x)!=REALSXP) || inherits(x, "integer64"))
+        error("Type '%s' not supported by GForce weighted.mean (gwmean). Either add the prefix stats::weighted.mean(.) or turn off GForce optimization using options(datatable.optimize=1)", inherits(x, "integer64") ? "integer64" : type2char(TYPEOF(x)));
+    if ((TYPEOF(w)!=LGLSXP && TYPEOF(w)!=INTSXP && TYPEOF(w)!=REALSXP) || inherits(w, "integer64"))
+        error("Type '%s' of weights not supported by GForce weighted.mean (gwmean). Either add the prefix stats::weighted.mean(.) or turn off GForce optimization using options(datatable.optimize=1)", inherits(w, "integer64") ? "integer64" : type2char(TYPEOF(w)));
+    if (length(w) != length(x)) error("'x' and 'w' must have the same length");
+    Rboolean narm = LOGICAL(narmArg)[0];
+    int n = (irowslen == -1) ? length(x) : irowslen;
+    if (grpn != n) error("grpn [%d] != length(x) [%d] in gwmean", grpn, n);
+    const int *xi = TYPEOF(x)==REALSXP ? NULL : INTEGER(x), *wi = TYPEOF(w)==REALSXP ? NULL : INTEGER(w);
+    const double *xd = xi ? NULL : REAL(x), *wd = wi ? NULL : REAL(w);
+    SEXP ans = PROTECT(allocVector(REALSXP, ngrp));
+    double *ansp = REAL(ans);
+    int nth = gthreads(n);
+    #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+    for (int g=0; g<ngrp; g++) {
+        long double s = 0, sw = 0;
+        for (int j=0; j<grpsize[g]; j++) {
+            int k = growi(g, j);
+            double xv = xi ? (xi[k]==NA_INTEGER ? NA_REAL : xi[k]) : xd[k];
+            if (narm && ISNAN(xv)) continue;
+            double wv = wi ? (wi[k]==NA_INTEGER ? NA_REAL : wi[k]) : wd[k];
+            sw += wv;
+            if (ISNAN(wv)) s += NA_REAL;   // w != 0 is NA so the item is NA
+            else if (wv != 0) s += xv*wv;
+        }
+        ansp[g] = (double)s / (double)sw;
+    }
+    UNPROTECT(1);
+    return(ans);
+}
+
+static double gvarsd_grp(const int *xi, const double *xd, int g, Rboolean narm, Rboolean isSD)
+// var (or sd) of group g of an integer (xi) or double (xd) column, as the loops of gvarsd1 below do it but reading x again
+// for each pass rather than gathering the group into sub once, so that groups can be done by threads in parallel
+{
+    long double m=0., s=0., v=0.;
+    int j, k, thisgrpsize = 0;
+    if (grpsize[g] == 1) return NA_REAL;
+    for (j=0; j<grpsize[g]; j++) {
+        k = growi(g, j);
+        if (xi ? xi[k] == NA_INTEGER : ISNAN(xd[k])) { if (narm) continue; return NA_REAL; }
+        m += xi ? (double)xi[k] : xd[k]; // sum
+        thisgrpsize++;
+    }
+    if (thisgrpsize <= 1) return NA_REAL;
+    m = m/thisgrpsize; // mean, first pass
+    for (j=0; j<grpsize[g]; j++) {
+        k = growi(g, j);
+        if (xi ? xi[k] == NA_INTEGER : ISNAN(xd[k])) continue;
+        s += ((xi ? (double)xi[k] : xd[k]) - m); // residuals
+    }
+    m += (s/thisgrpsize); // mean, second pass
+    for (j=0; j<grpsize[g]; j++) { // variance
+        k = growi(g, j);
+        if (xi ? xi[k] == NA_INTEGER : ISNAN(xd[k])) continue;
+        double d = (xi ? (double)xi[k] : xd[k]) - (double)m;
+        v += d * d;
+    }
+    double ans = (double)v/(thisgrpsize-1);
+    return isSD ? SQRTL(ans) : ans;
+}
+
 // TODO: gwhich.min, gwhich.max
 // implemented this similar to gmedian to balance well between speed and memory usage. There's one extra allocation on maximum groups and that's it.. and that helps speed things up extremely since we don't have to collect x's values for each group for each step (mean, residuals, mean again and then variance).
 SEXP gvarsd1(SEXP x, SEXP narm, Rboolean isSD)
@@ -845,11 +1930,27 @@ SEXP gvarsd1(SEXP x, SEXP narm, Rboolean isSD)
     if (!isLogical(narm) || LENGTH(narm)!=1 || LOGICAL(narm)[0]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
     if (!isVectorAtomic(x)) error("GForce var/sd can only be applied to columns, not .SD or similar. To find var/sd of all items in a list such as .SD, either add the prefix stats::var(.SD) (or stats::sd(.SD)) or turn off GForce optimization using options(datatable.optimize=1). More likely, you may be looking for 'DT[,lapply(.SD,var),by=,.SDcols=]'");
     if (inherits(x, "factor")) error("var/sd is not meaningful for factors.");
+    if (isint64(x)) {
+        SEXP xd = PROTECT(gi64double(x)), ans = gvarsd1(xd, narm, isSD);
+        UNPROTECT(1);
+        return (ans);
+    }
     long double m, s, v;
     R_len_t i, j, ix, thisgrpsize = 0, n = (irowslen == -1) ? length(x) : irowslen;
     if (grpn != n) error("grpn [%d] != length(x) [%d] in gvar", grpn, n);
     SEXP sub, ans = PROTECT(allocVector(REALSXP, ngrp));
     Rboolean ans_na;
+    int nth = gthreads(n);
+    if (nth > 1 && (TYPEOF(x) == LGLSXP || TYPEOF(x) == INTSXP || TYPEOF(x) == REALSXP)) {
+        const int *xi = TYPEOF(x) == REALSXP ? NULL : INTEGER(x);
+        const double *xd = TYPEOF(x) == REALSXP ? REAL(x) : NULL;
+        double *ad = REAL(ans);
+        Rboolean narm0 = LOGICAL(narm)[0];
+        #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+        for (int g=0; g<ngrp; g++) ad[g] = gvarsd_grp(xi, xd, g, narm0, isSD);
+        UNPROTECT(1);
+        return (ans);
+    }
     switch(TYPEOF(x)) {
         case LGLSXP: case INTSXP:
         sub = PROTECT(allocVector(INTSXP, maxgrpn)); // allocate once upfront
@@ -985,6 +2086,11 @@ SEXP gprod(SEXP x, SEXP narm)
     if (!isLogical(narm) || LENGTH(narm)!=1 || LOGICAL(narm)[0]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
     if (!isVectorAtomic(x)) error("GForce prod can only be applied to columns, not .SD or similar. To multiply all items in a list such as .SD, either add the prefix base::prod(.SD) or turn off GForce optimization using options(datatable.optimize=1). More likely, you may be looking for 'DT[,lapply(.SD,prod),by=,.SDcols=]'");
     if (inherits(x, "factor")) error("prod is not meaningful for factors.");
+    if (isint64(x)) {
+        int n = (irowslen == -1) ? length(x) : irowslen;
+        if (grpn != n) error("grpn [%d] != length(x) [%d] in gprod", grpn, n);
+        return (gi64sum(x, LOGICAL(narm)[0], 'p'));
+    }
     int i, ix, thisgrp;
     int n = (irowslen == -1) ? length(x) : irowslen;
     //clock_t start = clock();
@@ -994,9 +2100,23 @@ SEXP gprod(SEXP x, SEXP narm)
     if (!s) error("Unable to allocate %d * %d bytes for gprod", ngrp, sizeof(long double));
     for (i=0; i<ngrp; i++) s[i] = 1.0;
     ans = PROTECT(allocVector(REALSXP, ngrp));
+    int nth = gthreads(n);
+    Rboolean narm0 = LOGICAL(narm)[0];
     switch(TYPEOF(x)) {
     case LGLSXP: case INTSXP:
-        for (i=0; i<n; i++) {
+        if (nth > 1) {
+            const int *xd = INTEGER(x);
+            #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+            for (int g=0; g<ngrp; g++) {
+                long double t = 1.0;
+                for (int j=0; j<grpsize[g]; j++) {
+                    int v = xd[growi(g, j)];
+                    if (v == NA_INTEGER) { if (!narm0) t = NA_REAL; continue; }
+                    t *= v;
+                }
+                s[g] = t;
+            }
+        } else for (i=0; i<n; i++) {
             thisgrp = grp[i];
             ix = (irowslen == -1) ? i : irows[i]-1;
             if(INTEGER(x)[ix] == NA_INTEGER) { 
@@ -1012,7 +2132,19 @@ SEXP gprod(SEXP x, SEXP narm)
         }
         break;
     case REALSXP:
-        for (i=0; i<n; i++) {
+        if (nth > 1) {
+            const double *xd = REAL(x);
+            #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+            for (int g=0; g<ngrp; g++) {
+                long double t = 1.0;
+                for (int j=0; j<grpsize[g]; j++) {
+                    double v = xd[growi(g, j)];
+                    if (ISNAN(v) && narm0) continue;
+                    t *= v;
+                }
+                s[g] = t;
+            }
+        } else for (i=0; i<n; i++) {
             thisgrp = grp[i];
             ix = (irowslen == -1) ? i : irows[i]-1;
             if(ISNAN(REAL(x)[ix]) && LOGICAL(narm)[0]) continue;  // else let NA_REAL propogate from here
@@ -1034,3 +2166,186 @@ SEXP gprod(SEXP x, SEXP narm)
     // Rprintf("this gprod took %8.3f\n", 1.0*(clock()-start)/CLOCKS_PER_SEC);
     return(ans);
 }
+
+/* cumsum, cumprod, cummax, cummin and shift by group. Each gives a value for every row of its group, one group after
+   another as dogroups would give them, and with := gassign writes each back to its row. The groups are shared between the
+   threads and each is done in row order just as base's functions do it over the group's rows. */
+static SEXP gi64cum(SEXP x, char op, const int *off)
+// As bit64's: exact in long long, NA from a group's first NA or overflow on
+{
+    const long long *xp = (const long long *)REAL(x);
+    SEXP ans = PROTECT(allocVector(REALSXP, grpn));
+    long long *ap = (long long *)REAL(ans);
+    int nth = gthreads(grpn), overflow = 0;
+    #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth)) reduction(|:overflow)
+    for (int g=0; g<ngrp; g++) {
+        long long t = 0;
+        int j = 0;
+        for (; j<grpsize[g]; j++) {
+            long long v = xp[growi(g, j)];
+            if (v == NAINT64) break;
+            if (j == 0) t = v;
+            else if (op == 's' || op == 'p') { if (op == 's' ? i64add(&t, v) : i64mul(&t, v)) { overflow = 1; break; } }
+            else if (op == 'M') { if (v > t) t = v; }
+            else if (v < t) t = v;
+            ap[off[g]+j] = t;
+        }
+        for (; j<grpsize[g]; j++) ap[off[g]+j] = NAINT64;
+    }
+    if (overflow) warning("NAs produced by integer64 overflow");
+    copyMostAttrib(x, ans);
+    UNPROTECT(1);
+    return(ans);
+}
+
+SEXP gcum(SEXP x, SEXP funArg)
+{
+    if (!isString(funArg) || LENGTH(funArg)!=1) error("Internal error: fun to gcum must be a character vector of length 1");
+    const char *fun = CHAR(STRING_ELT(funArg, 0));
+    char op = !strcmp(fun, "cumsum") ? 's' : !strcmp(fun, "cumprod") ? 'p' : !strcmp(fun, "cummax") ? 'M' : !strcmp(fun, "cummin") ? 'm' : 0;
+    if (!op) error("Internal error: invalid fun '%s' to gcum", fun);
+    if (!isVectorAtomic(x)) error("GForce %s can only be applied to columns, not .SD or similar. Either add the prefix base::%s(.) or turn off GForce optimization using options(datatable.optimize=1)", fun, fun);
+    if (inherits(x, "factor")) error("'%s' not meaningful for factors", fun);
+    int n = (irowslen == -1) ? length(x) : irowslen;
+    if (grpn != n) error("grpn [%d] != length(x) [%d] in g%s", grpn, n, fun);
+    int *off = growoff();
+    if (isint64(x)) return (gi64cum(x, op, off));
+    int nth = gthreads(n), overflow = 0;
+    SEXP ans;
+    switch(TYPEOF(x)) {
+    case LGLSXP: case INTSXP: {
+        const int *xp = INTEGER(x);
+        if (op == 'p') {
+            // base's cumprod is double for integers too
+            ans = PROTECT(allocVector(REALSXP, n));
+            double *ap = REAL(ans);
+            #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+            for (int g=0; g<ngrp; g++) {
+                long double t = 1.0;
+                for (int j=0; j<grpsize[g]; j++) {
+                    int v = xp[growi(g, j)];
+                    t *= (v == NA_INTEGER) ? NA_REAL : v;
+                    ap[off[g]+j] = (double)t;
+                }
+            }
+            break;
+        }
+        ans = PROTECT(allocVector(INTSXP, n));
+        int *ap = INTEGER(ans);
+        #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth)) reduction(|:overflow)
+        for (int g=0; g<ngrp; g++) {
+            long long t = 0;
+            int j = 0;
+            for (; j<grpsize[g]; j++) {
+                int v = xp[growi(g, j)];
+                if (v == NA_INTEGER) break;  // NA from here on, as base
+                if (op == 's') { t += v; if (t > INT_MAX || t < 1+INT_MIN) { overflow = 1; break; } }
+                else if (j == 0 || (op == 'M' ? v > t : v < t)) t = v;
+                ap[off[g]+j] = (int)t;
+            }
+            for (; j<grpsize[g]; j++) ap[off[g]+j] = NA_INTEGER;
+        }
+        if (overflow) warning("integer overflow in 'cumsum'; use 'cumsum(as.numeric(.))'");
+    } break;
+    case REALSXP: {
+        const double *xp = REAL(x);
+        ans = PROTECT(allocVector(REALSXP, n));
+        double *ap = REAL(ans);
+        #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+        for (int g=0; g<ngrp; g++) {
+            if (op == 's' || op == 'p') {
+                long double t = (op == 's') ? 0.0 : 1.0;   // in long double, like base
+                for (int j=0; j<grpsize[g]; j++) {
+                    if (op == 's') t += xp[growi(g, j)]; else t *= xp[growi(g, j)];
+                    ap[off[g]+j] = (double)t;
+                }
+            } else {
+                double t = (op == 'M') ? R_NegInf : R_PosInf;
+                for (int j=0; j<grpsize[g]; j++) {
+                    double v = xp[growi(g, j)];
+                    if (ISNAN(v) || ISNAN(t)) t += v;   // propagate NA and NaN, as base
+                    else if (op == 'M' ? v > t : v < t) t = v;
+                    ap[off[g]+j] = t;
+                }
+            }
+        }
+    } break;
+    default:
+        error("Type '%s' not supported by GForce %s. Either add the prefix base::%s(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(TYPEOF(x)), fun, fun);
+    }
+    UNPROTECT(1);
+    return(ans);
+}
+
+static inline int gshiftrow(int g, int j, int k, Rboolean lag) {
+    // the row whose value the j-th of group g takes when shifted by k, or -1 to fill
+    if (lag) return (j < k) ? -1 : growi(g, j-k);
+    return (k >= grpsize[g]-j) ? -1 : growi(g, j+k);
+}
+
+SEXP gshift(SEXP x, SEXP nArg, SEXP fill, SEXP typeArg)
+// shift(x, n, fill, type) by group for one n
+{
+    if (!isInteger(nArg) || LENGTH(nArg)!=1 || INTEGER(nArg)[0]==NA_INTEGER || INTEGER(nArg)[0]<0)
+        error("Internal error: n to gshift must be a single non-negative integer. This should have been caught before. Please report to datatable-help.");
+    if (length(fill) != 1)
+        error("fill must be a vector of length 1");
+    if (!isString(typeArg) || LENGTH(typeArg)!=1)
+        error("type must be a character vector of length 1");
+    int k = INTEGER(nArg)[0];
+    Rboolean lag = !strcmp(CHAR(STRING_ELT(typeArg, 0)), "lag");
+    if (!lag && strcmp(CHAR(STRING_ELT(typeArg, 0)), "lead"))
+        error("Internal error: invalid type for gshift, should have been caught before. Please report to datatable-help");
+    int n = (irowslen == -1) ? length(x) : irowslen;
+    if (grpn != n) error("grpn [%d] != length(x) [%d] in gshift", grpn, n);
+    int *off = growoff();
+    int nth = gthreads(n);
+    SEXP thisfill;
+    if (isint64(x)) {
+        // as shift(): fill is NA or a whole number, to the integer64's bits
+        thisfill = PROTECT(allocVector(REALSXP, 1));
+        SEXP ifill = PROTECT(coerceVector(fill, INTSXP));
+        ((long long *)REAL(thisfill))[0] = (INTEGER(ifill)[0] == NA_INTEGER) ? NAINT64 : (long long)INTEGER(ifill)[0];
+        UNPROTECT(1);
+    } else {
+        thisfill = PROTECT(coerceVector(fill, TYPEOF(x)));
+    }
+    SEXP ans = PROTECT(allocVector(TYPEOF(x), n));
+    switch(TYPEOF(x)) {
+    case LGLSXP: case INTSXP: {
+        const int *xp = INTEGER(x), f = INTEGER(thisfill)[0];
+        int *ap = INTEGER(ans);
+        #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+        for (int g=0; g<ngrp; g++) for (int j=0; j<grpsize[g]; j++) { int s = gshiftrow(g, j, k, lag); ap[off[g]+j] = (s < 0) ? f : xp[s]; }
+    } break;
+    case REALSXP: {
+        const double *xp = REAL(x), f = REAL(thisfill)[0];   // integer64 too, bit for bit
+        double *ap = REAL(ans);
+        #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+        for (int g=0; g<ngrp; g++) for (int j=0; j<grpsize[g]; j++) { int s = gshiftrow(g, j, k, lag); ap[off[g]+j] = (s < 0) ? f : xp[s]; }
+    } break;
+    case CPLXSXP: {
+        const Rcomplex *xp = COMPLEX(x), f = COMPLEX(thisfill)[0];
+        Rcomplex *ap = COMPLEX(ans);
+        #pragma omp parallel for num_threads(nth) schedule(dynamic, grpchunk(nth))
+        for (int g=0; g<ngrp; g++) for (int j=0; j<grpsize[g]; j++) { int s = gshiftrow(g, j, k, lag); ap[off[g]+j] = (s < 0) ? f : xp[s]; }
+    } break;
+    case STRSXP:
+        for (int g=0; g<ngrp; g++) for (int j=0; j<grpsize[g]; j++) {
+            int s = gshiftrow(g, j, k, lag);
+            SET_STRING_ELT(ans, off[g]+j, (s < 0) ? STRING_ELT(thisfill, 0) : STRING_ELT(x, s));
+        }
+        break;
+    case VECSXP:
+        for (int g=0; g<ngrp; g++) for (int j=0; j<grpsize[g]; j++) {
+            int s = gshiftrow(g, j, k, lag);
+            SET_VECTOR_ELT(ans, off[g]+j, (s < 0) ? VECTOR_ELT(thisfill, 0) : VECTOR_ELT(x, s));
+        }
+        break;
+    default:
+        error("Type '%s' not supported by GForce shift (gshift). Either add the prefix data.table::shift(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(TYPEOF(x)));
+    }
+    copyMostAttrib(x, ans);
+    UNPROTECT(2);
+    return(ans);
+}
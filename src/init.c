@@ -20,6 +20,7 @@ SEXP readfile();
 SEXP writefile();
 SEXP genLookups();
 SEXP reorder();
+SEXP extsort();
 SEXP rbindlist();
 SEXP vecseq();
 SEXP copyattr();
@@ -38,6 +39,13 @@ SEXP gstart();
 SEXP gend();
 SEXP gsum();
 SEXP gmean();
+SEXP gforce();
+SEXP gassign();
+SEXP guniqueN();
+SEXP gany();
+SEXP gall();
+SEXP gnotna();
+SEXP gwmean();
 SEXP gmin();
 SEXP gmax();
 SEXP isOrderedSubset();
@@ -55,12 +63,16 @@ SEXP lookup();
 SEXP overlaps();
 SEXP whichwrapper();
 SEXP shift();
+SEXP froll();
 SEXP transpose();
 SEXP anyNA();
 SEXP isReallyReal();
 SEXP setlevels();
 SEXP rleid();
 SEXP gmedian();
+SEXP gquantile();
+SEXP gcum();
+SEXP gshift();
 SEXP gtail();
 SEXP ghead();
 SEXP glast();
@@ -100,6 +112,7 @@ R_CallMethodDef callMethods[] = {
 {"Cwritefile", (DL_FUNC) &writefile, -1},
 {"CgenLookups", (DL_FUNC) &genLookups, -1},
 {"Creorder", (DL_FUNC) &reorder, -1},
+{"Cextsort", (DL_FUNC) &extsort, -1},
 {"Crbindlist", (DL_FUNC) &rbindlist, -1},
 {"Cvecseq", (DL_FUNC) &vecseq, -1},
 {"Ccopyattr", (DL_FUNC) &copyattr, -1},
@@ -118,6 +131,13 @@ R_CallMethodDef callMethods[] = {
 {"Cgend", (DL_FUNC) &gend, -1},
 {"Cgsum", (DL_FUNC) &gsum, -1},
 {"Cgmean", (DL_FUNC) &gmean, -1},
+{"Cgforce", (DL_FUNC) &gforce, -1},
+{"Cgassign", (DL_FUNC) &gassign, -1},
+{"CguniqueN", (DL_FUNC) &guniqueN, -1},
+{"Cgany", (DL_FUNC) &gany, -1},
+{"Cgall", (DL_FUNC) &gall, -1},
+{"Cgnotna", (DL_FUNC) &gnotna, -1},
+{"Cgwmean", (DL_FUNC) &gwmean, -1},
 {"Cgmin", (DL_FUNC) &gmin, -1},
 {"Cgmax", (DL_FUNC) &gmax, -1},
 {"CisOrderedSubset", (DL_FUNC) &isOrderedSubset, -1},
@@ -135,12 +155,16 @@ R_CallMethodDef callMethods[] = {
 {"Coverlaps", (DL_FUNC) &overlaps, -1},
 {"Cwhichwrapper", (DL_FUNC) &whichwrapper, -1},
 {"Cshift", (DL_FUNC) &shift, -1},
+{"Cfroll", (DL_FUNC) &froll, -1},
 {"Ctranspose", (DL_FUNC) &transpose, -1},
 {"CanyNA", (DL_FUNC) &anyNA, -1},
 {"CisReallyReal", (DL_FUNC) &isReallyReal, -1},
 {"Csetlevels", (DL_FUNC) &setlevels, -1},
 {"Crleid", (DL_FUNC) &rleid, -1},
 {"Cgmedian", (DL_FUNC) &gmedian, -1},
+{"Cgquantile", (DL_FUNC) &gquantile, -1},
+{"Cgcum", (DL_FUNC) &gcum, -1},
+{"Cgshift", (DL_FUNC) &gshift, -1},
 {"Cgtail", (DL_FUNC) &gtail, -1},
 {"Cghead", (DL_FUNC) &ghead, -1},
 {"Cglast", (DL_FUNC) &glast, -1},
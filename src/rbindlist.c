@@ -402,7 +402,7 @@ static SEXP fast_order(SEXP dt, R_len_t byArg, R_len_t handleSorted) {
         order = PROTECT(allocVector(INTSXP, 1)); INTEGER(order)[0] = 1;
         UNPROTECT(4);
     }    
-    ans = PROTECT(forder(dt, by, retGrp, sortStr, order, na)); protecti++;
+    ans = PROTECT(forder(dt, by, retGrp, sortStr, order, na, ScalarLogical(FALSE))); protecti++;
     if (!length(ans) && handleSorted != 0) {
         starts = PROTECT(getAttrib(ans, mkString("starts"))); protecti++;
         // if cols are already sorted, 'forder' gives integer(0), got to replace it with 1:.N
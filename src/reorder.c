@@ -1,4 +1,5 @@
 #include "data.table.h"
+#include <errno.h>
 
 SEXP reorder(SEXP x, SEXP order)
 {
@@ -8,7 +9,7 @@ SEXP reorder(SEXP x, SEXP order)
     // x may be a vector, or a list of same-length vectors such as data.table
     
     R_len_t nrow, ncol;
-    int maxSize = 0;
+    size_t maxSize = 0;
     if (isNewList(x)) {
       nrow = length(VECTOR_ELT(x,0));
       ncol = length(x);
@@ -50,14 +51,14 @@ SEXP reorder(SEXP x, SEXP order)
     int nth = MIN(getDTthreads(), ncol);
     size_t oneTmpSize = (end-start+1)*(size_t)maxSize;
     size_t totalLimit = 1024*1024*(size_t)1024;  // 1GB
-    nth = MIN(totalLimit/oneTmpSize, nth);
+    nth = (int)MIN(totalLimit/oneTmpSize, (size_t)nth);
     if (nth==0) nth=1;  // if one column's worth is very big, we'll just have to try
     char *tmp[nth];  // VLA ok because small; limited to max getDTthreads() not ncol which could be > 1e6
     int ok=0; for (; ok<nth; ok++) {
       tmp[ok] = malloc(oneTmpSize);
       if (tmp[ok] == NULL) break;
     }
-    if (ok==0) error("unable to allocate %d * %d bytes of working memory for reordering data.table", end-start+1, maxSize);
+    if (ok==0) error("unable to allocate %d * %d bytes of working memory for reordering data.table", end-start+1, (int)maxSize);
     nth = ok;  // as many threads for which we have a successful malloc
     // So we can still reorder a 10GB table in 16GB of RAM, as long as we have at least one column's worth of tmp
     
@@ -103,6 +104,291 @@ SEXP reorder(SEXP x, SEXP order)
     return(R_NilValue);
 }
 
+/*
+External sort for setkey and setorder, used instead of forder+reorder when options(datatable.extsort) is set to a memory
+budget in bytes that their working memory would exceed. The rows are sorted a chunk at a time: forder on a copy of that
+chunk's key columns, then the chunk's rows, all columns, are written in that order to a temporary file of its own. Each
+file is a sequence of blocks of rows, a block holding each column's values contiguously in turn (the same binary layout as
+the columns in RAM). Once every chunk is on disk x's columns are free to overwrite, and the chunks are merged back into x a
+block at a time from each file. Ties go to the earlier chunk so the sort is stable, the same as forder. The memory used is
+a chunk's key columns and order (plus forder's own working memory for that chunk), then one block per chunk while merging;
+rather than the order vector for all of x plus one column's worth of working memory per thread.
+The merge must not allocate: for a while a CHARSXP (or a list column's item) may be referenced only from the files, and a
+gc then would free it. So keys are compared here rather than via StrCmp, whose ENC2UTF8 can allocate, and x is left alone
+(FALSE is returned) when a character key column contains a string that isn't ASCII or UTF-8 and would need translating.
+*/
+#define EXT_MAXCHUNK 256   // files open while merging
+#define EXT_MINROWS 1024   // in a chunk whatever the budget; and 64 in a block
+
+struct extKey {
+    int off;              // the column's offset in a block, per row
+    int type;             // 0 int or logical, 1 double, 2 integer64, 3 character
+    int order;
+};
+
+struct extChunk {
+    FILE *f;
+    char *buf;            // the current block: each column's rows in turn, at blockrows*off
+    void **keyp;          // where each key column starts in buf
+    int left;             // rows in the file not yet read into buf
+    int nbuf, at;         // rows in buf and the next one to merge
+};
+
+struct extSort {
+    int nkey, nalast, blockrows, nchunk;
+    struct extKey *keys;
+    struct extChunk *chunks;
+    const char *path;
+};
+
+static int extcmprow(const struct extSort *es, void **pa, int a, void **pb, int b)
+{
+    // <0 when row a goes before row b. pa and pb have the start of each key column: in x, or in a chunk's block
+    for (int k=0; k<es->nkey; k++) {
+        const struct extKey *key = es->keys + k;
+        int c = 0;
+        switch (key->type) {
+        case 0 : {
+            int x = ((int *)pa[k])[a], y = ((int *)pb[k])[b];
+            if (x == y) continue;
+            if (x == NA_INTEGER) return es->nalast;
+            if (y == NA_INTEGER) return -es->nalast;
+            c = x < y ? -key->order : key->order;
+            break; }
+        case 1 : case 2 : {
+            unsigned long long (*tw)(void *, int, int, int) = key->type == 1 ? dtwiddle_na : i64twiddle_na;
+            unsigned long long x = tw(pa[k], a, key->order, es->nalast), y = tw(pb[k], b, key->order, es->nalast);
+            if (x == y) continue;
+            c = x < y ? -1 : 1;
+            break; }
+        case 3 : {
+            SEXP x = ((SEXP *)pa[k])[a], y = ((SEXP *)pb[k])[b];
+            if (x == y) continue;
+            if (x == NA_STRING) return es->nalast;
+            if (y == NA_STRING) return -es->nalast;
+            c = strcmp(CHAR(x), CHAR(y));
+            if (!c) continue;                                       // same string in different cache entries
+            c = c < 0 ? -key->order : key->order;
+            break; }
+        }
+        return c;
+    }
+    return 0;
+}
+
+static int extcmp(const struct extSort *es, int a, int b)   // <0 when chunk a's next row goes before chunk b's
+{
+    const struct extChunk *ca = es->chunks + a, *cb = es->chunks + b;
+    int c = extcmprow(es, ca->keyp, ca->at, cb->keyp, cb->at);
+    return c ? c : a - b;                                           // ties to the earlier chunk; i.e. stable
+}
+
+static void extsiftdown(const struct extSort *es, int *heap, int n, int i)
+{
+    for (;;) {
+        int l = 2*i+1, m = i;
+        if (l < n && extcmp(es, heap[l], heap[m]) < 0) m = l;
+        if (l+1 < n && extcmp(es, heap[l+1], heap[m]) < 0) m = l+1;
+        if (m == i) return;
+        int tmp = heap[i]; heap[i] = heap[m]; heap[m] = tmp;
+        i = m;
+    }
+}
+
+static Rboolean extread(const struct extSort *es, struct extChunk *ch, int ncol, const int *off, const int *size)
+{
+    // the next block of a chunk's file into its buf
+    int m = MIN(ch->left, es->blockrows);
+    for (int j=0; j<ncol; j++) {
+        if (fread(ch->buf + (size_t)es->blockrows*off[j], size[j], m, ch->f) != (size_t)m) return FALSE;
+    }
+    ch->left -= m;
+    ch->nbuf = m;
+    ch->at = 0;
+    return TRUE;
+}
+
+static void extfname(const struct extSort *es, int c, char *fname, size_t len) {
+    snprintf(fname, len, "%s_%d", es->path, c+1);
+}
+
+static void extcleanup(struct extSort *es)
+{
+    // close and remove the temporary files. Working memory is from R_alloc so is released by R, including on error.
+    size_t len = strlen(es->path) + 16;
+    char fname[len];
+    for (int c=0; c<es->nchunk; c++) {
+        if (es->chunks[c].f) fclose(es->chunks[c].f);
+        es->chunks[c].f = NULL;
+        extfname(es, c, fname, len);
+        remove(fname);
+    }
+}
+
+SEXP extsort(SEXP x, SEXP by, SEXP orderArg, SEXP naArg, SEXP budgetArg, SEXP pathArg, SEXP verboseArg)
+{
+    // Returns TRUE when x has been sorted, or FALSE when x is left untouched for forder and reorder to do instead.
+    if (!isNewList(x) || !length(x)) error("x must be a non-empty list");
+    if (!isInteger(by) || !length(by)) error("by must be a non-empty integer vector");
+    if (!isInteger(orderArg) || LENGTH(orderArg) != LENGTH(by)) error("order must be an integer vector the same length as by");
+    if (!isLogical(naArg) || LENGTH(naArg) != 1 || LOGICAL(naArg)[0] == NA_LOGICAL) error("na.last must be TRUE or FALSE");
+    if (!isReal(budgetArg) || LENGTH(budgetArg) != 1 || !R_FINITE(REAL(budgetArg)[0]) || REAL(budgetArg)[0] <= 0) error("budget must be a single positive number of bytes");
+    if (!isString(pathArg) || LENGTH(pathArg) != 1) error("path must be a single string");
+    Rboolean verbose = isLogical(verboseArg) && LOGICAL(verboseArg)[0] == TRUE;
+    int ncol = length(x), nrow = length(VECTOR_ELT(x, 0)), nkey = LENGTH(by);
+    int off[ncol], size[ncol];                                      // VLA ok; as reorder's tmp
+    size_t rowbytes = 0, keybytes = 0;
+    for (int j=0; j<ncol; j++) {
+        SEXP v = VECTOR_ELT(x, j);
+        size[j] = SIZEOF(v);
+        if (size[j] != 4 && size[j] != 8) return ScalarLogical(FALSE);   // reorder gives the error for this
+        if (length(v) != nrow) error("Column %d is length %d which differs from length of column 1 (%d). Invalid data.table.", j+1, length(v), nrow);
+        off[j] = (int)rowbytes;
+        rowbytes += size[j];
+    }
+    for (int k=0; k<nkey; k++) {
+        int j = INTEGER(by)[k]-1;
+        if (j < 0 || j >= ncol) error("by contains column number %d which is outside the range [1,ncol=%d]", j+1, ncol);
+        if (abs(INTEGER(orderArg)[k]) != 1) error("Item %d of order is %d. Must be +1 (ascending) or -1 (descending)", k+1, INTEGER(orderArg)[k]);
+        SEXP v = VECTOR_ELT(x, j);
+        switch (TYPEOF(v)) {
+        case INTSXP : case LGLSXP : case REALSXP : break;
+        case STRSXP :
+            for (int i=0; i<nrow; i++) {
+                SEXP s = STRING_ELT(v, i);
+                if (s != NA_STRING && !IS_ASCII(s) && !IS_UTF8(s)) return ScalarLogical(FALSE);
+            }
+            break;
+        default : return ScalarLogical(FALSE);
+        }
+        keybytes += size[j];
+    }
+    if (nrow < 2) return ScalarLogical(TRUE);
+
+    // Chunks as large as the budget allows for their key columns, order and forder's working memory. Then blocks small
+    // enough for one per chunk to fit in the budget while merging.
+    struct extSort es;
+    double budget = REAL(budgetArg)[0];
+    double chunkrows = budget / (keybytes + 16);
+    if (chunkrows < EXT_MINROWS) chunkrows = EXT_MINROWS;
+    if (nrow / chunkrows > EXT_MAXCHUNK) chunkrows = ceil((double)nrow / EXT_MAXCHUNK);
+    int chunkn = (int)MIN(chunkrows, nrow);
+    es.nchunk = (nrow-1)/chunkn + 1;
+    double blockrows = budget / ((double)es.nchunk * rowbytes);
+    es.blockrows = (int)MIN(blockrows < 64 ? 64 : blockrows, chunkn);
+    es.nkey = nkey;
+    es.nalast = LOGICAL(naArg)[0] ? 1 : -1;
+    es.path = CHAR(STRING_ELT(pathArg, 0));
+    es.keys = (struct extKey *)R_alloc(nkey, sizeof(struct extKey));
+    es.chunks = (struct extChunk *)R_alloc(es.nchunk, sizeof(struct extChunk));
+    memset(es.chunks, 0, es.nchunk * sizeof(struct extChunk));
+    char *wbuf = R_alloc(es.blockrows, 8);
+    size_t fnamelen = strlen(es.path) + 16;
+    char fname[fnamelen];
+    for (int k=0; k<nkey; k++) {
+        SEXP v = VECTOR_ELT(x, INTEGER(by)[k]-1);
+        es.keys[k].off = off[INTEGER(by)[k]-1];
+        es.keys[k].type = TYPEOF(v) == STRSXP ? 3 : TYPEOF(v) != REALSXP ? 0 : inherits(v, "integer64") ? 2 : 1;
+        es.keys[k].order = INTEGER(orderArg)[k];
+    }
+
+    // 0. Already sorted (e.g. setkey again by the same columns) is just a scan
+    void *xkeyp[nkey];
+    for (int k=0; k<nkey; k++) xkeyp[k] = DATAPTR(VECTOR_ELT(x, INTEGER(by)[k]-1));
+    int i = 1;
+    while (i<nrow && extcmprow(&es, xkeyp, i-1, xkeyp, i) <= 0) i++;
+    if (i == nrow) {
+        if (verbose) Rprintf("extsort: x is already ordered by these columns\n");
+        return ScalarLogical(TRUE);
+    }
+    if (verbose) Rprintf("extsort: %d rows in %d chunks of up to %d rows, merged %d rows at a time from each\n", nrow, es.nchunk, chunkn, es.blockrows);
+
+    // 1. Sort each chunk and spill it to its file, which is closed again so that an error (e.g. in forder) leaves
+    // nothing open. x isn't changed so an error here leaves it as it was; the R caller removes any files left behind.
+    SEXP sub = PROTECT(allocVector(VECSXP, nkey));
+    SEXP subby = PROTECT(allocVector(INTSXP, nkey));
+    for (int k=0; k<nkey; k++) INTEGER(subby)[k] = k+1;
+    for (int c=0; c<es.nchunk; c++) {
+        int from = c*chunkn, n = MIN(chunkn, nrow-from);
+        for (int k=0; k<nkey; k++) {
+            SEXP v = VECTOR_ELT(x, INTEGER(by)[k]-1);
+            SEXP vsub = allocVector(TYPEOF(v), n);
+            SET_VECTOR_ELT(sub, k, vsub);
+            memcpy(DATAPTR(vsub), (char *)DATAPTR(v) + (size_t)from*SIZEOF(v), (size_t)n*SIZEOF(v));
+            if (isReal(v) && inherits(v, "integer64")) setAttrib(vsub, R_ClassSymbol, getAttrib(v, R_ClassSymbol));
+        }
+        SEXP o = PROTECT(forder(sub, subby, ScalarLogical(FALSE), ScalarLogical(TRUE), orderArg, naArg, ScalarLogical(FALSE)));
+        const int *op = length(o) ? INTEGER(o) : NULL;              // integer(0) when the chunk is already sorted
+        extfname(&es, c, fname, fnamelen);
+        FILE *f = fopen(fname, "wb");
+        if (f == NULL) error("Unable to create temporary file '%s' for extsort: %s", fname, strerror(errno));
+        Rboolean ok = TRUE;
+        for (int b=0; b<n && ok; b+=es.blockrows) {
+            int m = MIN(es.blockrows, n-b);
+            for (int j=0; j<ncol && ok; j++) {
+                const char *vd = (const char *)DATAPTR(VECTOR_ELT(x, j)) + (size_t)from*size[j];
+                if (!op) {
+                    ok = fwrite(vd + (size_t)b*size[j], size[j], m, f) == (size_t)m;
+                    continue;
+                }
+                if (size[j] == 4) {
+                    for (int i=0; i<m; i++) ((int *)wbuf)[i] = ((const int *)vd)[op[b+i]-1];
+                } else {
+                    for (int i=0; i<m; i++) ((double *)wbuf)[i] = ((const double *)vd)[op[b+i]-1];   // 8 bytes including pointers, as reorder
+                }
+                ok = fwrite(wbuf, size[j], m, f) == (size_t)m;
+            }
+        }
+        int err = errno;
+        if (fclose(f) != 0 && ok) { ok = FALSE; err = errno; }
+        if (!ok) error("Unable to write temporary file '%s' for extsort (is the disk full?): %s", fname, strerror(err));
+        es.chunks[c].left = n;
+        UNPROTECT(1);
+    }
+    UNPROTECT(2);
+
+    // 2. Merge the chunks back into x with a heap of them ordered by their next row. Everything that could fail (other
+    // than a read) is done before x is touched.
+    char *colp[ncol];
+    for (int j=0; j<ncol; j++) colp[j] = (char *)DATAPTR(VECTOR_ELT(x, j));
+    for (int c=0; c<es.nchunk; c++) {
+        es.chunks[c].buf = R_alloc(es.blockrows, rowbytes);
+        es.chunks[c].keyp = (void **)R_alloc(nkey, sizeof(void *));
+        for (int k=0; k<nkey; k++) es.chunks[c].keyp[k] = es.chunks[c].buf + (size_t)es.blockrows*es.keys[k].off;
+    }
+    int *heap = (int *)R_alloc(es.nchunk, sizeof(int)), nheap = 0;
+    for (int c=0; c<es.nchunk; c++) {
+        extfname(&es, c, fname, fnamelen);
+        es.chunks[c].f = fopen(fname, "rb");
+        if (es.chunks[c].f == NULL || !extread(&es, es.chunks+c, ncol, off, size)) {
+            int err = errno;
+            extcleanup(&es);
+            error("Unable to read temporary file '%s' for extsort: %s", fname, strerror(err));
+        }
+        heap[nheap++] = c;
+    }
+    for (int i=nheap/2-1; i>=0; i--) extsiftdown(&es, heap, nheap, i);
+    int pos = 0, failed = -1;
+    while (nheap) {
+        struct extChunk *ch = es.chunks + heap[0];
+        for (int j=0; j<ncol; j++) {
+            const char *src = ch->buf + (size_t)es.blockrows*off[j] + (size_t)ch->at*size[j];
+            if (size[j] == 4) ((int *)colp[j])[pos] = *(const int *)src;
+            else ((double *)colp[j])[pos] = *(const double *)src;
+        }
+        pos++;
+        if (++ch->at == ch->nbuf) {
+            if (!ch->left) heap[0] = heap[--nheap];
+            else if (!extread(&es, ch, ncol, off, size)) { failed = heap[0]; break; }
+        }
+        if (nheap) extsiftdown(&es, heap, nheap, 0);
+    }
+    extcleanup(&es);
+    if (failed >= 0) error("Unable to read back the temporary file of chunk %d after %d of %d rows were merged. x has been partly overwritten and is now invalid.", failed+1, pos, nrow);
+    if (verbose) Rprintf("extsort: merged %d rows\n", pos);
+    return ScalarLogical(TRUE);
+}
+
 // reverse a vector - equivalent of rev(x) in base, but implemented in C and about 12x faster (on 1e8)
 SEXP setrev(SEXP x) {
     R_len_t j, n, len;